@@ -45,9 +45,11 @@ int dbrelay_admin_kill(dbrelay_request_t *request, char *sock_path);
 u_char *dbrelay_admin_tables(dbrelay_request_t *request);
 u_char *dbrelay_admin_columns(dbrelay_request_t *request);
 u_char *dbrelay_admin_pkey(dbrelay_request_t *request);
+u_char *dbrelay_admin_slowlog(dbrelay_request_t *request);
+u_char *dbrelay_admin_statements(dbrelay_request_t *request);
 static int check_params(char **params, int needed);
 
-extern dbrelay_dbapi_t *api;
+extern __thread dbrelay_dbapi_t *api;
 
 char *dbrelay_admin_result_text(int ret)
 {
@@ -63,7 +65,7 @@ static int check_params(char **params, int needed)
    int i;
 
    for (i=0; i<needed; i++)
-      if (params[0]==NULL) return 0;
+      if (params==NULL || params[0]==NULL) return 0;
    return 1;
 }
 u_char *dbrelay_db_cmd(dbrelay_request_t *request)
@@ -86,6 +88,12 @@ u_char *dbrelay_db_cmd(dbrelay_request_t *request)
       if (!check_params(request->params, 1)) 
          return (u_char *) dbrelay_json_error("No parameter specified");
       return (u_char *) dbrelay_admin_pkey(request);
+   } else if (!strcmp(request->cmd, "slowlog")) {
+      return (u_char *) dbrelay_admin_slowlog(request);
+   } else if (!strcmp(request->cmd, "statements")) {
+      return (u_char *) dbrelay_admin_statements(request);
+   } else if (!strcmp(request->cmd, "statements_reset")) {
+      dbrelay_statements_reset();
    } else {
       return (u_char *) dbrelay_json_error("Unknown admin command");
    }
@@ -108,18 +116,24 @@ u_char *dbrelay_admin_tables(dbrelay_request_t *request)
 {
 
    dbrelay_log_debug(request, "calling tables");
+   if (!dbrelay_db_select_api(request)) 
+      return (u_char *) dbrelay_json_error("Unknown sql_dbtype");
    request->sql = api->catalogsql(DBRELAY_DBCMD_TABLES, NULL);
    return dbrelay_db_run_query(request);
 }
 u_char *dbrelay_admin_columns(dbrelay_request_t *request)
 {
    dbrelay_log_debug(request, "calling columns");
+   if (!dbrelay_db_select_api(request)) 
+      return (u_char *) dbrelay_json_error("Unknown sql_dbtype");
    request->sql = api->catalogsql(DBRELAY_DBCMD_COLUMNS, request->params);
    dbrelay_log_debug(request, "sql %s", request->sql);
    return dbrelay_db_run_query(request);
 }
 u_char *dbrelay_admin_pkey(dbrelay_request_t *request)
 {
+   if (!dbrelay_db_select_api(request)) 
+      return (u_char *) dbrelay_json_error("Unknown sql_dbtype");
    request->sql = api->catalogsql(DBRELAY_DBCMD_PKEY, request->params);
    return dbrelay_db_run_query(request);
 }
@@ -165,6 +179,138 @@ int dbrelay_admin_kill(dbrelay_request_t *request, char *sock_path)
    }
    return SUCCESS;
 }
+/*
+ * most recent slow queries first, param0 optionally limits how many
+ */
+u_char *dbrelay_admin_slowlog(dbrelay_request_t *request)
+{
+   dbrelay_slowlog_entry_t *entries;
+   dbrelay_slowlog_entry_t *e;
+   json_t *json = json_new();
+   u_char *json_output;
+   char tmpstr[100];
+   struct tm *ts;
+   int i, n, max = 256;
+
+   if (check_params(request->params, 1) && atoi(request->params[0]) > 0)
+      max = atoi(request->params[0]);
+   if (max > 256) max = 256;
+
+   entries = (dbrelay_slowlog_entry_t *) malloc(sizeof(dbrelay_slowlog_entry_t) * max);
+   n = dbrelay_slowlog_read(entries, max);
+
+   json_new_object(json);
+   json_add_key(json, "slowlog");
+   json_new_array(json);
+   for (i=0; i<n; i++) {
+      e = &entries[i];
+      json_new_object(json);
+      ts = localtime(&e->ts);
+      strftime(tmpstr, sizeof(tmpstr), "%Y-%m-%d %H:%M:%S", ts);
+      json_add_string(json, "time", tmpstr);
+      json_add_string(json, "sql", e->sql);
+      if (e->sql_len >= sizeof(e->sql)) {
+         sprintf(tmpstr, "%lu", (unsigned long) e->sql_len);
+         json_add_number(json, "sql_length", tmpstr);
+      }
+      sprintf(tmpstr, "%d", e->nparams);
+      json_add_number(json, "params", tmpstr);
+      json_add_string(json, "sql_server", e->sql_server);
+      json_add_string(json, "sql_database", e->sql_database);
+      json_add_string(json, "query_tag", e->query_tag);
+      json_add_key(json, "timings");
+      json_new_object(json);
+      sprintf(tmpstr, "%lu", e->timings.shm_wait);
+      json_add_number(json, "shm_wait_us", tmpstr);
+      sprintf(tmpstr, "%lu", e->timings.connect);
+      json_add_number(json, "connect_us", tmpstr);
+      sprintf(tmpstr, "%lu", e->timings.exec);
+      json_add_number(json, "exec_us", tmpstr);
+      sprintf(tmpstr, "%lu", e->timings.fetch);
+      json_add_number(json, "fetch_us", tmpstr);
+      sprintf(tmpstr, "%lu", e->timings.serialize);
+      json_add_number(json, "serialize_us", tmpstr);
+      sprintf(tmpstr, "%lu", e->timings.total);
+      json_add_number(json, "total_us", tmpstr);
+      json_end_object(json);
+      sprintf(tmpstr, "%lu", e->timings.rows);
+      json_add_number(json, "rows", tmpstr);
+      json_end_object(json);
+   }
+   json_end_array(json);
+   json_end_object(json);
+
+   free(entries);
+   json_output = (u_char *) json_to_string(json);
+   json_free(json);
+
+   return json_output;
+}
+static int compare_total_time(const void *a, const void *b)
+{
+   const dbrelay_statement_t *s1 = a, *s2 = b;
+
+   if (s1->total_us == s2->total_us) return 0;
+   return s1->total_us < s2->total_us ? 1 : -1;
+}
+/*
+ * statement statistics, most total time first, param0 optionally limits
+ * how many (default 100)
+ */
+u_char *dbrelay_admin_statements(dbrelay_request_t *request)
+{
+   dbrelay_statement_t *stmts;
+   dbrelay_statement_t *stmt;
+   json_t *json = json_new();
+   u_char *json_output;
+   char tmpstr[100];
+   int i, n, max = 100;
+
+   if (check_params(request->params, 1) && atoi(request->params[0]) > 0)
+      max = atoi(request->params[0]);
+
+   stmts = dbrelay_statements_read(&n);
+   if (n) qsort(stmts, n, sizeof(dbrelay_statement_t), compare_total_time);
+   if (n > max) n = max;
+
+   json_new_object(json);
+   json_add_key(json, "statements");
+   json_new_array(json);
+   for (i=0; i<n; i++) {
+      stmt = &stmts[i];
+      json_new_object(json);
+      sprintf(tmpstr, "%016llx", stmt->fingerprint);
+      json_add_string(json, "fingerprint", tmpstr);
+      json_add_string(json, "query", stmt->query);
+      sprintf(tmpstr, "%lu", stmt->calls);
+      json_add_number(json, "calls", tmpstr);
+      sprintf(tmpstr, "%lu", stmt->errors);
+      json_add_number(json, "errors", tmpstr);
+      sprintf(tmpstr, "%lu", stmt->total_us);
+      json_add_number(json, "total_us", tmpstr);
+      sprintf(tmpstr, "%lu", stmt->total_us / stmt->calls);
+      json_add_number(json, "mean_us", tmpstr);
+      sprintf(tmpstr, "%lu", stmt->min_us);
+      json_add_number(json, "min_us", tmpstr);
+      sprintf(tmpstr, "%lu", stmt->max_us);
+      json_add_number(json, "max_us", tmpstr);
+      sprintf(tmpstr, "%lu", dbrelay_statement_percentile(stmt, 99));
+      json_add_number(json, "p99_us", tmpstr);
+      sprintf(tmpstr, "%lu", stmt->rows);
+      json_add_number(json, "rows", tmpstr);
+      sprintf(tmpstr, "%lu", stmt->bytes);
+      json_add_number(json, "bytes", tmpstr);
+      json_end_object(json);
+   }
+   json_end_array(json);
+   json_end_object(json);
+
+   if (stmts) free(stmts);
+   json_output = (u_char *) json_to_string(json);
+   json_free(json);
+
+   return json_output;
+}
 u_char *dbrelay_json_error(char *error_string)
 {
    u_char *json_output;
@@ -0,0 +1,141 @@
+/*
+ * DB Relay is an HTTP module built on the NGiNX webserver platform which 
+ * communicates with a variety of database servers and returns JSON formatted 
+ * data.
+ * 
+ * Copyright (C) 2008-2010 Getco LLC
+ * 
+ * This program is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by the Free 
+ * Software Foundation, either version 3 of the License, or (at your option) 
+ * any later version. In addition, redistributions in source code and in binary 
+ * form must 
+ * include the above copyright notices, and each of the following disclaimers. 
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS “AS IS” 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANY COPYRIGHT OWNERS OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Columnar row batches for api->fetch_batch.  Drivers whose client library
+ * keeps fetched rows around (ODBC block cursors, libpq results) point the
+ * batch straight at them, the rest copy each value into a chain of blocks
+ * that is rewound, not freed, between batches.
+ */
+
+#include "dbrelay.h"
+
+dbrelay_batch_t *dbrelay_batch_new(int numcols, int maxrows)
+{
+   dbrelay_batch_t *batch = (dbrelay_batch_t *) malloc(sizeof(dbrelay_batch_t));
+
+   memset(batch, 0, sizeof(dbrelay_batch_t));
+   batch->numcols = numcols;
+   batch->maxrows = maxrows;
+   batch->nullbytes = (maxrows + 7) / 8;
+   batch->values = (char **) calloc(numcols ? numcols * maxrows : 1, sizeof(char *));
+   batch->lengths = (int *) calloc(numcols ? numcols * maxrows : 1, sizeof(int));
+   batch->nulls = (unsigned char *) calloc(numcols ? numcols * batch->nullbytes : 1, 1);
+   batch->quotes = (unsigned char *) calloc(numcols ? numcols * batch->nullbytes : 1, 1);
+   batch->quoted = (unsigned char *) calloc(numcols ? numcols : 1, 1);
+
+   return batch;
+}
+void dbrelay_batch_free(dbrelay_batch_t *batch)
+{
+   dbrelay_batch_block_t *block, *next;
+
+   if (!batch) return;
+   for (block=batch->blocks; block; block=next) {
+      next = block->next;
+      free(block);
+   }
+   free(batch->values);
+   free(batch->lengths);
+   free(batch->nulls);
+   free(batch->quotes);
+   free(batch->quoted);
+   free(batch);
+}
+/* called by fetch_batch before filling, keeps the first block for reuse */
+void dbrelay_batch_reset(dbrelay_batch_t *batch)
+{
+   dbrelay_batch_block_t *block, *next;
+
+   batch->rows = 0;
+   memset(batch->nulls, 0, batch->numcols * batch->nullbytes);
+   memset(batch->quotes, 0, batch->numcols * batch->nullbytes);
+   if (!batch->blocks) return;
+   for (block=batch->blocks->next; block; block=next) {
+      next = block->next;
+      free(block);
+   }
+   batch->blocks->next = NULL;
+   batch->blocks->used = 0;
+}
+/* len bytes that stay put until the next reset */
+char *dbrelay_batch_alloc(dbrelay_batch_t *batch, size_t len)
+{
+   dbrelay_batch_block_t *block = batch->blocks;
+   size_t size;
+   char *p;
+
+   if (!block || block->size - block->used < len) {
+      size = len > DBRELAY_BATCH_BLOCK ? len : DBRELAY_BATCH_BLOCK;
+      block = (dbrelay_batch_block_t *) malloc(sizeof(dbrelay_batch_block_t) + size);
+      block->size = size;
+      block->used = 0;
+      /* the head is the block being filled */
+      block->next = batch->blocks;
+      batch->blocks = block;
+   }
+   p = block->data + block->used;
+   block->used += len;
+   return p;
+}
+/* value must outlive the batch, NULL marks a NULL */
+void dbrelay_batch_set(dbrelay_batch_t *batch, int col, int row, char *value, int len)
+{
+   if (!value) {
+      batch->nulls[col * batch->nullbytes + row / 8] |= 1 << (row % 8);
+      DBRELAY_BATCH_VALUE(batch, col, row) = NULL;
+      DBRELAY_BATCH_LENGTH(batch, col, row) = 0;
+      return;
+   }
+   DBRELAY_BATCH_VALUE(batch, col, row) = value;
+   DBRELAY_BATCH_LENGTH(batch, col, row) = len;
+}
+/* as dbrelay_batch_set, for values in buffers the driver will reuse */
+void dbrelay_batch_copy(dbrelay_batch_t *batch, int col, int row, char *value, int len)
+{
+   char *copy;
+
+   if (!value) {
+      dbrelay_batch_set(batch, col, row, NULL, 0);
+      return;
+   }
+   copy = dbrelay_batch_alloc(batch, len);
+   memcpy(copy, value, len);
+   dbrelay_batch_set(batch, col, row, copy, len);
+}
+/* quote this value even though its column isn't, NaN for one */
+void dbrelay_batch_quote(dbrelay_batch_t *batch, int col, int row)
+{
+   batch->quotes[col * batch->nullbytes + row / 8] |= 1 << (row % 8);
+}
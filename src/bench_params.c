@@ -0,0 +1,105 @@
+/*
+ * DB Relay is an HTTP module built on the NGiNX webserver platform which 
+ * communicates with a variety of database servers and returns JSON formatted 
+ * data.
+ * 
+ * Copyright (C) 2008-2010 Getco LLC
+ * 
+ * This program is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by the Free 
+ * Software Foundation, either version 3 of the License, or (at your option) 
+ * any later version. In addition, redistributions in source code and in binary 
+ * form must 
+ * include the above copyright notices, and each of the following disclaimers. 
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS “AS IS” 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANY COPYRIGHT OWNERS OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Benchmark for dbrelay_sql_bind_params(), builds IN-list style statements
+ * with 1 to 1000 placeholders and reports the time per substitution.
+ *
+ *   make bench_params && ./bench_params [iterations]
+ */
+
+#include <sys/time.h>
+#include "dbrelay.h"
+
+static int counts[] = { 1, 10, 50, 100, 250, 500, 1000, 0 };
+
+static double
+now_usec()
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+static char *
+build_sql(int n)
+{
+   stringbuf_t *sb = sb_new(NULL);
+   char *sql;
+   int i;
+
+   sb_append(sb, "-- are we there yet?\nSELECT id, name, 'why?' AS q FROM reports /* any ? here is skipped */ WHERE region = ? AND id IN (");
+   for (i=1; i<n; i++) sb_append(sb, i==1 ? "?" : ", ?");
+   sb_append(sb, ")");
+   sql = sb_to_char(sb);
+   sb_free(sb);
+   return sql;
+}
+int
+main(int argc, char **argv)
+{
+   int iterations = argc > 1 ? atoi(argv[1]) : 10000;
+   char **params;
+   char *sql, *out;
+   char tmp[30];
+   double start, elapsed;
+   int i, j, n;
+
+   printf("%8s %10s %12s %12s\n", "params", "sql bytes", "usec/call", "nsec/param");
+   for (j=0; counts[j]; j++) {
+      n = counts[j];
+      sql = build_sql(n);
+      params = (char **) calloc(n + 1, sizeof(char *));
+      params[0] = strdup("varchar:EMEA");
+      for (i=1; i<n; i++) {
+         sprintf(tmp, "int:%d", 100000 + i);
+         params[i] = strdup(tmp);
+      }
+
+      start = now_usec();
+      for (i=0; i<iterations; i++) {
+         out = dbrelay_sql_bind_params(sql, params, NULL);
+         free(out);
+      }
+      elapsed = now_usec() - start;
+
+      printf("%8d %10lu %12.3f %12.1f\n", n, (unsigned long) strlen(sql), 
+         elapsed / iterations, elapsed * 1000.0 / iterations / n);
+
+      for (i=0; i<n; i++) free(params[i]);
+      free(params);
+      free(sql);
+   }
+   return 0;
+}
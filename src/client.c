@@ -103,10 +103,15 @@ dbrelay_conn_send_request(int s, dbrelay_request_t *request, int *error)
    int in_ptr = -1;
    char tmp[20];
    int t;
+   int cancel_sent = 0;
+   dbrelay_timings_t timings;
 
    *error = 2;
 
    dbrelay_log_debug(request, "setting options");
+   /* a connector may host several named connections, pick ours first */
+   if (dbrelay_conn_set_option(s, "SESSION", request->connection_name)<0) 
+      return dbrelay_conn_socket_error(request);
    if (dbrelay_conn_set_option(s, "SERVER", request->sql_server)<0) 
       return dbrelay_conn_socket_error(request);
    dbrelay_log_debug(request, "SERVER sent");
@@ -122,11 +127,18 @@ dbrelay_conn_send_request(int s, dbrelay_request_t *request, int *error)
    dbrelay_log_info(request, "timeout %s", tmp);
    if (dbrelay_conn_set_option(s, "TIMEOUT", tmp)<0) 
       return dbrelay_conn_socket_error(request);
+   sprintf(tmp, "%ld", request->query_timeout);
+   if (dbrelay_conn_set_option(s, "QUERYTIMEOUT", tmp)<0) 
+      return dbrelay_conn_socket_error(request);
    sprintf(tmp, "%lu", request->flags);
    if (dbrelay_conn_set_option(s, "FLAGS", tmp)<0) 
       return dbrelay_conn_socket_error(request);
    if (dbrelay_conn_set_option(s, "APPNAME", request->connection_name)<0) 
       return dbrelay_conn_socket_error(request);
+   if (strlen(request->sql_dbtype)) {
+      if (dbrelay_conn_set_option(s, "DBTYPE", request->sql_dbtype)<0) 
+         return dbrelay_conn_socket_error(request);
+   }
 
    if (dbrelay_socket_send_string(s, ":SQL BEGIN\n")<0) 
       return dbrelay_conn_socket_error(request);
@@ -145,7 +157,19 @@ dbrelay_conn_send_request(int s, dbrelay_request_t *request, int *error)
 
    sb_rslt = sb_new(NULL);
    dbrelay_log_debug(request, "receiving results");
-   while ((t=dbrelay_socket_recv_string(s, in_buf, &in_ptr, out_buf, 0))>0) {
+   while ((t=dbrelay_socket_recv_string(s, in_buf, &in_ptr, out_buf, DBRELAY_CANCEL_POLL))>0 || t==DBRELAY_SOCKET_TIMEOUT) {
+      if (t==DBRELAY_SOCKET_TIMEOUT) {
+         /* pass a client disconnect on, the connector answers with an error */
+         if (!cancel_sent && dbrelay_db_check_cancel(request)) {
+            dbrelay_log_info(request, "sending cancel to connector");
+            if (dbrelay_socket_send_string(s, ":CANCEL\n")<0) {
+               t = -1;
+               break;
+            }
+            cancel_sent = 1;
+         }
+         continue;
+      }
       if (out_buf[strlen(out_buf)-1]=='\n') out_buf[strlen(out_buf)-1]='\0';
       //dbrelay_log_debug(request, "result line = %s", out_buf);
       if (!strcmp(out_buf, ":BYE") ||
@@ -153,6 +177,19 @@ dbrelay_conn_send_request(int s, dbrelay_request_t *request, int *error)
 	 !strcmp(out_buf, ":ERR")) break;
       //dbrelay_log_debug(request, "in %s", in_buf);
       //dbrelay_log_debug(request, "out %s", out_buf);
+      if (!results && !errors && !strncmp(out_buf, ":TIMINGS ", 9)) {
+         /* connector side phases, its login adds to our own connect time */
+         memset(&timings, 0, sizeof(timings));
+         sscanf(out_buf + 9, "%lu %lu %lu %lu %lu",
+            &timings.connect, &timings.exec, &timings.fetch,
+            &timings.serialize, &timings.rows);
+         request->timings.connect += timings.connect;
+         request->timings.exec += timings.exec;
+         request->timings.fetch += timings.fetch;
+         request->timings.serialize += timings.serialize;
+         request->timings.rows += timings.rows;
+         continue;
+      }
       if (!strcmp(out_buf, ":RESULTS END")) results = 0;
       if (!strcmp(out_buf, ":ERROR END")) errors = 0;
       //printf("%s\n", out_buf);
@@ -168,6 +205,9 @@ dbrelay_conn_send_request(int s, dbrelay_request_t *request, int *error)
 	 dbrelay_log_debug(request, "have errors\n");
 	 *error = 1;
 	 errors = 1;
+         /* the error replaces any rows streamed before the query failed */
+         sb_free(sb_rslt);
+         sb_rslt = sb_new(NULL);
       }
    }
    if (t==-1) {
@@ -221,14 +261,15 @@ dbrelay_conn_set_option(int s, char *option, char *value)
 
 pid_t dbrelay_conn_launch_connector(char *sock_path, dbrelay_request_t *request)
 {
-   char *argv[] = {"dbrelay-connector", sock_path, NULL};
+   /* standbys are started by the supervisor, with no request to hand */
+   char *argv[] = {"dbrelay-connector", sock_path, request ? NULL : "standby", NULL};
    pid_t child = 0;
    char connector_path[256]; 
    //char line[256]; 
    FILE *connector;
    struct stat statbuf;
 #ifndef CMDLINE
-     ngx_http_request_t *r = request->nginx_request;
+     ngx_http_request_t *r = request ? request->nginx_request : NULL;
 #endif
 
    //sprintf(connector_path, "%s/sbin/connector %s", DBRELAY_PREFIX, sock_path);
@@ -237,7 +278,7 @@ pid_t dbrelay_conn_launch_connector(char *sock_path, dbrelay_request_t *request)
 
    if ((child = fork())==0) {
 #ifndef CMDLINE
-     ngx_close_connection(r->connection);
+     if (r) ngx_close_connection(r->connection);
 #endif
      execv(connector_path, argv);
      //printf("cmd = %s\n", connector_path);
@@ -247,6 +288,7 @@ pid_t dbrelay_conn_launch_connector(char *sock_path, dbrelay_request_t *request)
      /* wait for connector to be ready, signaled by dead parent */
      /* waitpid fails because nginx reaps child in signal handler */
      waitpid(child, NULL, 0);
+     if (child>0) dbrelay_metrics_connector(1);
    }
 /*
      while (fgets(line, 256, connector)!=NULL) {
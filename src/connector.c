@@ -42,10 +42,11 @@
 #include <sys/time.h>
 #include <sys/signal.h>
 #include <stdarg.h>
+#include <pthread.h>
 #include "dbrelay.h"
 #include "../include/dbrelay_config.h"
 
-extern dbrelay_dbapi_t *api;
+extern __thread dbrelay_dbapi_t *api;
 
 #define SOCK_PATH "/tmp/dbrelay/connector"
 #define DEBUG 1
@@ -59,75 +60,403 @@ extern dbrelay_dbapi_t *api;
 #define RUN 5
 #define CONT 6
 #define HELO 7
+#define CANCEL 8
+#define SESSION 9
+
+/* seconds to wait for the first session before giving up */
+#define DBRELAY_CONNECTOR_IDLE 60
+
+/*
+ * A connector hosts one or more named sessions, each with its own database
+ * connection.  Every client gets a thread, and picks the session it runs
+ * against with :SET SESSION.  Clients that never do share the default 
+ * session, which is how a connector behaved when it only had one.
+ *
+ * A client collects its settings and statement on its own and only takes
+ * the session for :RUN, so a slow client doesn't hold up the others.
+ * Runs against a session are served in the order they arrive.
+ */
+typedef struct {
+   char name[DBRELAY_NAME_SZ];
+   unsigned char used;
+   unsigned int users;        /* clients attached, guarded by sessions_lock */
+   pthread_mutex_t lock;      /* guards the queue */
+   pthread_cond_t turn;
+   unsigned long next_ticket;
+   unsigned long now_serving;
+   time_t running_since;      /* 0 when no query is running */
+   dbrelay_request_t request;
+   dbrelay_connection_t conn;
+   unsigned char connected;
+   dbrelay_dbapi_t *driver;   /* that opened conn */
+   time_t last_accessed;
+} dbrelay_session_t;
+
+typedef struct {
+   dbrelay_session_t *sess;
+   char name[DBRELAY_NAME_SZ];
+   dbrelay_request_t request;  /* settings and sql until the next :RUN */
+   int receive_sql;
+   stringbuf_t *sb_sql;
+   char timeout_str[10];
+} dbrelay_client_t;
 
 void log_open();
 void log_close();
 void log_msg(char *fmt, ...);
-void timeout(int i);
-int set_timer(int secs);
-void set_signal();
+int process_line(dbrelay_client_t *client, char *line);
+int check_command(char *line, char *command, char *dest, int maxsz);
 
 char app_name[DBRELAY_NAME_SZ];
-char timeout_str[10];
-int receive_sql;
-stringbuf_t *sb_sql;
 char logfilename[256];
 
-dbrelay_request_t request;
-
 static FILE *logfile;
-struct itimerval it;
-struct timeval last_accessed;
 
-  
-/* signal callback for timeout */
-void timeout(int i)
+static dbrelay_session_t sessions[DBRELAY_CONNECTOR_SESSIONS];
+/* guards the session table, users and clients */
+static pthread_mutex_t sessions_lock = PTHREAD_MUTEX_INITIALIZER;
+/* drivers keep login errors in statics, so logins take turns */
+static pthread_mutex_t connect_lock = PTHREAD_MUTEX_INITIALIZER;
+static int clients;
+static int hosted;
+static time_t started;
+static long idle_limit = DBRELAY_CONNECTOR_IDLE;
+
+/* close a session's connection and free its slot, sessions_lock held */
+static void session_close(dbrelay_session_t *sess)
 {
-   log_msg("Timeout reached. Exiting.\n");
-   exit(0);
+   log_msg("closing session %s\n", sess->name);
+   if (sess->connected) sess->driver->close(sess->conn.db);
+   if (sess->request.sql) free(sess->request.sql);
+   if (sess->request.error_message) free(sess->request.error_message);
+   memset(&sess->request, 0, sizeof(dbrelay_request_t));
+   memset(&sess->conn, 0, sizeof(dbrelay_connection_t));
+   sess->connected = 0;
+   sess->name[0] = '\0';
+   sess->used = 0;
 }
+/* find or create the named session */
+static dbrelay_session_t *session_attach(char *name)
+{
+   dbrelay_session_t *sess = NULL, *lru = NULL;
+   int i;
+
+   pthread_mutex_lock(&sessions_lock);
+   for (i=0; i<DBRELAY_CONNECTOR_SESSIONS; i++) {
+      if (sessions[i].used && !strcmp(sessions[i].name, name)) {
+         sess = &sessions[i];
+         break;
+      }
+   }
+   if (!sess) {
+      for (i=0; i<DBRELAY_CONNECTOR_SESSIONS; i++) {
+         if (!sessions[i].used) {
+            sess = &sessions[i];
+            break;
+         }
+         if (!sessions[i].users && (!lru || sessions[i].last_accessed < lru->last_accessed))
+            lru = &sessions[i];
+      }
+      /* table is full, make room by closing the longest idle session */
+      if (!sess && lru) {
+         session_close(lru);
+         sess = lru;
+      }
+      if (sess) {
+         dbrelay_copy_string(sess->name, name, sizeof(sess->name));
+         sess->used = 1;
+         sess->last_accessed = time(NULL);
+         hosted = 1;
+         log_msg("new session %s\n", sess->name);
+      }
+   }
+   if (sess) sess->users++;
+   pthread_mutex_unlock(&sessions_lock);
 
-/* setup the timer for the specified timeout value */
-int 
-set_timer(int secs)
+   return sess;
+}
+static void session_detach(dbrelay_session_t *sess)
+{
+   pthread_mutex_lock(&sessions_lock);
+   sess->users--;
+   sess->last_accessed = time(NULL);
+   pthread_mutex_unlock(&sessions_lock);
+}
+/* wait in line for the session */
+static void session_acquire(dbrelay_session_t *sess)
+{
+   unsigned long ticket;
+
+   pthread_mutex_lock(&sess->lock);
+   ticket = sess->next_ticket++;
+   while (ticket != sess->now_serving) pthread_cond_wait(&sess->turn, &sess->lock);
+   sess->running_since = time(NULL);
+   pthread_mutex_unlock(&sess->lock);
+}
+static void session_release(dbrelay_session_t *sess)
+{
+   pthread_mutex_lock(&sess->lock);
+   sess->running_since = 0;
+   sess->last_accessed = time(NULL);
+   if (sess->connected && !sess->driver->isalive(sess->conn.db)) {
+      sess->connected = 0;
+   }
+   sess->now_serving++;
+   pthread_cond_broadcast(&sess->turn);
+   pthread_mutex_unlock(&sess->lock);
+}
+/*
+ * Stands in for the old per process alarm.  Idle sessions are closed once
+ * their connection timeout passes, a query running past the hard timeout
+ * takes the process down, and the process exits once it has no sessions
+ * and no clients left.
+ */
+static void *session_reaper(void *arg)
 {
-  gettimeofday(&last_accessed, NULL);
-  it.it_interval.tv_sec = 0;
-  it.it_interval.tv_usec = 0;
-  it.it_value.tv_sec = secs; 
-  it.it_value.tv_usec = 0;
-  setitimer(ITIMER_REAL, &it,0);
+   dbrelay_session_t *sess;
+   time_t now;
+   long timeout;
+   int i, active;
+
+   for (;;) {
+      sleep(1);
+      now = time(NULL);
+      active = 0;
+      pthread_mutex_lock(&sessions_lock);
+      for (i=0; i<DBRELAY_CONNECTOR_SESSIONS; i++) {
+         sess = &sessions[i];
+         if (!sess->used) continue;
+         if (sess->running_since && now - sess->running_since > DBRELAY_HARD_TIMEOUT) {
+            log_msg("session %s reached the hard timeout. Exiting.\n", sess->name);
+            exit(0);
+         }
+         if (sess->users) {
+            active++;
+            continue;
+         }
+         timeout = sess->request.connection_timeout;
+         if (!timeout) timeout = DBRELAY_CONNECTOR_IDLE;
+         if (now - sess->last_accessed > timeout) session_close(sess);
+         else active++;
+      }
+      if (!active && !clients && (hosted || now - started > idle_limit)) {
+         log_msg("Timeout reached. Exiting.\n");
+         exit(0);
+      }
+      pthread_mutex_unlock(&sessions_lock);
+   }
+   return NULL;
 }
-void 
-set_signal()
+/* hand the client's settings and statement to the session it runs on */
+static void session_load(dbrelay_session_t *sess, dbrelay_request_t *from)
 {
-   struct sigaction sigact;
-   sigset_t sigmask;
-
-   memset(&sigact, 0, sizeof(sigact));
-   sigact.sa_handler = &timeout;
-   sigfillset(&sigmask);
-   sigact.sa_mask = sigmask;
-   sigaction(SIGALRM, &sigact, NULL); 
+   dbrelay_request_t *request = &sess->request;
+
+   strcpy(request->sql_server, from->sql_server);
+   strcpy(request->sql_port, from->sql_port);
+   strcpy(request->sql_database, from->sql_database);
+   strcpy(request->sql_user, from->sql_user);
+   strcpy(request->sql_password, from->sql_password);
+   strcpy(request->connection_name, from->connection_name);
+   strcpy(request->sql_dbtype, from->sql_dbtype);
+   request->connection_timeout = from->connection_timeout;
+   request->query_timeout = from->query_timeout;
+   request->flags = from->flags;
+   if (from->sql) {
+      if (request->sql) free(request->sql);
+      request->sql = from->sql;
+      from->sql = NULL;
+   }
 }
+static void run_session(dbrelay_session_t *sess, int s2)
+{
+   dbrelay_request_t *request = &sess->request;
+   struct timeval tv;
+   char timings[128];
+   char *results;
 
-int
-main(int argc, char **argv)
+   if (request->error_message) request->error_message[0]='\0';
+   memset(&request->timings, 0, sizeof(request->timings));
+   request->cancelled = 0;
+   // watch the client for :CANCEL or a dropped socket while we run
+   request->client_sock = s2;
+   // a client that gave up while waiting in line doesn't run
+   if (dbrelay_db_check_cancel(request)) {
+      log_msg("cancelled while queued\n"); 
+      dbrelay_socket_send_string(s2, ":ERROR BEGIN\n");
+      dbrelay_socket_send_string(s2, dbrelay_exec_error(&sess->conn, request));
+      dbrelay_socket_send_string(s2, "\n");
+      dbrelay_socket_send_string(s2, ":ERROR END\n");
+      dbrelay_socket_send_string(s2, ":OK\n");
+      request->client_sock = 0;
+      return;
+   }
+   if (!dbrelay_db_select_api(request)) {
+      log_msg("no driver for %s\n", request->sql_dbtype); 
+      dbrelay_socket_send_string(s2, ":ERROR BEGIN\n");
+      dbrelay_socket_send_string(s2, "Unknown sql_dbtype.\n");
+      dbrelay_socket_send_string(s2, ":ERROR END\n");
+      dbrelay_socket_send_string(s2, ":OK\n");
+      request->client_sock = 0;
+      return;
+   }
+   // sql_dbtype changed since the session logged in
+   if (sess->connected && sess->driver != api) {
+      sess->driver->close(sess->conn.db);
+      sess->connected = 0;
+   }
+   log_msg("running\n"); 
+#if PERSISTENT_CONN
+   if (!sess->connected) {
+#endif
+       gettimeofday(&tv, NULL);
+       pthread_mutex_lock(&connect_lock);
+       sess->conn.db = api->connect(request);
+       request->timings.connect = dbrelay_usecs_since(&tv);
+       if (!sess->conn.db) {
+          log_msg("login is null\n"); 
+          dbrelay_socket_send_string(s2, ":ERROR BEGIN\n");
+          log_msg("returning error %s\n", api->error(NULL));
+          dbrelay_socket_send_string(s2, api->error(NULL));
+          pthread_mutex_unlock(&connect_lock);
+          dbrelay_socket_send_string(s2, "\n");
+          dbrelay_socket_send_string(s2, ":ERROR END\n");
+          dbrelay_socket_send_string(s2, ":OK\n");
+          request->client_sock = 0;
+          return;
+       }
+       pthread_mutex_unlock(&connect_lock);
+       sess->connected = 1;
+       sess->driver = api;
+#if PERSISTENT_CONN
+   }
+#endif
+   // large results are sent on as they are fetched
+   request->stream_sock = s2;
+   request->streamed = 0;
+   results = (char *) dbrelay_exec_query(&sess->conn, request, request->sql);
+   request->client_sock = 0;
+   request->stream_sock = 0;
+   log_msg("addr = %lu\n", results);
+   // close off a partial result, the error that follows replaces it
+   if (request->streamed && results == NULL) {
+      dbrelay_socket_send_string(s2, "\n");
+      dbrelay_socket_send_string(s2, ":RESULTS END\n");
+   }
+   if (results == NULL) {
+      log_msg("results are null\n"); 
+      log_msg("error is %s\n", dbrelay_exec_error(&sess->conn, request));
+      dbrelay_socket_send_string(s2, ":ERROR BEGIN\n");
+      dbrelay_socket_send_string(s2, dbrelay_exec_error(&sess->conn, request));
+      dbrelay_socket_send_string(s2, "\n");
+      dbrelay_socket_send_string(s2, ":ERROR END\n");
+   } else {
+      log_msg("sending results\n"); 
+      if (!request->streamed) dbrelay_socket_send_string(s2, ":RESULTS BEGIN\n");
+      dbrelay_socket_send_string(s2, results);
+      dbrelay_socket_send_string(s2, "\n");
+      dbrelay_socket_send_string(s2, ":RESULTS END\n");
+   }
+   sprintf(timings, ":TIMINGS %lu %lu %lu %lu %lu\n",
+      request->timings.connect, request->timings.exec,
+      request->timings.fetch, request->timings.serialize,
+      request->timings.rows);
+   dbrelay_socket_send_string(s2, timings);
+   dbrelay_socket_send_string(s2, ":OK\n");
+   log_msg("done\n"); 
+#if !PERSISTENT_CONN
+   api->close(sess->conn.db);
+   sess->connected = 0;
+#endif
+   free(results);
+}
+static void *serve_client(void *arg)
 {
-   unsigned int s, s2;
+   int s2 = (int) (long) arg;
    char line[DBRELAY_SOCKET_BUFSIZE];
    char in_buf[DBRELAY_SOCKET_BUFSIZE];
    char buf[30];
    int in_ptr = -1;
-   int len, pos = 0;
    int done = 0, ret, t = 0;
-   char *results;
+   dbrelay_client_t client;
+
+   memset(&client, 0, sizeof(client));
+
+   // get a newline terminated string from the client
+   while (!done && ((t=dbrelay_socket_recv_string(s2, in_buf, &in_ptr, line, 30))>0 || t==DBRELAY_SOCKET_TIMEOUT)) {
+        // idle client, keep waiting
+        if (t==DBRELAY_SOCKET_TIMEOUT) continue;
+        // neither the password nor the query text goes to the log
+        if (!client.receive_sql && (strlen(line)<9 || strncmp(line, ":SET PASS", 9))) log_msg("line = %s\n", line);
+        ret = process_line(&client, line);
+        
+        if (ret == HELO) {
+           sprintf(buf, ":PID %lu\n", getpid());
+           dbrelay_socket_send_string(s2, buf);
+        } else if (ret == SESSION) {
+           if (client.sess) session_detach(client.sess);
+           if ((client.sess = session_attach(client.name))) {
+              dbrelay_socket_send_string(s2, ":OK\n");
+           } else {
+              log_msg("no room for session %s\n", client.name);
+              dbrelay_socket_send_string(s2, ":ERR\n");
+           }
+        } else if (ret == QUIT) {
+           log_msg("disconnect.\n"); 
+           dbrelay_socket_send_string(s2, ":BYE\n");
+           done = 1;
+        } else if (ret == RUN) {
+           // a client that never names a session uses the default one
+           if (!client.sess && !(client.sess = session_attach(""))) {
+              log_msg("no session available\n");
+              dbrelay_socket_send_string(s2, ":ERR\n");
+              continue;
+           }
+           session_acquire(client.sess);
+           session_load(client.sess, &client.request);
+           run_session(client.sess, s2);
+           session_release(client.sess);
+        } else if (ret == DIE) {
+           log_msg("sending BYE.\n"); 
+           dbrelay_socket_send_string(s2, ":BYE\n");
+           close(s2);
+           log_msg("exiting.\n"); 
+           log_close();
+           exit(0);
+        } else if (ret == OK) {
+           dbrelay_socket_send_string(s2, ":OK\n");
+        } else if (ret == CONT) {
+           log_msg("(cont)\n"); 
+        } else if (ret == CANCEL) {
+           // cancel arrived after the query finished, nothing to do
+           log_msg("late cancel ignored\n"); 
+        } else {
+           log_msg("ret = %d.\n", ret); 
+           dbrelay_socket_send_string(s2, ":ERR\n");
+        }
+   } // recv
+   if (t<=0) log_msg("client connection broken\n");
+   close(s2);
+   if (client.sess) session_detach(client.sess);
+   if (client.sb_sql) sb_free(client.sb_sql);
+   if (client.request.sql) free(client.request.sql);
+
+   pthread_mutex_lock(&sessions_lock);
+   clients--;
+   pthread_mutex_unlock(&sessions_lock);
+
+   return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+   int s, s2;
    char *sock_path;
-   dbrelay_connection_t conn;
-   unsigned char connected = 0;
    pid_t pid;
-   int tries = 0;
-   struct timeval now;
+   int i, tries = 0;
+   pthread_t thread;
+   pthread_attr_t attr;
 
    if (argc>1) {
       sock_path = argv[1];
@@ -142,138 +471,65 @@ main(int argc, char **argv)
       exit(0);
    }
 
-   set_timer(60); // set a default timer in case nobody attaches
+   // standbys wait until they are handed out
+   if (argc>2 && !strcmp(argv[2], "standby")) idle_limit = DBRELAY_HARD_TIMEOUT;
+   started = time(NULL);
 
-   api->init();
+   dbrelay_db_init_apis();
 
    log_open();
    log_msg("Using socket path %s\n", sock_path);
 
-   // register SIGALRM handler
-   //signal(SIGALRM,timeout); 
-   set_signal(); 
+   for (i=0; i<DBRELAY_CONNECTOR_SESSIONS; i++) {
+      pthread_mutex_init(&sessions[i].lock, NULL);
+      pthread_cond_init(&sessions[i].turn, NULL);
+   }
+
+   pthread_attr_init(&attr);
+   pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+   if (pthread_create(&thread, &attr, session_reaper, NULL)) {
+      log_msg("couldn't start session reaper\n");
+      exit(1);
+   }
 
    for (;;) {
-      done = 0;
       // wait for connection
+      log_msg("waiting for new connection\n");
+      s2 = dbrelay_socket_accept(s);
+      if (s2==-1) {
+         log_msg("socket accept had error\n");
+         if (++tries>3) { exit(0); }
+         continue;
+      }
+      if (s2==0) continue;
       tries = 0;
-      do {
-         log_msg("waiting for new connection\n");
-         s2 = dbrelay_socket_accept(s);
-         if (s2==-1) {
-            log_msg("socket accept had error\n");
-            tries++;
-            if (tries>3) { exit(0); }
-         }
-         gettimeofday(&now, NULL);
-         if (request.connection_timeout && now.tv_sec - last_accessed.tv_sec > request.connection_timeout) {
-            log_msg("manual timeout occurred\n");
-            exit(0);
-         }
-
-      } while (s2==0);
      
       log_msg("connected\n");
-      in_ptr = -1;
-      // get a newline terminated string from the client
-      while (!done && (t=dbrelay_socket_recv_string(s2, in_buf, &in_ptr, line, 30))>0) {
-           if (strlen(line)<9 || strncmp(line, ":SET PASS", 9)) log_msg("line = %s\n", line);
-           ret = process_line(line);
-           
-           if (ret == HELO) {
-              sprintf(buf, ":PID %lu\n", getpid());
-              dbrelay_socket_send_string(s2, buf);
-           } else if (ret == QUIT) {
-              log_msg("disconnect.\n"); 
-              dbrelay_socket_send_string(s2, ":BYE\n");
-              close(s2);
-              done = 1;
-           } else if (ret == RUN) {
-              request.error_message[0]='\0';
-              log_msg("running\n"); 
-#if PERSISTENT_CONN
-              if (!connected) {
-#endif
-                  conn.db = api->connect(&request);
-                  connected = 1;
-                  if (!conn.db) {
-	             log_msg("login is null\n"); 
-                     dbrelay_socket_send_string(s2, ":ERROR BEGIN\n");
-                     log_msg("returning error %s\n", api->error(NULL));
-                     dbrelay_socket_send_string(s2, api->error(NULL));
-                     dbrelay_socket_send_string(s2, "\n");
-                     dbrelay_socket_send_string(s2, ":ERROR END\n");
-                     dbrelay_socket_send_string(s2, ":OK\n");
-                     return 0;
-                  }
-#if PERSISTENT_CONN
-              }
-#endif
-              log_msg("%s\n", request.sql);
-              // don't timeout during query run
-	      if (request.connection_timeout) set_timer(DBRELAY_HARD_TIMEOUT);
-              results = (char *) dbrelay_exec_query(&conn, (char *) &request.sql_database, request.sql, request.flags);
-              log_msg("addr = %lu\n", results);
-              if (results == NULL) {
-	         log_msg("results are null\n"); 
-                 log_msg("error is %s\n", api->error(conn.db));
-                 dbrelay_socket_send_string(s2, ":ERROR BEGIN\n");
-                 dbrelay_socket_send_string(s2, api->error(conn.db));
-                 dbrelay_socket_send_string(s2, "\n");
-                 dbrelay_socket_send_string(s2, ":ERROR END\n");
-              } else {
-                 log_msg("sending results\n"); 
-                 dbrelay_socket_send_string(s2, ":RESULTS BEGIN\n");
-                 log_msg("%s\n", results);
-                 log_msg("len = %d\n", strlen(results));
-                 dbrelay_socket_send_string(s2, results);
-                 dbrelay_socket_send_string(s2, "\n");
-                 dbrelay_socket_send_string(s2, ":RESULTS END\n");
-              }
-              dbrelay_socket_send_string(s2, ":OK\n");
-              log_msg("done\n"); 
-#if !PERSISTENT_CONN
-              api->close(conn.db);
-#endif
-              free(results);
-	      if (request.connection_timeout) set_timer(request.connection_timeout);
-           } else if (ret == DIE) {
-              log_msg("sending BYE.\n"); 
-              dbrelay_socket_send_string(s2, ":BYE\n");
-              close(s2);
-              log_msg("exiting.\n"); 
-              log_close();
-              exit(0);
-           } else if (ret == OK) {
-              dbrelay_socket_send_string(s2, ":OK\n");
-              if (request.connection_timeout) set_timer(request.connection_timeout);
-           } else if (ret == CONT) {
-              log_msg("(cont)\n"); 
-           } else {
-              log_msg("ret = %d.\n", ret); 
-              dbrelay_socket_send_string(s2, ":ERR\n");
-           }
-        } // recv
-        if (t<=0) log_msg("client connection broken\n");
-        receive_sql = 0;
-        if (!api->isalive(conn.db)) {
-           connected = 0;
-        }
+      pthread_mutex_lock(&sessions_lock);
+      clients++;
+      pthread_mutex_unlock(&sessions_lock);
+      if (pthread_create(&thread, &attr, serve_client, (void *) (long) s2)) {
+         log_msg("couldn't start client thread\n");
+         close(s2);
+         pthread_mutex_lock(&sessions_lock);
+         clients--;
+         pthread_mutex_unlock(&sessions_lock);
+      }
    } // for
    return 0;
 }
 int 
-process_line(char *line)
+process_line(dbrelay_client_t *client, char *line)
 {
    char arg[100];
    int len = strlen(line);
    char flag_str[10];
+   dbrelay_request_t *request = &client->request;
 
-   if (receive_sql) {
+   if (client->receive_sql) {
       log_msg("sql mode\n");
-      log_msg("line: %s\n", line);
       if (!line || strlen(line)<8 || strncmp(line, ":SQL END", 8)) {
-      	sb_append(sb_sql, line);
+      	sb_append(client->sb_sql, line);
       	//sb_append(sb_sql, "\n");
         return CONT;
       }
@@ -290,48 +546,57 @@ process_line(char *line)
    else if (check_command(line, "QUIT", NULL, 0)) return QUIT;
    else if (check_command(line, "RUN", NULL, 0)) return RUN;
    else if (check_command(line, "DIE", NULL, 0)) return DIE;
-   else if (check_command(line, "SET NAME", &request.connection_name, sizeof(request.connection_name))) {
-      log_msg("connection name %s\n");
+   else if (check_command(line, "CANCEL", NULL, 0)) return CANCEL;
+   else if (check_command(line, "SET SESSION", client->name, sizeof(client->name))) {
+      if (strlen(line) <= strlen(":SET SESSION ")) client->name[0]='\0';
+      return SESSION;
+   }
+   else if (check_command(line, "SET NAME", request->connection_name, sizeof(request->connection_name))) {
+      log_msg("connection name %s\n", request->connection_name);
       return OK;
    }
-   else if (check_command(line, "SET PORT", &request.sql_port, sizeof(request.sql_port))) return OK;
-   else if (check_command(line, "SET SERVER", &request.sql_server, sizeof(request.sql_server))) return OK;
-   else if (check_command(line, "SET DATABASE", &request.sql_database, sizeof(request.sql_database))) return OK;
-   else if (check_command(line, "SET USER", &request.sql_user, sizeof(request.sql_user))) {
-     log_msg("username %s\n", request.sql_user);
+   else if (check_command(line, "SET PORT", request->sql_port, sizeof(request->sql_port))) return OK;
+   else if (check_command(line, "SET SERVER", request->sql_server, sizeof(request->sql_server))) return OK;
+   else if (check_command(line, "SET DATABASE", request->sql_database, sizeof(request->sql_database))) return OK;
+   else if (check_command(line, "SET USER", request->sql_user, sizeof(request->sql_user))) {
+     log_msg("username %s\n", request->sql_user);
      return OK;
    }
-   else if (check_command(line, "SET PASSWORD", &request.sql_password, sizeof(request.sql_password))) return OK;
-   else if (check_command(line, "SET APPNAME", &request.connection_name, sizeof(request.connection_name))) return OK;
-   else if (check_command(line, "SET TIMEOUT", timeout_str, sizeof(timeout_str))) {
-      request.connection_timeout = atol(timeout_str);
+   else if (check_command(line, "SET PASSWORD", request->sql_password, sizeof(request->sql_password))) return OK;
+   else if (check_command(line, "SET APPNAME", request->connection_name, sizeof(request->connection_name))) return OK;
+   else if (check_command(line, "SET DBTYPE", request->sql_dbtype, sizeof(request->sql_dbtype))) return OK;
+   else if (check_command(line, "SET TIMEOUT", client->timeout_str, sizeof(client->timeout_str))) {
+      request->connection_timeout = atol(client->timeout_str);
+      return OK;
+   }
+   else if (check_command(line, "SET QUERYTIMEOUT", client->timeout_str, sizeof(client->timeout_str))) {
+      request->query_timeout = atol(client->timeout_str);
       return OK;
    }
    else if (check_command(line, "SET FLAGS", flag_str, sizeof(flag_str))) {
-      request.flags = (unsigned long) atol(flag_str);
+      request->flags = (unsigned long) atol(flag_str);
       return OK;
    }
    else if (check_command(line, "SQL", arg, sizeof(arg))) {
       if (!strcmp(arg, "BEGIN")) {
          log_msg("sql mode on\n");
-         receive_sql = 1;
-         if (request.sql) free(request.sql);
-         request.sql = NULL;
-         sb_sql = sb_new(NULL);
-      } else if (!strcmp(arg, "END")) {
+         client->receive_sql = 1;
+         if (request->sql) free(request->sql);
+         request->sql = NULL;
+         if (client->sb_sql) sb_free(client->sb_sql);
+         client->sb_sql = sb_new(NULL);
+      } else if (!strcmp(arg, "END") && client->sb_sql) {
          log_msg("sql mode off\n");
-         receive_sql = 0;
-         request.sql = sb_to_char(sb_sql);
+         client->receive_sql = 0;
+         request->sql = sb_to_char(client->sb_sql);
          //log_msg("sql");
          //log_msg(request.sql);
-         sb_free(sb_sql);
+         sb_free(client->sb_sql);
+         client->sb_sql = NULL;
       } else return ERR;
-      if (receive_sql) return CONT;
+      if (client->receive_sql) return CONT;
       else return OK;
    }
-   else if (check_command(line, "RUN", NULL, 0)) {
-      return RUN;
-   }
 
    return ERR;
 }
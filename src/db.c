@@ -32,41 +32,81 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <strings.h>
 #include "dbrelay.h"
 #include "stringbuf.h"
 #include "../include/dbrelay_config.h"
 
 #ifdef HAVE_FREETDS
 extern dbrelay_dbapi_t dbrelay_mssql_api;
-dbrelay_dbapi_t *api = &dbrelay_mssql_api;
 #endif
 
 #ifdef HAVE_MYSQL
 extern dbrelay_dbapi_t dbrelay_mysql_api;
-dbrelay_dbapi_t *api = &dbrelay_mysql_api;
 #endif
 
 #ifdef HAVE_ODBC
 extern dbrelay_dbapi_t dbrelay_odbc_api;
-dbrelay_dbapi_t *api = &dbrelay_odbc_api;
 #endif
 
+#ifdef HAVE_PGSQL
+extern dbrelay_dbapi_t dbrelay_pgsql_api;
+#endif
+
+typedef struct {
+   char *name;
+   dbrelay_dbapi_t *api;
+} dbrelay_driver_t;
+
+/* drivers built in, by sql_dbtype, the first is used when none is given */
+static dbrelay_driver_t dbrelay_drivers[] = {
+#ifdef HAVE_FREETDS
+   { "mssql", &dbrelay_mssql_api },
+   { "sybase", &dbrelay_mssql_api },
+#endif
+#ifdef HAVE_MYSQL
+   { "mysql", &dbrelay_mysql_api },
+#endif
+#ifdef HAVE_ODBC
+   { "odbc", &dbrelay_odbc_api },
+#endif
+#ifdef HAVE_PGSQL
+   { "pgsql", &dbrelay_pgsql_api },
+   { "postgresql", &dbrelay_pgsql_api },
+#endif
+   { NULL, NULL }
+};
+
+/* the driver for the request being run, per thread for the connector */
+__thread dbrelay_dbapi_t *api;
+
 #define IS_SET(x) (x && strlen(x)>0)
 #define IS_EMPTY(x) (!x || strlen(x)==0)
 #define TRUE 1
 #define FALSE 0
 
-static int dbrelay_db_fill_data(json_t *json, dbrelay_connection_t *conn);
+/* rows fetched between checks for a disconnected client */
+#define DBRELAY_CANCEL_ROWS 1000
+/* rows fetched between checks of how much a connector has buffered */
+#define DBRELAY_STREAM_ROWS 64
+/* bytes a connector buffers before sending them on */
+#define DBRELAY_STREAM_CHUNK 65536
+/* longest sleep between looks at the pool while queued for a slot, usecs */
+#define DBRELAY_POOL_WAIT_NAP 20000
+
+static int dbrelay_db_fill_data(json_t *json, dbrelay_connection_t *conn, dbrelay_request_t *request);
 static int dbrelay_db_get_connection(dbrelay_request_t *request);
+static void dbrelay_db_close_connections(dbrelay_request_t *request);
 static char *dbrelay_resolve_params(dbrelay_request_t *request, char *sql);
-static int dbrelay_find_placeholder(char *sql);
 static int dbrelay_check_request(dbrelay_request_t *request);
 static void dbrelay_write_json_log(json_t *json, dbrelay_request_t *request, char *error_string);
 void dbrelay_write_json_colinfo(json_t *json, void *db, int colnum, int *maxcolname);
-void dbrelay_write_json_column(json_t *json, void *db, int colnum, int *maxcolname);
 static void dbrelay_db_zero_connection(dbrelay_connection_t *conn, dbrelay_request_t *request);
-static void dbrelay_write_json_column_csv(json_t *json, void *db, int colnum);
-static void dbrelay_write_json_column_std(json_t *json, void *db, int colnum, char *colname);
+static unsigned int match(char *s1, char *s2);
+static char **dbrelay_batch_colnames(void *db, int numcols);
+static int dbrelay_db_fetch_rows(void *db, dbrelay_batch_t *batch);
+static void dbrelay_write_json_batch_row(json_t *json, dbrelay_batch_t *batch, int row, char **names);
+static void dbrelay_db_free_batch(char **names, dbrelay_batch_t *batch, int numcols);
 static unsigned char dbrelay_is_unnamed_column(char *colname);
 dbrelay_connection_t *dbrelay_time_get_shmem(dbrelay_request_t *request);
 void dbrelay_time_release_shmem(dbrelay_request_t *request, dbrelay_connection_t *connections);
@@ -82,6 +122,8 @@ dbrelay_connection_t *dbrelay_time_get_shmem(dbrelay_request_t *request)
    gettimeofday(&start, NULL);
    connections = dbrelay_get_shmem();
    gettimeofday(&now, NULL);
+   request->timings.shm_wait += calc_time(&start, &now);
+   dbrelay_metrics_shm_wait(calc_time(&start, &now));
    dbrelay_log_debug(request, "shmem attach time %d", calc_time(&start, &now));
    return connections;
 }
@@ -93,8 +135,46 @@ void dbrelay_time_release_shmem(dbrelay_request_t *request, dbrelay_connection_t
    gettimeofday(&start, NULL);
    dbrelay_release_shmem(connections);
    gettimeofday(&now, NULL);
+   request->timings.shm_wait += calc_time(&start, &now);
    dbrelay_log_debug(request, "shmem release time %d", calc_time(&start, &now));
 }
+dbrelay_dbapi_t *dbrelay_db_find_api(char *dbtype)
+{
+   int i;
+
+   if (IS_EMPTY(dbtype)) return dbrelay_drivers[0].api;
+
+   for (i=0; dbrelay_drivers[i].name; i++) {
+      if (!strcasecmp(dbrelay_drivers[i].name, dbtype)) return dbrelay_drivers[i].api;
+   }
+   return NULL;
+}
+/* initialise every driver built in, for processes that may use any of them */
+void dbrelay_db_init_apis()
+{
+   int i, j;
+
+   for (i=0; dbrelay_drivers[i].name; i++) {
+      /* aliases share a driver, only init it once */
+      for (j=0; j<i && dbrelay_drivers[j].api!=dbrelay_drivers[i].api; j++);
+      if (j==i) dbrelay_drivers[i].api->init();
+   }
+}
+/*
+ * point api at the driver for request's sql_dbtype, returns 0 if that 
+ * driver wasn't built in
+ */
+int dbrelay_db_select_api(dbrelay_request_t *request)
+{
+   dbrelay_dbapi_t *driver = dbrelay_db_find_api(request->sql_dbtype);
+
+   if (!driver) {
+      dbrelay_log_warn(request, "no driver for sql_dbtype %s", request->sql_dbtype);
+      return 0;
+   }
+   api = driver;
+   return 1;
+}
 static unsigned char dbrelay_is_unnamed_column(char *colname)
 {
    /* For queries such as 'select 1'
@@ -111,7 +191,7 @@ static void *dbrelay_db_open_connection(dbrelay_request_t *request)
    api->init();
    return api->connect(request);
 }
-static void dbrelay_db_populate_connection(dbrelay_request_t *request, dbrelay_connection_t *conn, void *db)
+static void dbrelay_db_populate_connection(dbrelay_request_t *request, dbrelay_connection_t *conn, void *db, dbrelay_connection_t *host)
 {
    memset(conn, '\0', sizeof(dbrelay_connection_t));
 
@@ -121,6 +201,8 @@ static void dbrelay_db_populate_connection(dbrelay_request_t *request, dbrelay_c
       strcpy(conn->sql_server, request->sql_server);
    if (IS_SET(request->sql_port)) 
       strcpy(conn->sql_port, request->sql_port);
+   if (IS_SET(request->sql_dbtype)) 
+      strcpy(conn->sql_dbtype, request->sql_dbtype);
    if (IS_SET(request->sql_user))
       strcpy(conn->sql_user, request->sql_user);
    if (IS_SET(request->sql_password))
@@ -137,6 +219,12 @@ static void dbrelay_db_populate_connection(dbrelay_request_t *request, dbrelay_c
    if (IS_SET(request->connection_name)) {
       if (IS_SET(request->sock_path)) {
          strcpy(conn->sock_path, request->sock_path);
+      } else if (host) {
+         strcpy(conn->sock_path, host->sock_path);
+         conn->helper_pid = host->helper_pid;
+         dbrelay_log_info(request, "sharing connector with slot %d", host->slot);
+      } else if (dbrelay_standby_take(conn->sock_path)) {
+         dbrelay_log_info(request, "using standby connector");
       } else {
          if (tmpnam(conn->sock_path)==NULL) {
              dbrelay_log_error(request, "Could not get new socket name");
@@ -145,6 +233,7 @@ static void dbrelay_db_populate_connection(dbrelay_request_t *request, dbrelay_c
          dbrelay_conn_launch_connector(conn->sock_path, request);
       }
       dbrelay_log_info(request, "socket name %s", conn->sock_path);
+      conn->sessions = request->connector_sessions;
       conn->tm_create = time(NULL);
       conn->tm_accessed = time(NULL);
       conn->in_use++;
@@ -161,38 +250,139 @@ static void dbrelay_db_populate_connection(dbrelay_request_t *request, dbrelay_c
 
    conn->pid = getpid();
 }
-static int dbrelay_db_alloc_connection(dbrelay_request_t *request)
+/*
+ * find a connector already hosting named connections for the same login
+ * with room for one more.  Sessions are only grouped by login, so a
+ * connector that dies takes down nobody else's connections.
+ */
+static dbrelay_connection_t *dbrelay_db_find_host(dbrelay_connection_t *connections, dbrelay_request_t *request)
+{
+   dbrelay_connection_t *conn;
+   int i, j, count;
+
+   if (request->connector_sessions<2 || IS_EMPTY(request->connection_name)) return NULL;
+
+   for (i=0; i<DBRELAY_MAX_CONN; i++) {
+      conn = &connections[i];
+      if (!conn->pid || conn->sessions<2 || IS_EMPTY(conn->connection_name)) continue;
+      if (!match(conn->sql_server, request->sql_server) ||
+          !match(conn->sql_port, request->sql_port) ||
+          !match(conn->sql_database, request->sql_database) ||
+          !match(conn->sql_user, request->sql_user) ||
+          !match(conn->sql_password, request->sql_password) ||
+          !match(conn->sql_dbtype, request->sql_dbtype))
+         continue;
+      if (conn->helper_pid && kill(conn->helper_pid, 0)) continue;
+
+      count = 0;
+      for (j=0; j<DBRELAY_MAX_CONN; j++) {
+         if (connections[j].pid && !strcmp(connections[j].sock_path, conn->sock_path)) count++;
+      }
+      if (count < request->connector_sessions) return conn;
+   }
+   return NULL;
+}
+static int dbrelay_db_free_slot(dbrelay_connection_t *connections)
+{
+   int i;
+
+   for (i=0; i<DBRELAY_MAX_CONN; i++) {
+      if (connections[i].pid==0) return i;
+   }
+   return -1;
+}
+/*
+ * the pool is exhausted, queue behind requests of the same or a higher
+ * priority and take the first slot to come free once at the head. Returns
+ * the slot table still held, or NULL if the wait timed out, the queue is
+ * full or the client went away.
+ */
+static dbrelay_connection_t *dbrelay_db_wait_for_slot(dbrelay_request_t *request, int *slot)
 {
-   int i, slot = -1;
-   void *dbconn = NULL;
    dbrelay_connection_t *connections;
+   struct timeval start;
+   useconds_t nap = 1000;
+   time_t last_check;
+   int waiter, depth = 0, outcome = DBRELAY_WAIT_TIMEOUT;
 
-   /* connect to database outside holding shared mem */
-   if (!IS_SET(request->connection_name)) {
-      dbconn = dbrelay_db_open_connection(request);
+   *slot = -1;
+   gettimeofday(&start, NULL);
+   if ((waiter = dbrelay_waitq_join(request->priority, &depth))==-1) {
+      dbrelay_log_warn(request, "connection wait queue is full");
+      dbrelay_metrics_pool_wait(request->priority, DBRELAY_WAIT_FULL, 0, 0);
+      return NULL;
+   }
+   dbrelay_log_info(request, "pool exhausted, waiting behind %d requests", depth);
+
+   time(&last_check);
+   while (dbrelay_usecs_since(&start) < request->pool_wait * 1000) {
+      usleep(nap);
+      if (nap < DBRELAY_POOL_WAIT_NAP) nap *= 2;
+
+      /* also reap slots left by dead workers and idle timeouts */
+      if (time(NULL) - last_check >= DBRELAY_CANCEL_POLL) {
+         time(&last_check);
+         if (dbrelay_db_check_cancel(request)) {
+            outcome = DBRELAY_WAIT_CANCELLED;
+            break;
+         }
+         dbrelay_db_close_connections(request);
+      }
+
+      if (!dbrelay_waitq_is_next(waiter)) continue;
+
+      connections = dbrelay_time_get_shmem(request);
+      if ((*slot = dbrelay_db_free_slot(connections))!=-1) {
+         dbrelay_waitq_leave(waiter);
+         dbrelay_metrics_pool_wait(request->priority, DBRELAY_WAIT_ACQUIRED, dbrelay_usecs_since(&start), depth);
+         return connections;
+      }
+      dbrelay_time_release_shmem(request, connections);
    }
 
+   dbrelay_waitq_leave(waiter);
+   dbrelay_metrics_pool_wait(request->priority, outcome, dbrelay_usecs_since(&start), depth);
+   return NULL;
+}
+static int dbrelay_db_alloc_connection(dbrelay_request_t *request)
+{
+   int slot = -1;
+   void *dbconn;
+   dbrelay_connection_t *connections;
+
    connections = dbrelay_time_get_shmem(request);
 
-   for (i=0; i<DBRELAY_MAX_CONN; i++) {
-     if (connections[i].pid==0) {
-	slot = i;
-        break;
-     }
+   /* a slot freed while others are queued is theirs */
+   if (!request->pool_wait || !dbrelay_waitq_ahead(request->priority))
+      slot = dbrelay_db_free_slot(connections);
+
+   if (slot==-1 && request->pool_wait) {
+      dbrelay_time_release_shmem(request, connections);
+      connections = dbrelay_db_wait_for_slot(request, &slot);
    }
 
    /* we have exhausted the pool, log something sensible and return error */
    if (slot==-1) {
       dbrelay_log_error(request, "No free connections available!");
-      dbrelay_time_release_shmem(request, connections);
-      if (dbconn) api->close(dbconn);
+      if (connections) dbrelay_time_release_shmem(request, connections);
       return -1;
    }
 
-   dbrelay_db_populate_connection(request, &connections[slot], dbconn);
+   dbrelay_db_populate_connection(request, &connections[slot], NULL, dbrelay_db_find_host(connections, request));
    dbrelay_log_debug(request, "allocating slot %d to request", slot);
    connections[slot].slot = slot;
    dbrelay_time_release_shmem(request, connections);
+
+   /* 
+    * connect to database outside holding shared mem, only once the slot 
+    * is ours so nothing queued for one holds a session on the server
+    */
+   if (!IS_SET(request->connection_name)) {
+      dbconn = dbrelay_db_open_connection(request);
+      connections = dbrelay_time_get_shmem(request);
+      connections[slot].db = dbconn;
+      dbrelay_time_release_shmem(request, connections);
+   }
    return slot;
 }
 static unsigned int match(char *s1, char *s2)
@@ -211,6 +401,7 @@ static unsigned int dbrelay_db_match(dbrelay_connection_t *conn, dbrelay_request
        match(conn->sql_database, request->sql_database) &&
        match(conn->sql_user, request->sql_user) &&
        match(conn->sql_password, request->sql_password) &&
+       match(conn->sql_dbtype, request->sql_dbtype) &&
        match(conn->connection_name, request->connection_name))
          return TRUE;
    else return FALSE;
@@ -248,7 +439,8 @@ void dbrelay_db_close_connection(dbrelay_connection_t *conn, dbrelay_request_t *
 
    dbrelay_log_info(request, "closing connection %d", conn->slot);
 
-   if (conn->db) api->close(conn->db);
+   /* may be called from another request, use the driver that opened it */
+   if (conn->db) dbrelay_db_find_api(conn->sql_dbtype)->close(conn->db);
    dbrelay_db_zero_connection(conn, request);
 }
 static void dbrelay_db_zero_connection(dbrelay_connection_t *conn, dbrelay_request_t *request)
@@ -260,6 +452,7 @@ static void dbrelay_db_zero_connection(dbrelay_connection_t *conn, dbrelay_reque
    conn->sql_port[0]='\0';
    conn->sql_password[0]='\0';
    conn->connection_name[0]='\0';
+   conn->sql_dbtype[0]='\0';
    conn->in_use = 0;
 }
 static void dbrelay_db_close_connections(dbrelay_request_t *request)
@@ -421,6 +614,33 @@ static void dbrelay_append_request_json(json_t *json, dbrelay_request_t *request
    json_end_object(json);
 
 }
+/*
+ * per-phase breakdown, serialization of the enclosing document and
+ * the response size are not known yet and are left to the caller
+ */
+static void dbrelay_append_timings_json(json_t *json, dbrelay_request_t *request)
+{
+   dbrelay_timings_t *t = &request->timings;
+   char tmp[24];
+
+   json_add_key(json, "timings");
+   json_new_object(json);
+   sprintf(tmp, "%lu", t->shm_wait);
+   json_add_number(json, "shm_wait_us", tmp);
+   sprintf(tmp, "%lu", t->connect);
+   json_add_number(json, "connect_us", tmp);
+   sprintf(tmp, "%lu", t->exec);
+   json_add_number(json, "exec_us", tmp);
+   sprintf(tmp, "%lu", t->fetch);
+   json_add_number(json, "fetch_us", tmp);
+   sprintf(tmp, "%lu", t->serialize);
+   json_add_number(json, "serialize_us", tmp);
+   sprintf(tmp, "%lu", t->total);
+   json_add_number(json, "total_us", tmp);
+   sprintf(tmp, "%lu", t->rows);
+   json_add_number(json, "rows", tmp);
+   json_end_object(json);
+}
 static void dbrelay_append_log_json(json_t *json, dbrelay_request_t *request, char *error_string)
 {
    int i;
@@ -433,11 +653,12 @@ static void dbrelay_append_log_json(json_t *json, dbrelay_request_t *request, ch
       json_add_string(json, "error", error_string);
    }
    i = 0;
-   while (request->params[i]) {
+   while (request->params && request->params[i]) {
       sprintf(tmp, "param%d", i);
       json_add_string(json, tmp, request->params[i]);
       i++;
    }
+   if (request->flags & DBRELAY_FLAG_TIMINGS) dbrelay_append_timings_json(json, request);
    json_end_object(json);
 
    json_end_object(json);
@@ -485,10 +706,9 @@ static dbrelay_connection_t *dbrelay_wait_for_connection(dbrelay_request_t *requ
 }
 void dbrelay_cleanup_connector(dbrelay_connection_t *conn)
 {
-   if (conn->helper_pid) {
-      if (!kill(conn->helper_pid, 0)) 
-         kill(conn->helper_pid, SIGTERM);
-   }
+   /* a death is counted once, by whoever gets to signal it */
+   if (conn->helper_pid && !kill(conn->helper_pid, SIGTERM))
+      dbrelay_metrics_connector(0);
    unlink(conn->sock_path);
 }
 void dbrelay_db_restart_json(dbrelay_request_t *request, json_t **json)
@@ -502,6 +722,20 @@ void dbrelay_db_restart_json(dbrelay_request_t *request, json_t **json)
       dbrelay_append_request_json(*json, request);
    }
 }
+/* feed a finished query to the metrics, statement stats, query log and slow log */
+static void dbrelay_db_query_done(dbrelay_request_t *request, int err_class, struct timeval *start, u_char *ret, char *error)
+{
+   request->timings.total = dbrelay_usecs_since(start);
+   request->timings.bytes = ret ? strlen((char *) ret) : 0;
+   if (request->sql) request->fingerprint = dbrelay_sql_fingerprint(request->sql, NULL, 0);
+   dbrelay_limiter_release(request, err_class);
+   dbrelay_ratelimit_release(request);
+   dbrelay_router_done(request);
+   dbrelay_metrics_request(request, err_class);
+   dbrelay_statements_record(request, err_class);
+   dbrelay_querylog_append(request, err_class, error);
+   dbrelay_slowlog_append(request);
+}
 u_char *dbrelay_db_run_query(dbrelay_request_t *request)
 {
    /* FIX ME */
@@ -515,8 +749,12 @@ u_char *dbrelay_db_run_query(dbrelay_request_t *request)
    char *newsql;
    int have_error = 0;
    pid_t helper_pid = 0;
+   struct timeval start, phase;
+   unsigned long shm_wait;
+   int err_class = DBRELAY_ERR_NONE;
 
    error_string[0]='\0';
+   gettimeofday(&start, NULL);
 
    dbrelay_log_info(request, "run_query called");
 
@@ -531,6 +769,22 @@ u_char *dbrelay_db_run_query(dbrelay_request_t *request)
 
    dbrelay_append_request_json(json, request);
 
+   if (!dbrelay_db_select_api(request)) {
+        dbrelay_db_restart_json(request, &json);
+        dbrelay_write_json_log(json, request, "Unknown sql_dbtype.");
+
+	if (IS_SET(request->js_callback) || IS_SET(request->js_error)) {
+           json_end_callback(json);
+	}
+
+        ret = (u_char *) json_to_string(json);
+        json_free(json);
+        dbrelay_db_query_done(request, DBRELAY_ERR_REQUEST, &start, ret, "Unknown sql_dbtype.");
+        return ret;
+   }
+
+   dbrelay_router_route(request);
+
    if (!dbrelay_check_request(request)) {
 	dbrelay_db_restart_json(request, &json);
         dbrelay_log_info(request, "check_request failed.");
@@ -542,12 +796,48 @@ u_char *dbrelay_db_run_query(dbrelay_request_t *request)
 
         ret = (u_char *) json_to_string(json);
         json_free(json);
+        dbrelay_db_query_done(request, DBRELAY_ERR_REQUEST, &start, ret, "Not all required parameters submitted.");
         return ret;
    }
 
    newsql = dbrelay_resolve_params(request, request->sql);
 
+   /* per client limits come before anything shared is taken */
+   if (dbrelay_ratelimit_acquire(request)) {
+      sprintf(error_string, "Rate limit exceeded, retry after %u seconds", request->retry_after);
+      dbrelay_db_restart_json(request, &json);
+      dbrelay_write_json_log(json, request, error_string);
+      if (IS_SET(request->js_callback) || IS_SET(request->js_error))
+           json_end_callback(json);
+
+      free(newsql);
+      ret = (u_char *) json_to_string(json);
+      json_free(json);
+      dbrelay_db_query_done(request, DBRELAY_ERR_RATELIMIT, &start, ret, error_string);
+      return ret;
+   }
+
+   /* a backend struggling under its current limit sheds the excess */
+   if (!dbrelay_limiter_acquire(request)) {
+      dbrelay_log_warn(request, "concurrency limit for %s reached, shedding request", request->sql_server);
+      dbrelay_db_restart_json(request, &json);
+      dbrelay_write_json_log(json, request, "Server busy, concurrency limit reached");
+      if (IS_SET(request->js_callback) || IS_SET(request->js_error))
+           json_end_callback(json);
+
+      free(newsql);
+      ret = (u_char *) json_to_string(json);
+      json_free(json);
+      dbrelay_db_query_done(request, DBRELAY_ERR_POOL, &start, ret, "Server busy, concurrency limit reached");
+      return ret;
+   }
+
+   /* shm waits inside connection setup are reported on their own */
+   gettimeofday(&phase, NULL);
+   shm_wait = request->timings.shm_wait;
+   dbrelay_metrics_waiting(1);
    conn = dbrelay_wait_for_connection(request, &s);
+   dbrelay_metrics_waiting(-1);
    if (conn == NULL) {
       dbrelay_db_restart_json(request, &json);
       dbrelay_write_json_log(json, request, "Couldn't allocate new connection");
@@ -556,6 +846,7 @@ u_char *dbrelay_db_run_query(dbrelay_request_t *request)
 
       ret = (u_char *) json_to_string(json);
       json_free(json);
+      dbrelay_db_query_done(request, DBRELAY_ERR_POOL, &start, ret, "Couldn't allocate new connection");
       return ret;
    }
    slot = conn->slot;
@@ -577,6 +868,7 @@ u_char *dbrelay_db_run_query(dbrelay_request_t *request)
          free(newsql);
          ret = (u_char *) json_to_string(json);
          json_free(json);
+         dbrelay_db_query_done(request, DBRELAY_ERR_CONNECTOR, &start, ret, "Couldn't initialize connector");
          return ret;
       } else if (helper_pid) {
          // write the connectors pid into shared memory
@@ -584,9 +876,13 @@ u_char *dbrelay_db_run_query(dbrelay_request_t *request)
          connections[slot].helper_pid = helper_pid;
          dbrelay_time_release_shmem(request, connections);
       } // else we didn't get a pid but didn't fail, shouldn't happen
+      request->timings.connect += dbrelay_usecs_since(&phase) - (request->timings.shm_wait - shm_wait);
+      gettimeofday(&phase, NULL);
       dbrelay_log_info(request, "sending request");
       ret = (u_char *) dbrelay_conn_send_request(s, request, &have_error);
       dbrelay_log_debug(request, "back");
+      /* an older connector sends no :TIMINGS, charge the round trip to exec */
+      if (!request->timings.exec) request->timings.exec = dbrelay_usecs_since(&phase);
       // internal error
       if (have_error==2) {
          dbrelay_log_error(request, "Error occurred on socket %s (PID: %u)", conn->sock_path, conn->helper_pid);
@@ -594,6 +890,9 @@ u_char *dbrelay_db_run_query(dbrelay_request_t *request)
          dbrelay_conn_kill(s);
       }
       if (have_error) {
+         if (have_error==2) err_class = DBRELAY_ERR_CONNECTOR;
+         else if (request->cancelled) err_class = DBRELAY_ERR_CANCELLED;
+         else err_class = DBRELAY_ERR_QUERY;
          dbrelay_db_restart_json(request, &json);
          dbrelay_log_debug(request, "have error %s\n", ret);
          dbrelay_copy_string(error_string, (char *)ret, sizeof(error_string));
@@ -609,7 +908,9 @@ u_char *dbrelay_db_run_query(dbrelay_request_t *request)
       dbrelay_conn_close(s);
       dbrelay_log_debug(request, "after close");
    } else {
+      request->timings.connect += dbrelay_usecs_since(&phase) - (request->timings.shm_wait - shm_wait);
       if (!api->connected(conn->db)) {
+        err_class = DBRELAY_ERR_LOGIN;
 	//strcpy(error_string, "Failed to login");
         //if (login_msgno == 18452 && IS_EMPTY(request->sql_password)) {
         if (IS_EMPTY(request->sql_password)) {
@@ -623,12 +924,15 @@ u_char *dbrelay_db_run_query(dbrelay_request_t *request)
         dbrelay_db_restart_json(request, &json);
       } else {
    	dbrelay_log_debug(request, "Sending sql query");
-        ret = dbrelay_exec_query(conn, request->sql_database, newsql, request->flags);
+        ret = dbrelay_exec_query(conn, request, newsql);
         if (ret==NULL) {
+           if (request->cancelled) err_class = DBRELAY_ERR_CANCELLED;
+           else if (request->timed_out) err_class = DBRELAY_ERR_TIMEOUT;
+           else err_class = DBRELAY_ERR_QUERY;
            dbrelay_db_restart_json(request, &json);
    	   dbrelay_log_debug(request, "error");
            //strcpy(error_string, request->error_message);
-           strcpy(error_string, api->error(conn->db));
+           strcpy(error_string, dbrelay_exec_error(conn, request));
         } else {
            json_add_json(json, ", ");
            json_add_json(json, (char *) ret);
@@ -642,14 +946,17 @@ u_char *dbrelay_db_run_query(dbrelay_request_t *request)
    free(newsql);
 
    dbrelay_log_debug(request, "error = %s\n", error_string);
+   request->timings.total = dbrelay_usecs_since(&start);
    dbrelay_append_log_json(json, request, error_string);
 
    if (IS_SET(request->js_callback) || IS_SET(request->js_error)) {
       json_end_callback(json);
    }
 
+   gettimeofday(&phase, NULL);
    ret = (u_char *) json_to_string(json);
    json_free(json);
+   request->timings.serialize += dbrelay_usecs_since(&phase);
    dbrelay_log_debug(request, "Query completed, freeing connection.");
 
    connections = dbrelay_time_get_shmem(request);
@@ -661,40 +968,90 @@ u_char *dbrelay_db_run_query(dbrelay_request_t *request)
    dbrelay_db_free_connection(conn, request);
    dbrelay_time_release_shmem(request, connections);
 
+   dbrelay_db_query_done(request, err_class, &start, ret, error_string);
+
    return ret;
 }
 
 u_char *
-dbrelay_exec_query(dbrelay_connection_t *conn, char *database, char *sql, unsigned long flags)
+dbrelay_exec_query(dbrelay_connection_t *conn, dbrelay_request_t *request, char *sql)
 {
   json_t *json = json_new();
   u_char *ret;
+  unsigned long flags = request->flags;
+  struct timeval start;
  
   if (flags & DBRELAY_FLAG_PP) json_pretty_print(json, 1);
   if (flags & DBRELAY_FLAG_EMBEDCSV) json_set_mode(json, DBRELAY_JSON_MODE_CSV);
 
-  api->change_db(conn->db, database);
+  api->change_db(conn->db, request->sql_database);
+
+  /* drivers enforce query_timeout from here */
+  time(&request->query_start);
+  request->timed_out = 0;
+  request->failed = 0;
 
   if (flags & DBRELAY_FLAG_XACT) api->exec(conn->db, api->catalogsql(DBRELAY_DBCMD_BEGIN, NULL));
 
-  if (api->exec(conn->db, sql))
+  gettimeofday(&start, NULL);
+  if (!api->exec(conn->db, sql))
   {
-     dbrelay_db_fill_data(json, conn);
-     if (flags & DBRELAY_FLAG_XACT) api->exec(conn->db, api->catalogsql(DBRELAY_DBCMD_COMMIT, NULL));
-  } else {
+     request->timings.exec += dbrelay_usecs_since(&start);
      if (flags & DBRELAY_FLAG_XACT) api->exec(conn->db, api->catalogsql(DBRELAY_DBCMD_ROLLBACK, NULL));
+     json_free(json);
      return NULL;
   }
+  request->timings.exec += dbrelay_usecs_since(&start);
+
+  gettimeofday(&start, NULL);
+  dbrelay_db_fill_data(json, conn, request);
+  request->timings.fetch += dbrelay_usecs_since(&start);
+
+  /* nobody is reading the partial results of a cancelled or failed query */
+  if (request->cancelled || request->timed_out || request->failed) {
+     if (flags & DBRELAY_FLAG_XACT) api->exec(conn->db, api->catalogsql(DBRELAY_DBCMD_ROLLBACK, NULL));
+     json_free(json);
+     return NULL;
+  }
+  if (flags & DBRELAY_FLAG_XACT) api->exec(conn->db, api->catalogsql(DBRELAY_DBCMD_COMMIT, NULL));
+  gettimeofday(&start, NULL);
   ret = (u_char *) json_to_string(json);
   json_free(json);
+  request->timings.serialize += dbrelay_usecs_since(&start);
 
   return ret;
 }
-int dbrelay_db_fill_data(json_t *json, dbrelay_connection_t *conn)
+/*
+ * in the connector, send what has been built so far once it passes
+ * DBRELAY_STREAM_CHUNK rather than holding the whole result.  The send
+ * blocks while nginx is behind, which holds up the fetch as well.
+ */
+static void dbrelay_db_stream(json_t *json, dbrelay_request_t *request)
+{
+   char *chunk;
+   int failed;
+
+   if (request->stream_sock<=0 || sb_len(json->sb) < DBRELAY_STREAM_CHUNK) return;
+
+   chunk = json_flush(json);
+   failed = (!request->streamed && dbrelay_socket_send_string(request->stream_sock, ":RESULTS BEGIN\n")<0) ||
+            dbrelay_socket_send_string(request->stream_sock, chunk)<0;
+   free(chunk);
+   request->streamed = 1;
+
+   if (failed) {
+      dbrelay_log_notice(request, "client went away while streaming results");
+      request->cancelled = 1;
+   }
+}
+int dbrelay_db_fill_data(json_t *json, dbrelay_connection_t *conn, dbrelay_request_t *request)
 {
-   int numcols, colnum;
+   int numcols, colnum, row;
    char tmp[256];
    int maxcolname;
+   unsigned long rows = 0;
+   dbrelay_batch_t *batch;
+   char **names;
 
    json_add_key(json, "data");
    json_new_array(json);
@@ -715,16 +1072,26 @@ int dbrelay_db_fill_data(json_t *json, dbrelay_connection_t *conn)
 	if (json_get_mode(json)==DBRELAY_JSON_MODE_STD) json_new_array(json);
         else json_add_json(json, "\"");
 
-        while (api->fetch_row(conn->db)) { 
-           maxcolname = 0;
-	   if (json_get_mode(json)==DBRELAY_JSON_MODE_STD) json_new_object(json);
-	   for (colnum=1; colnum<=numcols; colnum++) {
-              dbrelay_write_json_column(json, conn->db, colnum, &maxcolname);
-	      if (json_get_mode(json)==DBRELAY_JSON_MODE_CSV && colnum!=numcols) json_add_json(json, ",");
+        /* names and quoting don't change within a result set */
+        names = dbrelay_batch_colnames(conn->db, numcols);
+        batch = dbrelay_batch_new(numcols, DBRELAY_BATCH_ROWS);
+	for (colnum=1; colnum<=numcols; colnum++) batch->quoted[colnum-1] = api->is_quoted(conn->db, colnum);
+
+        while (api->fetch_batch ? api->fetch_batch(conn->db, batch) : dbrelay_db_fetch_rows(conn->db, batch)) {
+           for (row=0; row<batch->rows; row++) {
+              rows++;
+              if (rows % DBRELAY_STREAM_ROWS == 0) dbrelay_db_stream(json, request);
+              if ((request->cancelled || rows % DBRELAY_CANCEL_ROWS == 0) && dbrelay_db_check_cancel(request)) {
+                 dbrelay_log_info(request, "client went away after %lu rows, cancelling", rows);
+                 api->cancel(conn->db);
+                 request->timings.rows += rows;
+                 dbrelay_db_free_batch(names, batch, numcols);
+                 return 1;
+              }
+              dbrelay_write_json_batch_row(json, batch, row, names);
            }
-	   if (json_get_mode(json)==DBRELAY_JSON_MODE_STD) json_end_object(json);
-           else json_add_json(json, "\\n");
         }
+        dbrelay_db_free_batch(names, batch, numcols);
 
 	if (json_get_mode(json)==DBRELAY_JSON_MODE_STD) json_end_array(json);
         else json_add_json(json, "\",");
@@ -739,19 +1106,172 @@ int dbrelay_db_fill_data(json_t *json, dbrelay_connection_t *conn)
    }
    /* sprintf(error_string, "rc = %d", rc); */
    json_end_array(json);
+   request->timings.rows += rows;
 
    return 0;
 }
+/*
+ * returns true if the client that submitted this request has gone away, 
+ * either by closing its socket or, for connectors, by sending :CANCEL
+ */
+int dbrelay_db_check_cancel(dbrelay_request_t *request)
+{
+   char buf[8];
+   int t;
+
+   if (!request) return 0;
+   if (request->cancelled) return 1;
+   if (request->client_sock<=0) return 0;
+
+   t = dbrelay_socket_peek(request->client_sock, buf, sizeof(buf));
+   if (t==0 || t==-1 || (t>=7 && !strncmp(buf, ":CANCEL", 7))) {
+      dbrelay_log_notice(request, "client disconnected, cancelling query");
+      request->cancelled = 1;
+   }
+   return request->cancelled;
+}
+/*
+ * returns true once the running statement has exceeded query_timeout,
+ * drivers without a native timeout call this while waiting on the server
+ */
+int dbrelay_db_check_timeout(dbrelay_request_t *request)
+{
+   if (!request || !request->query_timeout) return 0;
+   if (request->timed_out) return 1;
+
+   if (time(NULL) - request->query_start >= request->query_timeout) {
+      dbrelay_log_notice(request, "query exceeded timeout of %ld seconds", request->query_timeout);
+      request->timed_out = 1;
+   }
+   return request->timed_out;
+}
+/*
+ * error text for a failed dbrelay_exec_query()
+ */
+char *dbrelay_exec_error(dbrelay_connection_t *conn, dbrelay_request_t *request)
+{
+   if (request->cancelled) return "Query cancelled, client disconnected.";
+   if (request->timed_out) {
+      sprintf(dbrelay_request_errbuf(request), "Query timed out after %ld seconds.", request->query_timeout);
+      return request->error_message;
+   }
+   return api->error(conn->db);
+}
+
+/*
+ * Per request allocation. In the module everything comes from the nginx
+ * request pool and goes away with it; the command line tools use a small
+ * arena of malloc'd blocks released by dbrelay_free_request(). Requests 
+ * living outside a pool (the connector's) fall back to calloc.
+ */
+#ifdef CMDLINE
+#define DBRELAY_ARENA_SZ 4096
+
+typedef struct dbrelay_arena_s {
+   struct dbrelay_arena_s *next;
+   size_t size;
+   size_t used;
+} dbrelay_arena_t;
+
+static dbrelay_arena_t *
+dbrelay_arena_new(size_t sz)
+{
+   dbrelay_arena_t *arena;
+
+   if (sz < DBRELAY_ARENA_SZ) sz = DBRELAY_ARENA_SZ;
+   arena = (dbrelay_arena_t *) malloc(sizeof(dbrelay_arena_t) + sz);
+   arena->next = NULL;
+   arena->size = sz;
+   arena->used = 0;
+   return arena;
+}
+static void *
+dbrelay_arena_alloc(dbrelay_arena_t *arena, size_t sz)
+{
+   dbrelay_arena_t *block;
+   void *p;
+
+   sz = (sz + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+   if (arena->used + sz > arena->size) {
+      /* keep the head in place, the request itself lives there */
+      block = dbrelay_arena_new(sz);
+      block->next = arena->next;
+      arena->next = block;
+   } else block = arena;
+
+   p = (char *) block + sizeof(dbrelay_arena_t) + block->used;
+   block->used += sz;
+   return p;
+}
+static void
+dbrelay_arena_free(dbrelay_arena_t *arena)
+{
+   dbrelay_arena_t *next;
+
+   for (; arena; arena = next) {
+      next = arena->next;
+      free(arena);
+   }
+}
+#endif
+
+void *
+dbrelay_request_alloc(dbrelay_request_t *request, size_t sz)
+{
+   void *p;
+
+   if (!request->pool) return calloc(1, sz);
+#ifdef CMDLINE
+   p = dbrelay_arena_alloc((dbrelay_arena_t *) request->pool, sz);
+   memset(p, 0, sz);
+#else
+   p = ngx_pcalloc((ngx_pool_t *) request->pool, sz);
+#endif
+   return p;
+}
+char *
+dbrelay_request_strdup(dbrelay_request_t *request, char *s)
+{
+   size_t len = strlen(s) + 1;
+   char *p = (char *) dbrelay_request_alloc(request, len);
 
+   memcpy(p, s, len);
+   return p;
+}
+char *
+dbrelay_request_errbuf(dbrelay_request_t *request)
+{
+   if (!request->error_message) 
+      request->error_message = (char *) dbrelay_request_alloc(request, DBRELAY_ERRMSG_SZ);
+   return request->error_message;
+}
+/* i is zero based, unlike the param1..paramN request keys */
+void
+dbrelay_request_set_param(dbrelay_request_t *request, int i, char *value)
+{
+   if (i<0 || i>=DBRELAY_MAX_PARAMS) return;
+   if (!request->params) 
+      request->params = (char **) dbrelay_request_alloc(request, sizeof(char *) * (DBRELAY_MAX_PARAMS + 1));
+   request->params[i] = value ? dbrelay_request_strdup(request, value) : NULL;
+}
 dbrelay_request_t *
-dbrelay_alloc_request()
+dbrelay_alloc_request(void *pool)
 {
    dbrelay_request_t *request;
 
-   request = (dbrelay_request_t *) malloc(sizeof(dbrelay_request_t));
+#ifdef CMDLINE
+   dbrelay_arena_t *arena = dbrelay_arena_new(sizeof(dbrelay_request_t));
+
+   request = (dbrelay_request_t *) dbrelay_arena_alloc(arena, sizeof(dbrelay_request_t));
    memset(request, '\0', sizeof(dbrelay_request_t));
+   request->pool = arena;
+#else
+   request = (dbrelay_request_t *) ngx_pcalloc((ngx_pool_t *) pool, sizeof(dbrelay_request_t));
+   request->pool = pool;
+#endif
    request->http_keepalive = 1;
    request->connection_timeout = 60;
+   request->priority = DBRELAY_PRIORITY_NORMAL;
    //request->flags |= DBRELAY_FLAGS_PP;
 
    return request;
@@ -761,76 +1281,25 @@ dbrelay_free_request(dbrelay_request_t *request)
 {
    if (request->sql) free(request->sql);
 
-   free(request);
-}
-static int
-is_quoted_param(char *param)
-{
-   int ret;
-   char *tmp = strdup(param);
-   char *s = strstr(tmp, ":");
-   *s = '\0';
-   if (!strcasecmp(tmp, "char") ||
-       !strcasecmp(tmp, "varchar") ||
-       !strcasecmp(tmp, "datetime") ||
-       !strcasecmp(tmp, "smalldatetime"))
-      ret = TRUE;
-   else ret = FALSE;
-   free(tmp);
-   return ret;
+#ifdef CMDLINE
+   /* the request is the first thing in its own arena */
+   dbrelay_arena_free((dbrelay_arena_t *) request->pool);
+#endif
 }
 static char *
 dbrelay_resolve_params(dbrelay_request_t *request, char *sql)
 {
-   int i = 0;
-   int pos = 0, prevpos = 0;
-   stringbuf_t *sb = sb_new(NULL);
    char *ret;
-   char *tmpsql = strdup(sql);
+   char *prefix = NULL;
 
    if (IS_SET(DBRELAY_MAGIC) && !(request->flags & DBRELAY_FLAG_NOMAGIC)) {
-      sb_append(sb, DBRELAY_MAGIC);
-   }
-   while (request->params[i]) {
-      prevpos = pos;
-      pos += dbrelay_find_placeholder(&tmpsql[pos]);
-      if (pos==-1) {
-	 // ignore missing placeholders
-         pos = prevpos;	
-      } else {
-         tmpsql[pos]='\0';
-         sb_append(sb, &tmpsql[prevpos]);
-         if (is_quoted_param(request->params[i])) sb_append(sb, "'");
-         sb_append(sb, strstr(request->params[i], ":") + 1);
-         if (is_quoted_param(request->params[i])) sb_append(sb, "'");
-         pos++;
-      }
-      i++;
-   } 
-   sb_append(sb, &tmpsql[pos]);
-   ret = sb_to_char(sb);
-   free(tmpsql);
-   sb_free(sb);
+      prefix = DBRELAY_MAGIC;
+   }
+   ret = dbrelay_sql_bind_params(sql, request->params, prefix);
    dbrelay_log_debug(request, "new sql %s", ret);
    return ret;
 }
 static int
-dbrelay_find_placeholder(char *sql)
-{
-   int quoted = 0;
-   int i = 0;
-   int found = 0;
-   int len = strlen(sql);
-
-   do {
-     if (sql[i]=='\'') quoted = quoted ? 0 : 1;
-     if (!quoted && sql[i]=='?') found = 1;
-     i++;
-   } while (!found && i<len);
-   if (!found) return -1;
-   else return i-1;
-}
-static int
 dbrelay_check_request(dbrelay_request_t *request)
 {
    if (!request->sql && !request->cmd) return 0;
@@ -885,59 +1354,99 @@ void dbrelay_write_json_colinfo(json_t *json, void *db, int colnum, int *maxcoln
    }
    json_end_object(json);
 }
-void dbrelay_write_json_column(json_t *json, void *db, int colnum, int *maxcolname)
+/* 
+ * the key each column is written under, unnamed ones numbered after the 
+ * highest numeric name seen so far
+ */
+static char **dbrelay_batch_colnames(void *db, int numcols)
 {
+   char **names = (char **) malloc(sizeof(char *) * (numcols ? numcols : 1));
    char *colname, tmpcolname[256];
-   int l;
+   int colnum, l, maxcolname = 0;
 
-   colname = api->colname(db, colnum);
-   if (dbrelay_is_unnamed_column(colname)) {
-      sprintf(tmpcolname, "%d", ++(*maxcolname));
-   } else {
-      l = atoi(colname); 
-      if (l>0 && l>*maxcolname) {
-         *maxcolname=l;
+   for (colnum=1; colnum<=numcols; colnum++) {
+      colname = api->colname(db, colnum);
+      if (dbrelay_is_unnamed_column(colname)) {
+         sprintf(tmpcolname, "%d", ++maxcolname);
+         names[colnum-1] = strdup(tmpcolname);
+      } else {
+         l = atoi(colname); 
+         if (l>0 && l>maxcolname) {
+            maxcolname=l;
+         }
+         names[colnum-1] = strdup(colname);
       }
-      strcpy(tmpcolname, colname);
    }
-
-   if (json_get_mode(json)==DBRELAY_JSON_MODE_CSV)
-      dbrelay_write_json_column_csv(json, db, colnum);
-   else 
-      dbrelay_write_json_column_std(json, db, colnum, tmpcolname);
+   return names;
 }
-static void dbrelay_write_json_column_csv(json_t *json, void *db, int colnum)
+static void dbrelay_db_free_batch(char **names, dbrelay_batch_t *batch, int numcols)
 {
-   unsigned char escape = 0;
-   int colsize;
-   char *tmp;
-
-   colsize = api->collen(db, colnum);
-   tmp = (char *) malloc(colsize > 256 ? colsize : 256);
+   int i;
 
-   if (api->colvalue(db, colnum, tmp)==NULL) return;
-   if (strchr(tmp, ',')) escape = 1;
-   if (escape) json_add_json(json, "\\\"");
-   json_add_json(json, tmp);
-   if (escape) json_add_json(json, "\\\"");
-   free(tmp);
+   for (i=0; i<numcols; i++) free(names[i]);
+   free(names);
+   dbrelay_batch_free(batch);
 }
-static void dbrelay_write_json_column_std(json_t *json, void *db, int colnum, char *colname)
+/* for drivers without fetch_batch, a row at a time through the old calls */
+static int dbrelay_db_fetch_rows(void *db, dbrelay_batch_t *batch)
 {
-   int colsize;
-   char *tmp;
-
-   colsize = api->collen(db, colnum);
-   tmp = (char *) malloc(colsize > 256 ? colsize : 256);
-
-   if (api->colvalue(db, colnum, tmp)==NULL) {
-      json_add_null(json, colname);
-   } else if (api->is_quoted(db, colnum)) {
-      json_add_string(json, colname, tmp);
-   } else {
-      json_add_number(json, colname, tmp);
+   int col, row, len;
+   char *value;
+
+   dbrelay_batch_reset(batch);
+   while (batch->rows < batch->maxrows && api->fetch_row(db)) {
+      row = batch->rows++;
+      for (col=0; col<batch->numcols; col++) {
+         if (api->colvalue_ref) {
+            value = api->colvalue_ref(db, col+1, &len);
+            dbrelay_batch_copy(batch, col, row, value, len);
+         } else {
+            len = api->collen(db, col+1);
+            value = dbrelay_batch_alloc(batch, len > 256 ? len : 256);
+            if (api->colvalue(db, col+1, value)==NULL) value = NULL;
+            dbrelay_batch_set(batch, col, row, value, value ? strlen(value) : 0);
+         }
+         if (value && !batch->quoted[col] && api->is_quoted(db, col+1)) dbrelay_batch_quote(batch, col, row);
+      }
+   }
+   return batch->rows;
+}
+static void dbrelay_write_json_batch_row(json_t *json, dbrelay_batch_t *batch, int row, char **names)
+{
+   unsigned char csv = json_get_mode(json)==DBRELAY_JSON_MODE_CSV;
+   int col, len;
+   char *value;
+
+   if (!csv) json_new_object(json);
+   for (col=0; col<batch->numcols; col++) {
+      value = DBRELAY_BATCH_VALUE(batch, col, row);
+      len = DBRELAY_BATCH_LENGTH(batch, col, row);
+      if (csv) {
+         if (!DBRELAY_BATCH_IS_NULL(batch, col, row)) {
+            if (memchr(value, ',', len)) {
+               json_add_json(json, "\\\"");
+               json_add_json_len(json, value, len);
+               json_add_json(json, "\\\"");
+            } else json_add_json_len(json, value, len);
+         }
+         if (col!=batch->numcols-1) json_add_json(json, ",");
+      } else if (DBRELAY_BATCH_IS_NULL(batch, col, row)) {
+         json_add_null(json, names[col]);
+      } else if (DBRELAY_BATCH_IS_QUOTED(batch, col, row)) {
+         json_add_string_len(json, names[col], value, len);
+      } else {
+         json_add_number_len(json, names[col], value, len);
+      }
    }
-   free(tmp);
+   if (!csv) json_end_object(json);
+   else json_add_json(json, "\\n");
+}
+unsigned long dbrelay_usecs_since(struct timeval *start)
+{
+   struct timeval now;
+
+   gettimeofday(&now, NULL);
+   return (unsigned long) (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_usec - start->tv_usec);
 }
 static int calc_time(struct timeval *start, struct timeval *now)
 {
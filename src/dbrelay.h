@@ -38,6 +38,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <sys/time.h>
 #include <unistd.h>
 #include <sys/ipc.h>
 #include <sys/signal.h>
@@ -53,12 +54,17 @@
 #include "json.h"
 
 #define DBRELAY_MAX_CONN 1000
-#define DBRELAY_MAX_PARAMS 100
+#define DBRELAY_MAX_PARAMS 1000
 #define DBRELAY_OBJ_SZ 31
 #define DBRELAY_NAME_SZ 101
+#define DBRELAY_ERRMSG_SZ 4000
 #define DBRELAY_SOCKET_BUFSIZE 4096
 
 #define DBRELAY_HARD_TIMEOUT 28800
+/* most named connections one connector process will host */
+#define DBRELAY_CONNECTOR_SESSIONS 64
+/* seconds between checks for a client disconnect while a query runs */
+#define DBRELAY_CANCEL_POLL 1
 
 #define DBRELAY_LOG_SCOPE_SERVER 1
 #define DBRELAY_LOG_SCOPE_CONN 2
@@ -85,6 +91,9 @@
 #define DBRELAY_FLAG_XACT    0x04
 #define DBRELAY_FLAG_EMBEDCSV    0x08
 #define DBRELAY_FLAG_NOMAGIC    0x10
+#define DBRELAY_FLAG_TIMINGS    0x20
+#define DBRELAY_FLAG_PREPARE    0x40
+#define DBRELAY_FLAG_READONLY   0x80
 
 #define DBRELAY_DBCMD_TABLES    0
 #define DBRELAY_DBCMD_COLUMNS   1
@@ -104,6 +113,73 @@
 #define NET_FLAGS 0
 #endif
 
+#define DBRELAY_SOCKET_TIMEOUT -2
+
+/* error classes counted by the metrics */
+#define DBRELAY_ERR_NONE       0
+#define DBRELAY_ERR_REQUEST    1
+#define DBRELAY_ERR_POOL       2
+#define DBRELAY_ERR_CONNECTOR  3
+#define DBRELAY_ERR_LOGIN      4
+#define DBRELAY_ERR_QUERY      5
+#define DBRELAY_ERR_TIMEOUT    6
+#define DBRELAY_ERR_CANCELLED  7
+#define DBRELAY_ERR_RATELIMIT  8
+#define DBRELAY_ERR_CLASSES    9
+/* names of the above, in metrics.c */
+extern char *dbrelay_error_class_names[DBRELAY_ERR_CLASSES];
+
+/* classes for requests waiting on an exhausted pool, lowest goes first */
+#define DBRELAY_PRIORITY_HIGH   0
+#define DBRELAY_PRIORITY_NORMAL 1
+#define DBRELAY_PRIORITY_LOW    2
+#define DBRELAY_PRIORITIES      3
+
+/* how a wait for a slot ended */
+#define DBRELAY_WAIT_ACQUIRED   0
+#define DBRELAY_WAIT_TIMEOUT    1
+#define DBRELAY_WAIT_FULL       2
+#define DBRELAY_WAIT_CANCELLED  3
+#define DBRELAY_WAIT_OUTCOMES   4
+
+/* most queries allowed to run at once against one backend server */
+#define DBRELAY_LIMITER_MAX 256
+
+/* what dbrelay_rate_limit counts requests by */
+#define DBRELAY_RATELIMIT_REMOTE_ADDR 0
+#define DBRELAY_RATELIMIT_SQL_USER    1
+#define DBRELAY_RATELIMIT_QUERY_TAG   2
+
+#define DBRELAY_RATELIMIT_RULES 4
+#define DBRELAY_RATELIMIT_CONCURRENCY 64
+
+/* a member of a location's dbrelay_backend group */
+typedef struct {
+   char sql_server[DBRELAY_NAME_SZ];
+   char sql_port[6];
+   int replica;
+} dbrelay_route_backend_t;
+
+typedef struct {
+   unsigned int id;          /* keeps the buckets of different rules apart */
+   int key;                  /* DBRELAY_RATELIMIT_* */
+   unsigned long rate;       /* thousandths of a request per minute, 0 for none */
+   unsigned long burst;      /* requests allowed over the rate */
+   unsigned int concurrency; /* requests running at once, 0 for no limit */
+} dbrelay_ratelimit_t;
+
+/* wall clock spent in each phase of a request, in microseconds */
+typedef struct {
+   unsigned long shm_wait;   /* attaching and releasing the slot table */
+   unsigned long connect;    /* slot allocation, login or connector spawn */
+   unsigned long exec;       /* api->exec */
+   unsigned long fetch;      /* reading rows into json */
+   unsigned long serialize;  /* json_to_string */
+   unsigned long total;
+   unsigned long rows;
+   unsigned long bytes;      /* length of the response body */
+} dbrelay_timings_t;
+
 typedef struct {
    int status;
    char cmd[DBRELAY_NAME_SZ];
@@ -116,12 +192,13 @@ typedef struct {
    char query_tag[DBRELAY_NAME_SZ];
    char connection_name[DBRELAY_NAME_SZ];
    long connection_timeout;
+   long query_timeout;   /* seconds a statement may run, 0 for no limit */
    int http_keepalive;
    int log_level;
    int log_level_scope;
    ngx_log_t *log;
-   char error_message[4000];
-   char *params[DBRELAY_MAX_PARAMS];
+   char *error_message;  /* DBRELAY_ERRMSG_SZ, allocated on first error */
+   char **params;        /* DBRELAY_MAX_PARAMS + 1, allocated on first param */
    char sql_dbtype[DBRELAY_OBJ_SZ];
    char remote_addr[DBRELAY_OBJ_SZ];
    char sock_path[256];  /* explicitly specify socket path */
@@ -129,8 +206,73 @@ typedef struct {
    char js_callback[DBRELAY_NAME_SZ];
    char js_error[DBRELAY_NAME_SZ];
    void *nginx_request;
+   int client_sock;      /* watched for disconnect or :CANCEL during a query */
+   int cancelled;
+   int stream_sock;      /* connector: results go out here as rows are fetched */
+   int streamed;         /* :RESULTS BEGIN and some rows have been sent */
+   time_t query_start;
+   int timed_out;
+   int failed;           /* a later statement of a multi statement batch failed */
+   void *pool;           /* ngx_pool_t in the module, a private arena otherwise */
+   dbrelay_timings_t timings;
+   unsigned int query_log_sample;  /* log one in N queries, 0 to disable */
+   unsigned long slow_query_time;  /* msecs, 0 disables the slow query log */
+   unsigned long long fingerprint; /* of sql, set once the query is done */
+   unsigned int connector_sessions; /* named connections one connector may host */
+   unsigned long pool_wait;        /* msecs to wait for a free slot, 0 fails at once */
+   int priority;                   /* DBRELAY_PRIORITY_*, while waiting for a slot */
+   unsigned int backend_limit;     /* ceiling on concurrent queries per server, 0 for none */
+   int limiter;                    /* place held under the backend's limit, 0 for none */
+   dbrelay_ratelimit_t *rate_limits;
+   int nrate_limits;
+   int rate_held[DBRELAY_RATELIMIT_RULES];  /* places held under concurrency limits */
+   unsigned int retry_after;       /* secs, set when rate limited */
+   dbrelay_route_backend_t *backends; /* group to route to when sql_server is not given */
+   int nbackends;
+   int routed;                     /* outstanding query counted against a backend */
 } dbrelay_request_t;
 
+#define DBRELAY_SLOWLOG_SQL_SZ 1024
+
+typedef struct {
+   volatile unsigned long seq;
+   time_t ts;
+   char sql[DBRELAY_SLOWLOG_SQL_SZ];
+   size_t sql_len;       /* before truncation */
+   int nparams;
+   char sql_server[DBRELAY_NAME_SZ];
+   char sql_database[DBRELAY_OBJ_SZ];
+   char query_tag[DBRELAY_NAME_SZ];
+   dbrelay_timings_t timings;
+} dbrelay_slowlog_entry_t;
+
+#define DBRELAY_STATEMENT_SZ 256
+#define DBRELAY_STATEMENT_BUCKETS 64
+
+typedef struct {
+   volatile unsigned long long fingerprint;   /* 0 while the entry is free */
+   volatile int ready;
+   char query[DBRELAY_STATEMENT_SZ];          /* normalized text */
+   unsigned long calls;
+   unsigned long errors;
+   unsigned long total_us;
+   unsigned long min_us;
+   unsigned long max_us;
+   unsigned long rows;
+   unsigned long bytes;
+   unsigned long buckets[DBRELAY_STATEMENT_BUCKETS];
+} dbrelay_statement_t;
+
+typedef struct {
+   char sql_server[DBRELAY_NAME_SZ];
+   char sql_port[6];
+   unsigned long limit;
+   int inflight;
+   unsigned long queued;
+   unsigned long shed;
+   unsigned long latency;  /* recent average, usecs */
+} dbrelay_limiter_stat_t;
+
 typedef struct {
    char sql_server[DBRELAY_NAME_SZ];
    char sql_port[6];
@@ -138,6 +280,7 @@ typedef struct {
    char sql_user[DBRELAY_OBJ_SZ];
    char sql_password[DBRELAY_OBJ_SZ];
    char connection_name[DBRELAY_NAME_SZ];
+   char sql_dbtype[DBRELAY_OBJ_SZ];
    long connection_timeout;
    time_t tm_create;
    time_t tm_accessed;
@@ -146,9 +289,43 @@ typedef struct {
    pid_t pid;
    pid_t helper_pid;
    char sock_path[DBRELAY_NAME_SZ];
+   unsigned int sessions;  /* connector shared with up to this many slots */
    void *db;
 } dbrelay_connection_t;
 
+#define DBRELAY_BATCH_ROWS 64
+#define DBRELAY_BATCH_BLOCK 65536
+
+typedef struct dbrelay_batch_block_s {
+   struct dbrelay_batch_block_s *next;
+   size_t size;
+   size_t used;
+   char data[1];
+} dbrelay_batch_block_t;
+
+/*
+ * up to maxrows rows of a result set, stored by column. Values point into
+ * the driver's buffers or, for drivers that reuse theirs row by row, into
+ * copies held in blocks. Either way they are good until the next fetch.
+ */
+typedef struct {
+   int numcols;
+   int maxrows;
+   int rows;              /* filled by the last fetch_batch */
+   char **values;         /* values[col * maxrows + row], not null terminated */
+   int *lengths;
+   unsigned char *nulls;  /* a bit per row, nullbytes per column */
+   unsigned char *quotes; /* the same, for values quoted whatever their column */
+   int nullbytes;
+   unsigned char *quoted; /* per column, is_quoted as of the first row */
+   dbrelay_batch_block_t *blocks;
+} dbrelay_batch_t;
+
+#define DBRELAY_BATCH_VALUE(b, col, row) ((b)->values[(col) * (b)->maxrows + (row)])
+#define DBRELAY_BATCH_LENGTH(b, col, row) ((b)->lengths[(col) * (b)->maxrows + (row)])
+#define DBRELAY_BATCH_IS_NULL(b, col, row) ((b)->nulls[(col) * (b)->nullbytes + (row) / 8] & (1 << ((row) % 8)))
+#define DBRELAY_BATCH_IS_QUOTED(b, col, row) ((b)->quoted[col] || ((b)->quotes[(col) * (b)->nullbytes + (row) / 8] & (1 << ((row) % 8))))
+
 typedef void (*dbrelay_db_init)(void);
 typedef void *(*dbrelay_db_connect)(dbrelay_request_t *request);
 typedef void (*dbrelay_db_close)(void *db);
@@ -170,6 +347,14 @@ typedef char *(*dbrelay_db_colvalue)(void *db, int colnum, char *dest);
 typedef char *(*dbrelay_db_error)(void *db);
 typedef char *(*dbrelay_db_catalogsql)(int dbcmd, char **params);
 typedef int (*dbrelay_db_isalive)(void *db);
+typedef int (*dbrelay_db_cancel)(void *db);
+/* 
+ * optional, the value in the driver's own buffer, valid until the next 
+ * fetch_row, and its length. NULL for a NULL value.
+ */
+typedef char *(*dbrelay_db_colvalue_ref)(void *db, int colnum, int *len);
+/* optional, fill batch with the next rows, returns how many, 0 at the end */
+typedef int (*dbrelay_db_fetch_batch)(void *db, dbrelay_batch_t *batch);
 
 typedef struct {
    dbrelay_db_init init;
@@ -193,13 +378,31 @@ typedef struct {
    dbrelay_db_error error;
    dbrelay_db_catalogsql catalogsql;
    dbrelay_db_isalive isalive;
+   dbrelay_db_cancel cancel;
+   dbrelay_db_colvalue_ref colvalue_ref;
+   dbrelay_db_fetch_batch fetch_batch;
 
 } dbrelay_dbapi_t;
 
+dbrelay_dbapi_t *dbrelay_db_find_api(char *dbtype);
+int dbrelay_db_select_api(dbrelay_request_t *request);
+void dbrelay_db_init_apis();
 u_char *dbrelay_db_run_query(dbrelay_request_t *request);
 u_char *dbrelay_db_status(dbrelay_request_t *request);
 void dbrelay_db_close_connection(dbrelay_connection_t *conn, dbrelay_request_t *request);
 void dbrelay_copy_string(char *dest, char *src, int sz);
+int dbrelay_db_check_cancel(dbrelay_request_t *request);
+void *dbrelay_request_alloc(dbrelay_request_t *request, size_t sz);
+char *dbrelay_request_strdup(dbrelay_request_t *request, char *s);
+char *dbrelay_request_errbuf(dbrelay_request_t *request);
+void dbrelay_request_set_param(dbrelay_request_t *request, int i, char *value);
+int dbrelay_db_check_timeout(dbrelay_request_t *request);
+unsigned long dbrelay_usecs_since(struct timeval *start);
+char *dbrelay_exec_error(dbrelay_connection_t *conn, dbrelay_request_t *request);
+
+/* params.c */
+char *dbrelay_sql_bind_params(char *sql, char **params, char *prefix);
+unsigned long long dbrelay_sql_fingerprint(char *sql, char *norm, size_t normsz);
 
 
 
@@ -209,9 +412,74 @@ void dbrelay_log_notice(dbrelay_request_t *request, const char *fmt, ...);
 void dbrelay_log_warn(dbrelay_request_t *request, const char *fmt, ...);
 void dbrelay_log_error(dbrelay_request_t *request, const char *fmt, ...);
 
-dbrelay_request_t *dbrelay_alloc_request();
+dbrelay_request_t *dbrelay_alloc_request(void *pool);
 void dbrelay_free_request(dbrelay_request_t *request);
 
+/* metrics.c */
+void dbrelay_metrics_request(dbrelay_request_t *request, int error_class);
+void dbrelay_metrics_shm_wait(unsigned long usecs);
+void dbrelay_metrics_connector(int spawned);
+void dbrelay_metrics_waiting(int delta);
+void dbrelay_metrics_pool_wait(int priority, int outcome, unsigned long usecs, int depth);
+char *dbrelay_metrics_text();
+void dbrelay_metrics_destroy();
+
+/* querylog.c */
+void dbrelay_querylog_append(dbrelay_request_t *request, int err_class, char *error);
+int dbrelay_querylog_drain(int fd);
+unsigned long dbrelay_querylog_dropped();
+void dbrelay_querylog_destroy();
+
+/* batch.c */
+dbrelay_batch_t *dbrelay_batch_new(int numcols, int maxrows);
+void dbrelay_batch_free(dbrelay_batch_t *batch);
+void dbrelay_batch_reset(dbrelay_batch_t *batch);
+char *dbrelay_batch_alloc(dbrelay_batch_t *batch, size_t len);
+void dbrelay_batch_set(dbrelay_batch_t *batch, int col, int row, char *value, int len);
+void dbrelay_batch_copy(dbrelay_batch_t *batch, int col, int row, char *value, int len);
+void dbrelay_batch_quote(dbrelay_batch_t *batch, int col, int row);
+
+/* slowlog.c */
+void dbrelay_slowlog_append(dbrelay_request_t *request);
+int dbrelay_slowlog_read(dbrelay_slowlog_entry_t *out, int max);
+void dbrelay_slowlog_destroy();
+
+/* statements.c */
+void dbrelay_statements_record(dbrelay_request_t *request, int err_class);
+dbrelay_statement_t *dbrelay_statements_read(int *count);
+unsigned long dbrelay_statement_percentile(dbrelay_statement_t *stmt, int pct);
+void dbrelay_statements_reset();
+void dbrelay_statements_destroy();
+
+/* standby.c */
+int dbrelay_standby_take(char *sock_path);
+void dbrelay_standby_start(int target);
+void dbrelay_standby_destroy();
+
+/* waitq.c */
+int dbrelay_waitq_join(int priority, int *depth);
+void dbrelay_waitq_leave(int waiter);
+int dbrelay_waitq_is_next(int waiter);
+int dbrelay_waitq_ahead(int priority);
+int dbrelay_waitq_depth(int priority);
+void dbrelay_waitq_destroy();
+
+/* limiter.c */
+int dbrelay_limiter_acquire(dbrelay_request_t *request);
+void dbrelay_limiter_release(dbrelay_request_t *request, int err_class);
+int dbrelay_limiter_read(dbrelay_limiter_stat_t *out, int max);
+void dbrelay_limiter_destroy();
+
+/* ratelimit.c */
+dbrelay_ratelimit_t *dbrelay_ratelimit_acquire(dbrelay_request_t *request);
+void dbrelay_ratelimit_release(dbrelay_request_t *request);
+void dbrelay_ratelimit_destroy();
+
+/* router.c */
+void dbrelay_router_route(dbrelay_request_t *request);
+void dbrelay_router_done(dbrelay_request_t *request);
+void dbrelay_router_destroy();
+
 /* shmem.c */
 void dbrelay_create_shmem();
 dbrelay_connection_t *dbrelay_get_shmem();
@@ -224,7 +492,7 @@ pid_t dbrelay_conn_initialize(int s, dbrelay_request_t *request);
 char *dbrelay_conn_send_request(int s, dbrelay_request_t *request, int *error);
 int dbrelay_conn_set_option(int s, char *option, char *value);
 pid_t dbrelay_conn_launch_connector(char *sock_path, dbrelay_request_t *request);
-u_char *dbrelay_exec_query(dbrelay_connection_t *conn, char *database, char *sql, unsigned long flags); 
+u_char *dbrelay_exec_query(dbrelay_connection_t *conn, dbrelay_request_t *request, char *sql);
 void dbrelay_conn_kill(int s);
 void dbrelay_conn_close(int s);
 
@@ -235,5 +503,6 @@ u_char *dbrelay_db_cmd(dbrelay_request_t *request);
 int dbrelay_socket_connect(char *sock_path, int timeout, int *error);
 int dbrelay_socket_recv_string(int s, char *in_buf, int *in_ptr, char *out_buf, int timeout);
 int dbrelay_socket_send_string(int s, char *str);
+int dbrelay_socket_peek(int s, char *buf, int sz);
 
 #endif /* _DBRELAY_H_INCLUDED_ */
@@ -33,6 +33,8 @@
  */
 
 #include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
 #include "json.h"
 
 json_t *json_new()
@@ -64,6 +66,16 @@ char *json_to_string(json_t *json)
 {
    return sb_to_char(json->sb);
 }
+/* returns the text written so far and empties the buffer, nesting is kept */
+char *json_flush(json_t *json)
+{
+   char *s = sb_to_char(json->sb);
+
+   sb_free(json->sb);
+   json->sb = sb_new(NULL);
+
+   return s;
+}
 static void json_tab(json_t *json)
 {
    int i;
@@ -198,40 +210,70 @@ static void append_nonprintable(stringbuf_t *sb, char c)
       break;
    }
 }
+/*
+ * true if any of the 8 bytes at s needs escaping, tested a word at a time:
+ * control characters, '"', '\\' and, where char is signed, the high half
+ */
+#define JSON_ONES 0x0101010101010101ULL
+#define JSON_HIGHS 0x8080808080808080ULL
+#define JSON_HAS_ZERO(x) (((x) - JSON_ONES) & ~(x) & JSON_HIGHS)
+static int json_word_needs_escape(const char *s)
+{
+   uint64_t w;
+
+   memcpy(&w, s, sizeof(w));
+#if CHAR_MIN < 0
+   if (w & JSON_HIGHS) return 1;
+#endif
+   return ((w - JSON_ONES * ' ') & ~w & JSON_HIGHS) ||
+          JSON_HAS_ZERO(w ^ (JSON_ONES * '"')) ||
+          JSON_HAS_ZERO(w ^ (JSON_ONES * '\\')) ? 1 : 0;
+}
 void json_add_null(json_t *json, char *key)
 {
    json_add_key(json, key);
    sb_append(json->sb, "null");
    json->pending = 0;
 }
+void json_add_number_len(json_t *json, char *key, char *value, size_t len)
+{
+   json_add_key(json, key);
+   sb_append_len(json->sb, value, len);
+   json->pending = 0;
+}
 void json_add_string(json_t *json, char *key, char *value)
 {
-   char *s, *first, *tmp;
-   char c;
-   
-   tmp = strdup(value);
+   json_add_string_len(json, key, value, strlen(value));
+}
+/* value need not be null terminated, runs between escapes are appended as is */
+void json_add_string_len(json_t *json, char *key, char *value, size_t len)
+{
+   char *s, *first, *end = value + len;
 
    json_add_key(json, key);
    sb_append(json->sb, "\"");
-   for (s=tmp, first=tmp; *s; s++) {
+   for (s=value, first=value; s<end; s++) {
+      /* skip clean runs 8 bytes at a time */
+      while (end - s >= 8 && !json_word_needs_escape(s)) s += 8;
+      if (s>=end) break;
       if (!is_printable(*s)) {
-         c = *s;
-         *s='\0';
-         sb_append(json->sb, first);
-         append_nonprintable(json->sb, c);
+         if (s>first) sb_append_len(json->sb, first, s - first);
+         append_nonprintable(json->sb, *s);
          first=s+1;	
       }
    }
-   sb_append(json->sb, first);
+   if (end>first) sb_append_len(json->sb, first, end - first);
    sb_append(json->sb, "\"");
    json->pending = 0;
-
-   free(tmp);
 }
 void json_add_json(json_t *json, char *value)
 {
    sb_append(json->sb, value);
 }
+void json_add_json_len(json_t *json, char *value, size_t len)
+{
+   sb_append_len(json->sb, value, len);
+}
 
 void json_push(json_t *json, int node_type)
 {
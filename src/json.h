@@ -65,6 +65,7 @@ json_t *json_new();
 void json_pretty_print(json_t *json, unsigned char pp);
 void json_free(json_t *json);
 char *json_to_string(json_t *json);
+char *json_flush(json_t *json);
 void json_new_object(json_t *json);
 void json_end_object(json_t *json);
 void json_new_array(json_t *json);
@@ -73,7 +74,10 @@ void json_add_value(json_t *json, char *value);
 void json_add_key(json_t *json, char *key);
 void json_add_number(json_t *json, char *key, char *value);
 void json_add_string(json_t *json, char *key, char *value);
+void json_add_number_len(json_t *json, char *key, char *value, size_t len);
+void json_add_string_len(json_t *json, char *key, char *value, size_t len);
 void json_add_json(json_t *json, char *value);
+void json_add_json_len(json_t *json, char *value, size_t len);
 void json_add_null(json_t *json, char *key);
 void json_push(json_t *json, int node_type);
 void json_add_callback(json_t *json, char *value);
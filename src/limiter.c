@@ -0,0 +1,314 @@
+/*
+ * DB Relay is an HTTP module built on the NGiNX webserver platform which 
+ * communicates with a variety of database servers and returns JSON formatted 
+ * data.
+ * 
+ * Copyright (C) 2008-2010 Getco LLC
+ * 
+ * This program is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by the Free 
+ * Software Foundation, either version 3 of the License, or (at your option) 
+ * any later version. In addition, redistributions in source code and in binary 
+ * form must 
+ * include the above copyright notices, and each of the following disclaimers. 
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS “AS IS” 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANY COPYRIGHT OWNERS OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Adaptive limit on the queries run concurrently against each backend 
+ * server.  Every worker shares one table, in a SysV segment, with an 
+ * entry per sql_server/sql_port holding the current limit and the 
+ * requests holding a place under it.
+ *
+ * The limit follows AIMD: each query that completes in reasonable time
+ * adds 1/limit, so a full window of them grows it by one, while a query 
+ * timing out or a short run of latency well above the backend's long
+ * term average cuts it to 90%, at most once per cooldown.  Requests over
+ * the limit wait up to pool_wait for a place and are shed after that.
+ */
+
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/time.h>
+#include <signal.h>
+#include "dbrelay.h"
+#include "../include/dbrelay_config.h"
+
+#define DBRELAY_LIMITER_BACKENDS 64
+
+/* limits are kept in thousandths so increases of 1/limit add up */
+#define LIMIT_SCALE 1000
+/* cut to this many thousandths of the limit when congested */
+#define LIMIT_BACKOFF 900
+/* recent latency this many times the long term average is congestion */
+#define LIMIT_TOLERANCE 2
+/* usecs between cuts, so one burst of slow queries cuts the limit once */
+#define LIMIT_COOLDOWN 250000
+/* longest sleep waiting for a place, usecs */
+#define LIMIT_NAP 20000
+
+#define BACKEND_FREE 0
+#define BACKEND_CLAIMED 1
+#define BACKEND_READY 2
+
+#define ATOMIC_ADD(p, v) __sync_fetch_and_add((p), (v))
+
+typedef struct {
+   volatile unsigned int state;
+   unsigned int hash;
+   char sql_server[DBRELAY_NAME_SZ];
+   char sql_port[6];
+   volatile int inflight;
+   volatile unsigned long limit;          /* scaled */
+   volatile unsigned long max;            /* scaled */
+   volatile unsigned long recent;         /* latency ewma, usecs, 1/8 */
+   volatile unsigned long average;        /* latency ewma, usecs, 1/128 */
+   volatile unsigned long last_cut;       /* usecs since the epoch */
+   unsigned long queued;
+   unsigned long shed;
+   volatile pid_t holders[DBRELAY_LIMITER_MAX];  /* so places held by dead workers are returned */
+} dbrelay_backend_t;
+
+typedef struct {
+   dbrelay_backend_t backends[DBRELAY_LIMITER_BACKENDS];
+} dbrelay_limiter_t;
+
+static dbrelay_limiter_t *limiter;
+
+static key_t dbrelay_limiter_ipc_key()
+{
+   return ftok(DBRELAY_PREFIX, 8);
+}
+static dbrelay_limiter_t *dbrelay_limiter_get(int create)
+{
+   int shmid;
+   void *p;
+
+   if (limiter) return limiter;
+
+   shmid = shmget(dbrelay_limiter_ipc_key(), sizeof(dbrelay_limiter_t), (create ? IPC_CREAT : 0) | 0600);
+   if (shmid==-1) return NULL;
+   p = shmat(shmid, NULL, 0);
+   if (p==(void *) -1) return NULL;
+   limiter = (dbrelay_limiter_t *) p;
+
+   return limiter;
+}
+void dbrelay_limiter_destroy()
+{
+   int shmid;
+
+   if (limiter) shmdt(limiter);
+   limiter = NULL;
+   shmid = shmget(dbrelay_limiter_ipc_key(), sizeof(dbrelay_limiter_t), 0600);
+   if (shmid!=-1) shmctl(shmid, IPC_RMID, NULL);
+}
+static unsigned int dbrelay_limiter_hash(dbrelay_request_t *request)
+{
+   unsigned int h = 5381;
+   char *s;
+
+   for (s=request->sql_server; *s; s++) h = h * 33 + (unsigned char) *s;
+   h = h * 33 + ':';
+   for (s=request->sql_port; *s; s++) h = h * 33 + (unsigned char) *s;
+   return h;
+}
+/*
+ * find or claim the entry for the request's backend by open addressing,
+ * NULL once the table is full and the backend goes unlimited
+ */
+static dbrelay_backend_t *dbrelay_limiter_backend(dbrelay_limiter_t *l, dbrelay_request_t *request)
+{
+   dbrelay_backend_t *b;
+   unsigned int hash = dbrelay_limiter_hash(request);
+   int i, n;
+
+   for (n=0; n<DBRELAY_LIMITER_BACKENDS; n++) {
+      i = (hash + n) % DBRELAY_LIMITER_BACKENDS;
+      b = &l->backends[i];
+      if (b->state==BACKEND_FREE && __sync_bool_compare_and_swap(&b->state, BACKEND_FREE, BACKEND_CLAIMED)) {
+         b->hash = hash;
+         dbrelay_copy_string(b->sql_server, request->sql_server, sizeof(b->sql_server));
+         dbrelay_copy_string(b->sql_port, request->sql_port, sizeof(b->sql_port));
+         __sync_synchronize();
+         b->state = BACKEND_READY;
+         return b;
+      }
+      while (b->state==BACKEND_CLAIMED);
+      if (b->hash==hash && 
+          !strcmp(b->sql_server, request->sql_server) &&
+          !strcmp(b->sql_port, request->sql_port))
+         return b;
+   }
+   return NULL;
+}
+static unsigned long dbrelay_limiter_now()
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return (unsigned long) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+/* return places held by workers that died mid query */
+static void dbrelay_limiter_reap(dbrelay_backend_t *b)
+{
+   pid_t pid;
+   int i;
+
+   for (i=0; i<DBRELAY_LIMITER_MAX; i++) {
+      pid = b->holders[i];
+      if (pid && kill(pid, 0) && __sync_bool_compare_and_swap(&b->holders[i], pid, 0))
+         ATOMIC_ADD(&b->inflight, -1);
+   }
+}
+static int dbrelay_limiter_hold(dbrelay_backend_t *b)
+{
+   int i;
+
+   for (i=0; i<DBRELAY_LIMITER_MAX; i++) {
+      if (!b->holders[i] && __sync_bool_compare_and_swap(&b->holders[i], 0, getpid())) return i;
+   }
+   return -1;
+}
+/*
+ * take a place under the backend's limit, waiting up to pool_wait for 
+ * one. Returns 0 if the request should be shed.
+ */
+int dbrelay_limiter_acquire(dbrelay_request_t *request)
+{
+   dbrelay_limiter_t *l;
+   dbrelay_backend_t *b;
+   struct timeval start;
+   useconds_t nap = 1000;
+   unsigned long max;
+   int n, b_idx, holder, waited = 0;
+
+   request->limiter = 0;
+   if (!request->backend_limit) return 1;
+   if (!(l = dbrelay_limiter_get(1)) || !(b = dbrelay_limiter_backend(l, request))) return 1;
+   b_idx = b - l->backends;
+
+   max = (unsigned long) (request->backend_limit > DBRELAY_LIMITER_MAX ? DBRELAY_LIMITER_MAX : request->backend_limit) * LIMIT_SCALE;
+   if (b->max!=max) b->max = max;
+   if (!b->limit || b->limit > max) b->limit = max;
+
+   gettimeofday(&start, NULL);
+   for (;;) {
+      n = b->inflight;
+      if (n < (int) (b->limit / LIMIT_SCALE)) {
+         if (!__sync_bool_compare_and_swap(&b->inflight, n, n + 1)) continue;
+         if ((holder = dbrelay_limiter_hold(b))==-1) {
+            ATOMIC_ADD(&b->inflight, -1);
+         } else {
+            request->limiter = b_idx * DBRELAY_LIMITER_MAX + holder + 1;
+            return 1;
+         }
+      }
+      if (!waited) {
+         waited = 1;
+         ATOMIC_ADD(&b->queued, 1);
+         dbrelay_log_info(request, "%d queries running on %s, waiting", n, request->sql_server);
+         dbrelay_limiter_reap(b);
+      }
+      if (dbrelay_usecs_since(&start) >= request->pool_wait * 1000 || dbrelay_db_check_cancel(request)) {
+         ATOMIC_ADD(&b->shed, 1);
+         return 0;
+      }
+      usleep(nap);
+      if (nap < LIMIT_NAP) nap *= 2;
+   }
+}
+/* fold a latency sample into an ewma with weight 1/(1 << shift) */
+static unsigned long dbrelay_limiter_ewma(unsigned long avg, unsigned long sample, int shift)
+{
+   if (!avg) return sample;
+   if (sample > avg) return avg + ((sample - avg) >> shift);
+   return avg - ((avg - sample) >> shift);
+}
+/*
+ * give back the place taken by acquire and adjust the limit from how 
+ * the query went. request->timings must be filled in.
+ */
+void dbrelay_limiter_release(dbrelay_request_t *request, int err_class)
+{
+   dbrelay_backend_t *b;
+   unsigned long sample, limit, next, now, last;
+   int congested;
+
+   if (!request->limiter || !limiter) return;
+   b = &limiter->backends[(request->limiter - 1) / DBRELAY_LIMITER_MAX];
+   b->holders[(request->limiter - 1) % DBRELAY_LIMITER_MAX] = 0;
+   ATOMIC_ADD(&b->inflight, -1);
+   request->limiter = 0;
+
+   /* failures before or beside the query say nothing about the server's load */
+   if (err_class!=DBRELAY_ERR_NONE && err_class!=DBRELAY_ERR_QUERY && err_class!=DBRELAY_ERR_TIMEOUT) return;
+
+   sample = request->timings.exec + request->timings.fetch;
+   b->recent = dbrelay_limiter_ewma(b->recent, sample, 3);
+   b->average = dbrelay_limiter_ewma(b->average, sample, 7);
+   congested = err_class==DBRELAY_ERR_TIMEOUT || b->recent > b->average * LIMIT_TOLERANCE;
+
+   if (congested) {
+      now = dbrelay_limiter_now();
+      last = b->last_cut;
+      if (now - last < LIMIT_COOLDOWN || !__sync_bool_compare_and_swap(&b->last_cut, last, now)) return;
+      do {
+         limit = b->limit;
+         next = limit * LIMIT_BACKOFF / 1000;
+         if (next < LIMIT_SCALE) next = LIMIT_SCALE;
+      } while (!__sync_bool_compare_and_swap(&b->limit, limit, next));
+      dbrelay_log_notice(request, "%s is congested, concurrency limit cut to %lu", request->sql_server, next / LIMIT_SCALE);
+   } else {
+      do {
+         limit = b->limit;
+         if (limit >= b->max) return;
+         next = limit + LIMIT_SCALE * LIMIT_SCALE / limit;
+         if (next > b->max) next = b->max;
+      } while (!__sync_bool_compare_and_swap(&b->limit, limit, next));
+   }
+}
+/*
+ * copy up to max backends into out for metrics, returns the number copied
+ */
+int dbrelay_limiter_read(dbrelay_limiter_stat_t *out, int max)
+{
+   dbrelay_limiter_t *l;
+   dbrelay_backend_t *b;
+   int i, n = 0;
+
+   if (!(l = dbrelay_limiter_get(0))) return 0;
+
+   for (i=0; i<DBRELAY_LIMITER_BACKENDS && n<max; i++) {
+      b = &l->backends[i];
+      if (b->state!=BACKEND_READY) continue;
+      strcpy(out[n].sql_server, b->sql_server);
+      strcpy(out[n].sql_port, b->sql_port);
+      out[n].limit = b->limit / LIMIT_SCALE;
+      out[n].inflight = b->inflight;
+      out[n].queued = b->queued;
+      out[n].shed = b->shed;
+      out[n].latency = b->recent;
+      n++;
+   }
+   return n;
+}
@@ -45,18 +45,15 @@ void
 dbrelay_log(unsigned int log_level, dbrelay_request_t *request, const char *fmt, va_list args)
 {
    u_char buf[NGX_MAX_ERROR_STR];
+#ifndef CMDLINE
    u_char *p;
 
-   /* ngx_vsnprintf() does not appear to null terminate the buffer it writes
-    * into and provides no length, therefore we must do this
-    */
-   memset(buf, 0, NGX_MAX_ERROR_STR);
-
-#ifndef CMDLINE
-   p = ngx_vsnprintf(buf, NGX_MAX_ERROR_STR, fmt, args);
+   /* ngx_vsnprintf() does not null terminate, it returns the end instead */
+   p = ngx_vsnprintf(buf, NGX_MAX_ERROR_STR - 1, fmt, args);
+   *p = '\0';
    ngx_log_error(log_level, request->log, 0, "%s\n", (char *)buf);
 #else
-   p = vsnprintf((char *)buf, NGX_MAX_ERROR_STR, fmt, args);
+   vsnprintf((char *)buf, NGX_MAX_ERROR_STR, fmt, args);
    fprintf(stderr, "%s\n", (char *)buf);
 #endif
 }
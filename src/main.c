@@ -46,6 +46,7 @@
 static char *dbrelay_readline(char *prompt);
 static void dbrelay_add_history(const char *s);
 static void write_flag_values(dbrelay_request_t *request, char *value);
+static void read_param_file(dbrelay_request_t *request, char *fname);
 
 static int istty;
 static char *input_file;
@@ -56,7 +57,7 @@ populate_request(int argc, char **argv, dbrelay_request_t *request)
     int opt;
     int required = 0;
 
-    while ((opt = getopt(argc, argv, "h:p:u:w:c:t:d:v:f:F:T:S:C:E:")) != -1) {
+    while ((opt = getopt(argc, argv, "h:p:u:w:c:t:d:v:f:F:P:T:Q:S:C:E:")) != -1) {
           switch (opt) {
           case 'c':
                   strcpy(request->connection_name, optarg);
@@ -76,6 +77,9 @@ populate_request(int argc, char **argv, dbrelay_request_t *request)
           case 'F':
                   write_flag_values(request, optarg);
                   break;
+          case 'P':
+                  read_param_file(request, optarg);
+                  break;
           case 'h':
                   strcpy(request->sql_server, optarg);
                   required++;
@@ -92,6 +96,9 @@ populate_request(int argc, char **argv, dbrelay_request_t *request)
           case 'T':
                   request->connection_timeout = atoi(optarg);
                   break;
+          case 'Q':
+                  request->query_timeout = atoi(optarg);
+                  break;
           case 't':
                   strcpy(request->query_tag, optarg);
                   break;
@@ -133,6 +140,25 @@ slurp_input_file(char *fname, char **mybuf, int *bufsz, size_t *buflen, int *lin
        (*line)++;
    }
 }
+/* one "type:value" per line, bound to the query's placeholders in order */
+static void
+read_param_file(dbrelay_request_t *request, char *fname)
+{
+   FILE *fp = NULL;
+   char linebuf[1024];
+   char *n;
+   int i = 0;
+
+   if ((fp = fopen(fname, "r")) == NULL) {
+       fprintf(stderr, "Unable to open parameter file '%s': %s\n", fname, strerror(errno));
+       return;
+   }
+   while (i < DBRELAY_MAX_PARAMS && fgets(linebuf, sizeof(linebuf), fp) != NULL) {
+       if ((n = strpbrk(linebuf, "\r\n")) != NULL) *n = '\0';
+       dbrelay_request_set_param(request, i++, linebuf);
+   }
+   fclose(fp);
+}
 int main(int argc, char **argv)
 {
     u_char *json_output;
@@ -150,12 +176,12 @@ int main(int argc, char **argv)
 
     istty = isatty(0);
 
-    request = dbrelay_alloc_request();
+    request = dbrelay_alloc_request(NULL);
     strcpy(request->sql_port, "1433");
     request->log_level = 0;
 
     if (!populate_request(argc, argv, request)) {
-       printf("Usage: %s -u <user> -h <host> [-c <connection name>] [-d <database>] [-f <input file>] [-l <log level>] [-p <port>] [-t <tag>] [-v] [-w <password>]\n", argv[0]);
+       printf("Usage: %s -u <user> -h <host> [-c <connection name>] [-d <database>] [-f <input file>] [-l <log level>] [-p <port>] [-P <param file>] [-t <tag>] [-v] [-w <password>]\n", argv[0]);
        exit(1);
     }
 
@@ -199,7 +225,7 @@ int main(int argc, char **argv)
 	       param0 = strtok(NULL, " \t\n\r");
 	       fprintf(stderr, "killing %s\n", param0);
                strcpy(request->cmd,"kill");
-               request->params[0] = param0;
+               dbrelay_request_set_param(request, 0, param0);
 	       json_output = dbrelay_db_cmd(request);
 	       free(m2);
 	    } else if (strlen(mybuf)>=11 && !strncmp(mybuf, "list tables", 11)) {
@@ -211,7 +237,7 @@ int main(int argc, char **argv)
 	       strtok(NULL, " \t\n\r");
 	       param0 = strtok(NULL, " \t\n\r");
                strcpy(request->cmd,"columns");
-               request->params[0] = param0;
+               dbrelay_request_set_param(request, 0, param0);
 	       json_output = dbrelay_db_cmd(request);
 	       free(m2);
 	    } else if (strlen(mybuf)>=9 && !strncmp(mybuf, "list keys", 9)) {
@@ -220,7 +246,7 @@ int main(int argc, char **argv)
 	       strtok(NULL, " \t\n\r");
 	       param0 = strtok(NULL, " \t\n\r");
                strcpy(request->cmd,"pkey");
-               request->params[0] = param0;
+               dbrelay_request_set_param(request, 0, param0);
 	       json_output = dbrelay_db_cmd(request);
 	       free(m2);
             } else {
@@ -333,6 +359,9 @@ write_flag_values(dbrelay_request_t *request, char *value)
       else if (!strcmp(tok, "xact")) request->flags|=DBRELAY_FLAG_XACT;
       else if (!strcmp(tok, "embedcsv")) request->flags|=DBRELAY_FLAG_EMBEDCSV;
       else if (!strcmp(tok, "nomagic")) request->flags|=DBRELAY_FLAG_NOMAGIC;
+      else if (!strcmp(tok, "timings")) request->flags|=DBRELAY_FLAG_TIMINGS;
+      else if (!strcmp(tok, "prepare")) request->flags|=DBRELAY_FLAG_PREPARE;
+      else if (!strcmp(tok, "readonly")) request->flags|=DBRELAY_FLAG_READONLY;
    }
    free(flags);
 }
@@ -0,0 +1,484 @@
+/*
+ * DB Relay is an HTTP module built on the NGiNX webserver platform which 
+ * communicates with a variety of database servers and returns JSON formatted 
+ * data.
+ * 
+ * Copyright (C) 2008-2010 Getco LLC
+ * 
+ * This program is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by the Free 
+ * Software Foundation, either version 3 of the License, or (at your option) 
+ * any later version. In addition, redistributions in source code and in binary 
+ * form must 
+ * include the above copyright notices, and each of the following disclaimers. 
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS “AS IS” 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANY COPYRIGHT OWNERS OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Request metrics kept in a SysV segment of their own so that every worker,
+ * the command line tool and the connectors add to the same numbers.  All
+ * updates are atomic adds, nothing here takes the slot table semaphore
+ * except the pool occupancy gauges read at scrape time.
+ */
+
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include "dbrelay.h"
+#include "stringbuf.h"
+#include "../include/dbrelay_config.h"
+
+#define DBRELAY_METRICS_SERIES 128
+#define DBRELAY_METRICS_BUCKETS 15   /* including +Inf */
+
+#define DBRELAY_SERIES_FREE 0
+#define DBRELAY_SERIES_CLAIMED 1
+#define DBRELAY_SERIES_READY 2
+
+#define ATOMIC_ADD(p, v) __sync_fetch_and_add((p), (v))
+
+typedef struct {
+   unsigned long buckets[DBRELAY_METRICS_BUCKETS];
+   unsigned long count;
+   unsigned long sum;                /* usecs */
+} dbrelay_histogram_t;
+
+typedef struct {
+   volatile unsigned int state;
+   unsigned int hash;
+   char sql_server[DBRELAY_NAME_SZ];
+   char sql_database[DBRELAY_OBJ_SZ];
+   char query_tag[DBRELAY_NAME_SZ];
+   dbrelay_histogram_t latency;
+   unsigned long rows;
+   unsigned long bytes;
+} dbrelay_metrics_series_t;
+
+typedef struct {
+   dbrelay_metrics_series_t series[DBRELAY_METRICS_SERIES];
+   dbrelay_metrics_series_t overflow;  /* once every series is taken */
+   unsigned long errors[DBRELAY_ERR_CLASSES];
+   unsigned long connector_spawns;
+   unsigned long connector_deaths;
+   long waiting;
+   dbrelay_histogram_t shm_wait;
+   dbrelay_histogram_t pool_wait[DBRELAY_PRIORITIES];
+   dbrelay_histogram_t pool_queue_depth;  /* requests ahead on joining */
+   unsigned long pool_waits[DBRELAY_PRIORITIES][DBRELAY_WAIT_OUTCOMES];
+} dbrelay_metrics_t;
+
+/* upper bounds in usecs, the last bucket is +Inf */
+static const unsigned long latency_bounds[DBRELAY_METRICS_BUCKETS - 1] = {
+   1000, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+   1000000, 2500000, 5000000, 10000000, 30000000, 60000000
+};
+static const unsigned long shm_wait_bounds[DBRELAY_METRICS_BUCKETS - 1] = {
+   5, 10, 25, 50, 100, 250, 500, 1000,
+   2500, 5000, 10000, 50000, 100000, 1000000
+};
+/* a count, not usecs */
+static const unsigned long depth_bounds[DBRELAY_METRICS_BUCKETS - 1] = {
+   0, 1, 2, 3, 4, 6, 8, 12, 16, 24, 32, 64, 128, 256
+};
+static char *priority_names[DBRELAY_PRIORITIES] = {
+   "high", "normal", "low"
+};
+static char *wait_outcome_names[DBRELAY_WAIT_OUTCOMES] = {
+   "acquired", "timeout", "full", "cancelled"
+};
+char *dbrelay_error_class_names[DBRELAY_ERR_CLASSES] = {
+   "", "request", "pool", "connector", "login", "query", "timeout", "cancelled", "ratelimit"
+};
+
+static dbrelay_metrics_t *metrics;
+
+static key_t dbrelay_metrics_ipc_key()
+{
+   return ftok(DBRELAY_PREFIX, 2);
+}
+/*
+ * attach on first use, a fresh segment is zero filled so whoever gets
+ * there first creates it
+ */
+static dbrelay_metrics_t *dbrelay_metrics_get()
+{
+   int shmid;
+   void *p;
+
+   if (metrics) return metrics;
+
+   shmid = shmget(dbrelay_metrics_ipc_key(), sizeof(dbrelay_metrics_t), IPC_CREAT | 0600);
+   if (shmid==-1) return NULL;
+   p = shmat(shmid, NULL, 0);
+   if (p==(void *) -1) return NULL;
+   metrics = (dbrelay_metrics_t *) p;
+
+   return metrics;
+}
+void dbrelay_metrics_destroy()
+{
+   int shmid;
+
+   if (metrics) shmdt(metrics);
+   metrics = NULL;
+   shmid = shmget(dbrelay_metrics_ipc_key(), sizeof(dbrelay_metrics_t), 0600);
+   if (shmid!=-1) shmctl(shmid, IPC_RMID, NULL);
+}
+static void dbrelay_histogram_observe(dbrelay_histogram_t *h, const unsigned long *bounds, unsigned long usecs)
+{
+   int i;
+
+   for (i=0; i<DBRELAY_METRICS_BUCKETS - 1; i++)
+      if (usecs <= bounds[i]) break;
+   ATOMIC_ADD(&h->buckets[i], 1);
+   ATOMIC_ADD(&h->sum, usecs);
+   ATOMIC_ADD(&h->count, 1);
+}
+static unsigned int dbrelay_metrics_hash(dbrelay_request_t *request)
+{
+   unsigned int h = 5381;
+   char *s;
+
+   for (s=request->sql_server; *s; s++) h = h * 33 + (unsigned char) *s;
+   h = h * 33 + '/';
+   for (s=request->sql_database; *s; s++) h = h * 33 + (unsigned char) *s;
+   h = h * 33 + '/';
+   for (s=request->query_tag; *s; s++) h = h * 33 + (unsigned char) *s;
+
+   return h;
+}
+/*
+ * find or claim the series for this server/database/query_tag by open
+ * addressing, a claimed slot is published by flipping it to READY after
+ * the labels are written
+ */
+static dbrelay_metrics_series_t *dbrelay_metrics_series(dbrelay_metrics_t *m, dbrelay_request_t *request)
+{
+   dbrelay_metrics_series_t *series;
+   unsigned int hash = dbrelay_metrics_hash(request);
+   int i, n;
+
+   for (n=0; n<DBRELAY_METRICS_SERIES; n++) {
+      i = (hash + n) % DBRELAY_METRICS_SERIES;
+      series = &m->series[i];
+
+      if (series->state==DBRELAY_SERIES_FREE &&
+          __sync_bool_compare_and_swap(&series->state, DBRELAY_SERIES_FREE, DBRELAY_SERIES_CLAIMED)) {
+         series->hash = hash;
+         dbrelay_copy_string(series->sql_server, request->sql_server, sizeof(series->sql_server));
+         dbrelay_copy_string(series->sql_database, request->sql_database, sizeof(series->sql_database));
+         dbrelay_copy_string(series->query_tag, request->query_tag, sizeof(series->query_tag));
+         __sync_synchronize();
+         series->state = DBRELAY_SERIES_READY;
+         return series;
+      }
+      /* another process is writing the labels, they are short */
+      while (series->state==DBRELAY_SERIES_CLAIMED)
+         __sync_synchronize();
+
+      if (series->hash==hash &&
+          !strcmp(series->sql_server, request->sql_server) &&
+          !strcmp(series->sql_database, request->sql_database) &&
+          !strcmp(series->query_tag, request->query_tag))
+         return series;
+   }
+   return &m->overflow;
+}
+/* request->timings must be complete, total and bytes included */
+void dbrelay_metrics_request(dbrelay_request_t *request, int error_class)
+{
+   dbrelay_metrics_t *m = dbrelay_metrics_get();
+   dbrelay_metrics_series_t *series;
+
+   if (!m) return;
+
+   series = dbrelay_metrics_series(m, request);
+   dbrelay_histogram_observe(&series->latency, latency_bounds, request->timings.total);
+   ATOMIC_ADD(&series->rows, request->timings.rows);
+   ATOMIC_ADD(&series->bytes, request->timings.bytes);
+
+   if (error_class!=DBRELAY_ERR_NONE && error_class<DBRELAY_ERR_CLASSES)
+      ATOMIC_ADD(&m->errors[error_class], 1);
+}
+void dbrelay_metrics_shm_wait(unsigned long usecs)
+{
+   dbrelay_metrics_t *m = dbrelay_metrics_get();
+
+   if (m) dbrelay_histogram_observe(&m->shm_wait, shm_wait_bounds, usecs);
+}
+void dbrelay_metrics_connector(int spawned)
+{
+   dbrelay_metrics_t *m = dbrelay_metrics_get();
+
+   if (!m) return;
+   if (spawned) ATOMIC_ADD(&m->connector_spawns, 1);
+   else ATOMIC_ADD(&m->connector_deaths, 1);
+}
+void dbrelay_metrics_waiting(int delta)
+{
+   dbrelay_metrics_t *m = dbrelay_metrics_get();
+
+   if (m) ATOMIC_ADD(&m->waiting, delta);
+}
+/* a request queued for a slot on an exhausted pool and how it ended */
+void dbrelay_metrics_pool_wait(int priority, int outcome, unsigned long usecs, int depth)
+{
+   dbrelay_metrics_t *m = dbrelay_metrics_get();
+
+   if (!m || priority<0 || priority>=DBRELAY_PRIORITIES) return;
+   ATOMIC_ADD(&m->pool_waits[priority][outcome], 1);
+   if (outcome==DBRELAY_WAIT_FULL) return;
+   dbrelay_histogram_observe(&m->pool_wait[priority], latency_bounds, usecs);
+   dbrelay_histogram_observe(&m->pool_queue_depth, depth_bounds, depth);
+}
+/*
+ * exposition format
+ */
+static void dbrelay_metrics_escape(char *dest, char *src)
+{
+   for (; *src; src++) {
+      if (*src=='\\' || *src=='"') *dest++ = '\\';
+      if (*src=='\n') {
+         *dest++ = '\\';
+         *dest++ = 'n';
+         continue;
+      }
+      *dest++ = *src;
+   }
+   *dest = '\0';
+}
+static void dbrelay_metrics_labels(char *dest, dbrelay_metrics_series_t *series)
+{
+   char server[DBRELAY_NAME_SZ * 2];
+   char database[DBRELAY_OBJ_SZ * 2];
+   char query_tag[DBRELAY_NAME_SZ * 2];
+
+   if (series->state!=DBRELAY_SERIES_READY) {
+      strcpy(dest, "sql_server=\"_other\",sql_database=\"\",query_tag=\"\"");
+      return;
+   }
+   dbrelay_metrics_escape(server, series->sql_server);
+   dbrelay_metrics_escape(database, series->sql_database);
+   dbrelay_metrics_escape(query_tag, series->query_tag);
+   sprintf(dest, "sql_server=\"%s\",sql_database=\"%s\",query_tag=\"%s\"", server, database, query_tag);
+}
+static void dbrelay_metrics_backend_labels(char *dest, dbrelay_limiter_stat_t *backend)
+{
+   char server[DBRELAY_NAME_SZ * 2];
+
+   dbrelay_metrics_escape(server, backend->sql_server);
+   sprintf(dest, "sql_server=\"%s\",sql_port=\"%s\"", server, backend->sql_port);
+}
+/* bounds and sum are usecs shown as seconds unless plain is set */
+static void dbrelay_metrics_histogram(stringbuf_t *sb, char *name, char *labels, dbrelay_histogram_t *h, const unsigned long *bounds, int plain)
+{
+   char line[1024];
+   unsigned long cumulative = 0;
+   int i;
+
+   for (i=0; i<DBRELAY_METRICS_BUCKETS; i++) {
+      cumulative += h->buckets[i];
+      if (i<DBRELAY_METRICS_BUCKETS - 1 && plain)
+         sprintf(line, "%s_bucket{%s%sle=\"%lu\"} %lu\n", name, labels, *labels ? "," : "", bounds[i], cumulative);
+      else if (i<DBRELAY_METRICS_BUCKETS - 1)
+         sprintf(line, "%s_bucket{%s%sle=\"%lu.%06lu\"} %lu\n", name, labels, *labels ? "," : "",
+            bounds[i] / 1000000, bounds[i] % 1000000, cumulative);
+      else
+         sprintf(line, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels, *labels ? "," : "", cumulative);
+      sb_append(sb, line);
+   }
+   if (plain) {
+      sprintf(line, "%s_sum%s%s%s %lu\n%s_count%s%s%s %lu\n", name, *labels ? "{" : "", labels, *labels ? "}" : "",
+         h->sum, name, *labels ? "{" : "", labels, *labels ? "}" : "", h->count);
+   } else if (*labels) {
+      sprintf(line, "%s_sum{%s} %lu.%06lu\n%s_count{%s} %lu\n", name, labels,
+         h->sum / 1000000, h->sum % 1000000, name, labels, h->count);
+   } else {
+      sprintf(line, "%s_sum %lu.%06lu\n%s_count %lu\n", name,
+         h->sum / 1000000, h->sum % 1000000, name, h->count);
+   }
+   sb_append(sb, line);
+}
+static int dbrelay_metrics_has_data(dbrelay_metrics_series_t *series)
+{
+   return series->latency.count!=0;
+}
+char *dbrelay_metrics_text()
+{
+   dbrelay_metrics_t *m = dbrelay_metrics_get();
+   dbrelay_metrics_series_t *series;
+   dbrelay_connection_t *connections;
+   stringbuf_t *sb;
+   char labels[1024];
+   char line[1024];
+   char *ret;
+   dbrelay_limiter_stat_t backends[DBRELAY_METRICS_SERIES];
+   int i, j, n, allocated = 0, busy = 0;
+
+   if (!m) return NULL;
+
+   sb = sb_new(NULL);
+
+   sb_append(sb, "# HELP dbrelay_request_duration_seconds Time from request start to response, by target.\n");
+   sb_append(sb, "# TYPE dbrelay_request_duration_seconds histogram\n");
+   for (i=0; i<=DBRELAY_METRICS_SERIES; i++) {
+      series = i<DBRELAY_METRICS_SERIES ? &m->series[i] : &m->overflow;
+      if (!dbrelay_metrics_has_data(series)) continue;
+      dbrelay_metrics_labels(labels, series);
+      dbrelay_metrics_histogram(sb, "dbrelay_request_duration_seconds", labels, &series->latency, latency_bounds, 0);
+   }
+
+   sb_append(sb, "# HELP dbrelay_rows_total Rows returned, by target.\n");
+   sb_append(sb, "# TYPE dbrelay_rows_total counter\n");
+   for (i=0; i<=DBRELAY_METRICS_SERIES; i++) {
+      series = i<DBRELAY_METRICS_SERIES ? &m->series[i] : &m->overflow;
+      if (!dbrelay_metrics_has_data(series)) continue;
+      dbrelay_metrics_labels(labels, series);
+      sprintf(line, "dbrelay_rows_total{%s} %lu\n", labels, series->rows);
+      sb_append(sb, line);
+   }
+
+   sb_append(sb, "# HELP dbrelay_response_bytes_total Response body bytes, by target.\n");
+   sb_append(sb, "# TYPE dbrelay_response_bytes_total counter\n");
+   for (i=0; i<=DBRELAY_METRICS_SERIES; i++) {
+      series = i<DBRELAY_METRICS_SERIES ? &m->series[i] : &m->overflow;
+      if (!dbrelay_metrics_has_data(series)) continue;
+      dbrelay_metrics_labels(labels, series);
+      sprintf(line, "dbrelay_response_bytes_total{%s} %lu\n", labels, series->bytes);
+      sb_append(sb, line);
+   }
+
+   sb_append(sb, "# HELP dbrelay_errors_total Failed requests by class.\n");
+   sb_append(sb, "# TYPE dbrelay_errors_total counter\n");
+   for (i=1; i<DBRELAY_ERR_CLASSES; i++) {
+      sprintf(line, "dbrelay_errors_total{class=\"%s\"} %lu\n", dbrelay_error_class_names[i], m->errors[i]);
+      sb_append(sb, line);
+   }
+
+   connections = dbrelay_get_shmem();
+   if (connections) {
+      for (i=0; i<DBRELAY_MAX_CONN; i++) {
+         if (!connections[i].pid) continue;
+         allocated++;
+         if (connections[i].in_use) busy++;
+      }
+      dbrelay_release_shmem(connections);
+   }
+   sb_append(sb, "# HELP dbrelay_pool_slots Connection slots by state.\n");
+   sb_append(sb, "# TYPE dbrelay_pool_slots gauge\n");
+   sprintf(line, "dbrelay_pool_slots{state=\"busy\"} %d\n", busy);
+   sb_append(sb, line);
+   sprintf(line, "dbrelay_pool_slots{state=\"idle\"} %d\n", allocated - busy);
+   sb_append(sb, line);
+   sprintf(line, "dbrelay_pool_slots{state=\"free\"} %d\n", DBRELAY_MAX_CONN - allocated);
+   sb_append(sb, line);
+
+   sb_append(sb, "# HELP dbrelay_waiting_requests Requests waiting for a connection slot.\n");
+   sb_append(sb, "# TYPE dbrelay_waiting_requests gauge\n");
+   sprintf(line, "dbrelay_waiting_requests %ld\n", m->waiting);
+   sb_append(sb, line);
+
+   sb_append(sb, "# HELP dbrelay_pool_queue_depth Requests queued for a slot on an exhausted pool.\n");
+   sb_append(sb, "# TYPE dbrelay_pool_queue_depth gauge\n");
+   for (i=0; i<DBRELAY_PRIORITIES; i++) {
+      sprintf(line, "dbrelay_pool_queue_depth{priority=\"%s\"} %d\n", priority_names[i], dbrelay_waitq_depth(i));
+      sb_append(sb, line);
+   }
+   sb_append(sb, "# HELP dbrelay_pool_queue_waits_total Queued requests by how the wait ended.\n");
+   sb_append(sb, "# TYPE dbrelay_pool_queue_waits_total counter\n");
+   for (i=0; i<DBRELAY_PRIORITIES; i++) {
+      for (j=0; j<DBRELAY_WAIT_OUTCOMES; j++) {
+         sprintf(line, "dbrelay_pool_queue_waits_total{priority=\"%s\",outcome=\"%s\"} %lu\n", 
+            priority_names[i], wait_outcome_names[j], m->pool_waits[i][j]);
+         sb_append(sb, line);
+      }
+   }
+   sb_append(sb, "# HELP dbrelay_pool_queue_wait_seconds Time queued for a slot.\n");
+   sb_append(sb, "# TYPE dbrelay_pool_queue_wait_seconds histogram\n");
+   for (i=0; i<DBRELAY_PRIORITIES; i++) {
+      sprintf(labels, "priority=\"%s\"", priority_names[i]);
+      dbrelay_metrics_histogram(sb, "dbrelay_pool_queue_wait_seconds", labels, &m->pool_wait[i], latency_bounds, 0);
+   }
+   sb_append(sb, "# HELP dbrelay_pool_queue_ahead Requests already queued when one joined.\n");
+   sb_append(sb, "# TYPE dbrelay_pool_queue_ahead histogram\n");
+   dbrelay_metrics_histogram(sb, "dbrelay_pool_queue_ahead", "", &m->pool_queue_depth, depth_bounds, 1);
+
+   n = dbrelay_limiter_read(backends, DBRELAY_METRICS_SERIES);
+   sb_append(sb, "# HELP dbrelay_backend_concurrency_limit Adaptive limit on concurrent queries, by backend.\n");
+   sb_append(sb, "# TYPE dbrelay_backend_concurrency_limit gauge\n");
+   for (i=0; i<n; i++) {
+      dbrelay_metrics_backend_labels(labels, &backends[i]);
+      sprintf(line, "dbrelay_backend_concurrency_limit{%s} %lu\n", labels, backends[i].limit);
+      sb_append(sb, line);
+   }
+   sb_append(sb, "# HELP dbrelay_backend_inflight Queries running, by backend.\n");
+   sb_append(sb, "# TYPE dbrelay_backend_inflight gauge\n");
+   for (i=0; i<n; i++) {
+      dbrelay_metrics_backend_labels(labels, &backends[i]);
+      sprintf(line, "dbrelay_backend_inflight{%s} %d\n", labels, backends[i].inflight);
+      sb_append(sb, line);
+   }
+   sb_append(sb, "# HELP dbrelay_backend_latency_seconds Recent average query latency, by backend.\n");
+   sb_append(sb, "# TYPE dbrelay_backend_latency_seconds gauge\n");
+   for (i=0; i<n; i++) {
+      dbrelay_metrics_backend_labels(labels, &backends[i]);
+      sprintf(line, "dbrelay_backend_latency_seconds{%s} %lu.%06lu\n", labels, 
+         backends[i].latency / 1000000, backends[i].latency % 1000000);
+      sb_append(sb, line);
+   }
+   sb_append(sb, "# HELP dbrelay_backend_queued_total Requests that waited at the limit, by backend.\n");
+   sb_append(sb, "# TYPE dbrelay_backend_queued_total counter\n");
+   for (i=0; i<n; i++) {
+      dbrelay_metrics_backend_labels(labels, &backends[i]);
+      sprintf(line, "dbrelay_backend_queued_total{%s} %lu\n", labels, backends[i].queued);
+      sb_append(sb, line);
+   }
+   sb_append(sb, "# HELP dbrelay_backend_shed_total Requests refused at the limit, by backend.\n");
+   sb_append(sb, "# TYPE dbrelay_backend_shed_total counter\n");
+   for (i=0; i<n; i++) {
+      dbrelay_metrics_backend_labels(labels, &backends[i]);
+      sprintf(line, "dbrelay_backend_shed_total{%s} %lu\n", labels, backends[i].shed);
+      sb_append(sb, line);
+   }
+
+   sb_append(sb, "# HELP dbrelay_connector_spawns_total Connector processes started.\n");
+   sb_append(sb, "# TYPE dbrelay_connector_spawns_total counter\n");
+   sprintf(line, "dbrelay_connector_spawns_total %lu\n", m->connector_spawns);
+   sb_append(sb, line);
+   sb_append(sb, "# HELP dbrelay_connector_deaths_total Connectors found unreachable and killed.\n");
+   sb_append(sb, "# TYPE dbrelay_connector_deaths_total counter\n");
+   sprintf(line, "dbrelay_connector_deaths_total %lu\n", m->connector_deaths);
+   sb_append(sb, line);
+
+   sb_append(sb, "# HELP dbrelay_query_log_dropped_total Query log records lost to a full ring.\n");
+   sb_append(sb, "# TYPE dbrelay_query_log_dropped_total counter\n");
+   sprintf(line, "dbrelay_query_log_dropped_total %lu\n", dbrelay_querylog_dropped());
+   sb_append(sb, line);
+
+   sb_append(sb, "# HELP dbrelay_shm_lock_wait_seconds Time to lock and attach the slot table.\n");
+   sb_append(sb, "# TYPE dbrelay_shm_lock_wait_seconds histogram\n");
+   dbrelay_metrics_histogram(sb, "dbrelay_shm_lock_wait_seconds", "", &m->shm_wait, shm_wait_bounds, 0);
+
+   ret = sb_to_char(sb);
+   sb_free(sb);
+
+   return ret;
+}
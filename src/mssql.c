@@ -60,7 +60,10 @@ dbrelay_dbapi_t dbrelay_mssql_api =
    &dbrelay_mssql_colvalue,
    &dbrelay_mssql_error,
    &dbrelay_mssql_catalogsql,
-   &dbrelay_mssql_isalive
+   &dbrelay_mssql_isalive,
+   &dbrelay_mssql_cancel,
+   &dbrelay_mssql_colvalue_ref,
+   &dbrelay_mssql_fetch_batch
 };
 
 int dbrelay_mssql_msg_handler(DBPROCESS * dbproc, DBINT msgno, int msgstate, int severity, char *msgtext, char *srvname, char *procname, int line);
@@ -80,6 +83,8 @@ void dbrelay_mssql_init()
 {
    dberrhandle(dbrelay_mssql_err_handler);
    dbmsghandle(dbrelay_mssql_msg_handler);
+   /* wake up the err handler periodically so we can notice a client disconnect */
+   dbsettime(DBRELAY_CANCEL_POLL);
 }
 void *dbrelay_mssql_connect(dbrelay_request_t *request)
 {
@@ -291,8 +296,15 @@ void dbrelay_mssql_free_results(void *db)
          free(mssql->colval[i]);
          mssql->colval[i]=NULL;
       }
+      mssql->colsize[i]=0;
+      mssql->colbound[i]=0;
    }
 }
+/* character data needs no conversion, it is read in place with dbdata() */
+static unsigned char dbrelay_mssql_is_char(int coltype)
+{
+   return (coltype==SYBCHAR || coltype==SYBVARCHAR || coltype==SYBTEXT);
+}
 int dbrelay_mssql_has_results(void *db)
 {
    mssql_db_t *mssql = (mssql_db_t *) db;
@@ -301,17 +313,27 @@ int dbrelay_mssql_has_results(void *db)
    int numcols;
    RETCODE rc;
 
-   dbrelay_mssql_free_results(db);
-
+   mssql->has_row = 0;
    if ((rc = dbresults(mssql->dbproc)) == NO_MORE_RESULTS) return FALSE;
 
    numcols = dbnumcols(mssql->dbproc);
+   if (numcols > MSSQL_MAX_COLUMNS) numcols = MSSQL_MAX_COLUMNS;
    for (colnum=1; colnum<=numcols; colnum++) {
-      colsize = dbrelay_mssql_collen(db, colnum);
-      mssql->colval[colnum-1] = malloc(colsize > 256 ? colsize + 1 : 256);
+      mssql->colbound[colnum-1] = 0;
+      if (dbrelay_mssql_is_char(dbcoltype(mssql->dbproc, colnum))) continue;
+
+      /* buffers only grow, they are reused by later results and queries */
+      colsize = dbcollen(mssql->dbproc, colnum);
+      colsize = colsize > 256 ? colsize + 1 : 256;
+      if (mssql->colsize[colnum-1] < colsize) {
+         free(mssql->colval[colnum-1]);
+         mssql->colval[colnum-1] = malloc(colsize);
+         mssql->colsize[colnum-1] = colsize;
+      }
       mssql->colval[colnum-1][0] = '\0';
-      dbbind(mssql->dbproc, colnum, NTBSTRINGBIND, 0, (BYTE *) mssql->colval[colnum-1]);
+      dbbind(mssql->dbproc, colnum, NTBSTRINGBIND, mssql->colsize[colnum-1], (BYTE *) mssql->colval[colnum-1]);
       dbnullbind(mssql->dbproc, colnum, (DBINT *) &(mssql->colnull[colnum-1]));
+      mssql->colbound[colnum-1] = 1;
    }
    return TRUE;
 }
@@ -333,6 +355,10 @@ void dbrelay_mssql_coltype(void *db, int colnum, char *dest)
 int dbrelay_mssql_collen(void *db, int colnum)
 {
    mssql_db_t *mssql = (mssql_db_t *) db;
+
+   /* size colvalue's buffer to the value, a text column declares 2GB */
+   if (mssql->has_row && !mssql->colbound[colnum-1])
+      return dbdatlen(mssql->dbproc, colnum) + 1;
    return dbcollen(mssql->dbproc, colnum);
 }
 int dbrelay_mssql_colprec(void *db, int colnum)
@@ -360,18 +386,58 @@ int dbrelay_mssql_colscale(void *db, int colnum)
 int dbrelay_mssql_fetch_row(void *db)
 {
    mssql_db_t *mssql = (mssql_db_t *) db;
-   if (dbnextrow(mssql->dbproc)!=NO_MORE_ROWS) return TRUE; 
+   if (dbnextrow(mssql->dbproc)!=NO_MORE_ROWS) {
+      mssql->has_row = 1;
+      return TRUE; 
+   }
+   mssql->has_row = 0;
    return FALSE;
 }
-char *dbrelay_mssql_colvalue(void *db, int colnum, char *dest)
+char *dbrelay_mssql_colvalue_ref(void *db, int colnum, int *len)
 {
    mssql_db_t *mssql = (mssql_db_t *) db;
+   char *value;
+
+   if (mssql->colbound[colnum-1]) {
+      if (mssql->colnull[colnum-1]==-1) return NULL;
+      *len = strlen(mssql->colval[colnum-1]);
+      return mssql->colval[colnum-1];
+   }
+   /* NULL data comes back as a NULL pointer, empty strings don't */
+   if ((value = (char *) dbdata(mssql->dbproc, colnum))==NULL) return NULL;
+   *len = dbdatlen(mssql->dbproc, colnum);
+   return value;
+}
+char *dbrelay_mssql_colvalue(void *db, int colnum, char *dest)
+{
+   char *value;
+   int len;
 
-   if (mssql->colnull[colnum-1]==-1) return NULL;
+   if ((value = dbrelay_mssql_colvalue_ref(db, colnum, &len))==NULL) return NULL;
 
-   strcpy(dest, mssql->colval[colnum-1]);
+   memcpy(dest, value, len);
+   dest[len] = '\0';
    return dest;
 }
+/* db-lib holds one row at a time, values are copied out of it */
+int dbrelay_mssql_fetch_batch(void *db, dbrelay_batch_t *batch)
+{
+   mssql_db_t *mssql = (mssql_db_t *) db;
+   int numcols = dbnumcols(mssql->dbproc);
+   int c, r, len;
+   char *value;
+
+   if (numcols > MSSQL_MAX_COLUMNS) numcols = MSSQL_MAX_COLUMNS;
+   dbrelay_batch_reset(batch);
+   while (batch->rows < batch->maxrows && dbrelay_mssql_fetch_row(db)) {
+      r = batch->rows++;
+      for (c=0; c<numcols; c++) {
+         value = dbrelay_mssql_colvalue_ref(db, c + 1, &len);
+         dbrelay_batch_copy(batch, c, r, value, len);
+      }
+   }
+   return batch->rows;
+}
 
 int
 dbrelay_mssql_msg_handler(DBPROCESS * dbproc, DBINT msgno, int msgstate, int severity, char *msgtext, char *srvname, char *procname, int line)
@@ -381,9 +447,11 @@ dbrelay_mssql_msg_handler(DBPROCESS * dbproc, DBINT msgno, int msgstate, int sev
 
       dbrelay_request_t *request = (dbrelay_request_t *) dbgetuserdata(dbproc);
       if (request!=NULL) {
-         if (IS_SET(msgtext)) 
-            strcat(request->error_message, "\n");
-         strcat(request->error_message, msgtext);
+         char *errbuf = dbrelay_request_errbuf(request);
+
+         if (IS_SET(msgtext) && strlen(errbuf) < DBRELAY_ERRMSG_SZ - 1) 
+            strcat(errbuf, "\n");
+         strncat(errbuf, msgtext, DBRELAY_ERRMSG_SZ - strlen(errbuf) - 1);
       } else {
          login_msgno = msgno;
          strcpy(login_error, msgtext);
@@ -396,6 +464,12 @@ int
 dbrelay_mssql_err_handler(DBPROCESS * dbproc, int severity, int dberr, int oserr, char *dberrstr, char *oserrstr)
 {
    //db_error = strdup(dberrstr);
+   if (dbproc!=NULL && dberr==SYBETIME) {
+      dbrelay_request_t *request = (dbrelay_request_t *) dbgetuserdata(dbproc);
+      /* poll timer fired, keep waiting unless the client is gone or we ran too long */
+      if (request!=NULL && (dbrelay_db_check_cancel(request) || dbrelay_db_check_timeout(request))) return INT_CANCEL;
+      return INT_CONTINUE;
+   }
    if (dbproc!=NULL) {
       //dbrelay_request_t *request = (dbrelay_request_t *) dbgetuserdata(dbproc);
       //strcat(request->error_message, dberrstr);
@@ -410,7 +484,7 @@ char *dbrelay_mssql_error(void *db)
    if (mssql && mssql->dbproc) {
       dbrelay_request_t *request = (dbrelay_request_t *) dbgetuserdata(mssql->dbproc);
       if (request!=NULL) {
-         return request->error_message;
+         return dbrelay_request_errbuf(request);
       }
       return NULL;
    } else {
@@ -532,3 +606,10 @@ int dbrelay_mssql_isalive(void *db)
    
    return !DBDEAD(mssql->dbproc);
 }
+int dbrelay_mssql_cancel(void *db)
+{
+   mssql_db_t *mssql = (mssql_db_t *) db;
+
+   if (!mssql || !mssql->dbproc) return 0;
+   return dbcancel(mssql->dbproc)==SUCCEED;
+}
@@ -43,8 +43,11 @@
 typedef struct mssql_db_s {
     LOGINREC *login;
     DBPROCESS *dbproc;
-    char *colval[MSSQL_MAX_COLUMNS];
+    char *colval[MSSQL_MAX_COLUMNS];    /* kept for the life of the connection */
+    int colsize[MSSQL_MAX_COLUMNS];     /* allocated size of colval */
     int colnull[MSSQL_MAX_COLUMNS];
+    unsigned char colbound[MSSQL_MAX_COLUMNS]; /* else read with dbdata() */
+    unsigned char has_row;
 } mssql_db_t;
 
 void dbrelay_mssql_init();
@@ -65,9 +68,12 @@ int dbrelay_mssql_colprec(void *db, int colnum);
 int dbrelay_mssql_colscale(void *db, int colnum);
 int dbrelay_mssql_fetch_row(void *db);
 char *dbrelay_mssql_colvalue(void *db, int colnum, char *dest);
+char *dbrelay_mssql_colvalue_ref(void *db, int colnum, int *len);
+int dbrelay_mssql_fetch_batch(void *db, dbrelay_batch_t *batch);
 char *dbrelay_mssql_error(void *db);
 char *dbrelay_mssql_catalogsql(int dbcmd, char **params);
 int dbrelay_mssql_isalive(void *db);
+int dbrelay_mssql_cancel(void *db);
 
 
 #endif
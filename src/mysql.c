@@ -32,6 +32,7 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <poll.h>
 #include "stringbuf.h"
 #include "vmysql.h"
 
@@ -59,7 +60,10 @@ dbrelay_dbapi_t dbrelay_mysql_api =
    &dbrelay_mysql_colvalue,
    &dbrelay_mysql_error,
    &dbrelay_mysql_catalogsql,
-   &dbrelay_mysql_isalive
+   &dbrelay_mysql_isalive,
+   &dbrelay_mysql_cancel,
+   NULL,
+   &dbrelay_mysql_fetch_batch
 };
 
 void dbrelay_mysql_init()
@@ -68,29 +72,50 @@ void dbrelay_mysql_init()
 void *dbrelay_mysql_connect(dbrelay_request_t *request)
 {
    mysql_db_t *mydb = (mysql_db_t *)malloc(sizeof(mysql_db_t));
+   memset(mydb, 0, sizeof(mysql_db_t));
    mydb->mysql = (MYSQL *)malloc(sizeof(MYSQL));
 
+   mydb->request = request;
    if(mysql_init(mydb->mysql)==NULL) return NULL;
 
-   if (!mysql_real_connect(mydb->mysql,request->sql_server,request->sql_user, IS_SET(request->sql_password) ? request->sql_password : NULL ,NULL,0,NULL,0)) return NULL;
+   /* batches and procedures may return several results, see has_results */
+   if (!mysql_real_connect(mydb->mysql,request->sql_server,request->sql_user, IS_SET(request->sql_password) ? request->sql_password : NULL ,NULL,0,NULL,CLIENT_MULTI_STATEMENTS)) return NULL;
 
    return ((void *) mydb);
 }
+/*
+ * an unbuffered result has to be read to the end, and any further 
+ * results of the batch with it, before the connection takes a new query
+ */
+static void dbrelay_mysql_drain(mysql_db_t *mydb)
+{
+   MYSQL_RES *result;
+
+   if (mydb->result) mysql_free_result(mydb->result);
+   mydb->result = NULL;
+   mydb->row = NULL;
+   mydb->pending = 0;
+   while (mysql_more_results(mydb->mysql) && mysql_next_result(mydb->mysql)==0) {
+      if ((result = mysql_use_result(mydb->mysql))) mysql_free_result(result);
+   }
+}
 void dbrelay_mysql_close(void *db)
 {
    mysql_db_t *mydb = (mysql_db_t *) db;
 
+   if (mydb->result) mysql_free_result(mydb->result);
    if (mydb->mysql) mysql_close(mydb->mysql);
 }
 void dbrelay_mysql_assign_request(void *db, dbrelay_request_t *request)
 {
+   mysql_db_t *mydb = (mysql_db_t *) db;
+
+   mydb->request = request;
 }
 int dbrelay_mysql_is_quoted(void *db, int colnum)
 {
    mysql_db_t *mydb = (mysql_db_t *) db;
-   
-   mydb->field = mysql_fetch_field_direct(mydb->result, colnum-1);
-   int coltype = mydb->field->type;
+   int coltype = mydb->fields[colnum-1].type;
 
    if (coltype == MYSQL_TYPE_VARCHAR ||
        coltype == MYSQL_TYPE_VAR_STRING ||
@@ -216,69 +241,133 @@ int dbrelay_mysql_change_db(void *db, char *database)
 int dbrelay_mysql_exec(void *db, char *sql)
 {
    mysql_db_t *mydb = (mysql_db_t *) db;
+   struct pollfd pfd;
+   int killed = 0;
+
+   dbrelay_mysql_drain(mydb);
+   if(mysql_send_query(mydb->mysql, sql, strlen(sql))!=0) return FALSE;
 
-   if(mysql_real_query(mydb->mysql, sql, strlen(sql))!=0) return FALSE;
+   /* 
+    * wait for the server to answer, waking up periodically to see if 
+    * the client went away or query_timeout passed, in which case we kill 
+    * the query server side and let the read below collect the error.
+    * This leaves the connection usable, unlike MYSQL_OPT_READ_TIMEOUT.
+    */
+   pfd.fd = mydb->mysql->net.fd;
+   pfd.events = POLLIN;
+   while (poll(&pfd, 1, DBRELAY_CANCEL_POLL * 1000)==0) {
+      if (!killed && mydb->request && 
+          (dbrelay_db_check_cancel(mydb->request) || dbrelay_db_check_timeout(mydb->request))) {
+         dbrelay_mysql_cancel(db);
+         killed = 1;
+      }
+   }
+
+   if(mysql_read_query_result(mydb->mysql)!=0) return FALSE;
+   mydb->pending = 1;
    return TRUE;
 }
 int dbrelay_mysql_rowcount(void *db)
 {
    mysql_db_t *mydb = (mysql_db_t *) db;
 
+   /* only known for an unbuffered result once the last row is read */
+   if (mydb->result) return mysql_num_rows(mydb->result);
    return mysql_affected_rows(mydb->mysql);
 }
+/*
+ * steps through the results of a batch with mysql_use_result, rows stay
+ * on the server until fetched.  Statements without a result set are 
+ * skipped as they were when only the first result was read.
+ */
 int dbrelay_mysql_has_results(void *db)
 {
    mysql_db_t *mydb = (mysql_db_t *) db;
+   int rc;
 
-   mydb->result = mysql_store_result(mydb->mysql);
-   if (mydb->result) return TRUE;
-   return FALSE;
+   if (mydb->result) mysql_free_result(mydb->result);
+   mydb->result = NULL;
+   mydb->row = NULL;
+
+   for (;;) {
+      if (!mydb->pending) {
+         if ((rc = mysql_next_result(mydb->mysql))<0) return FALSE;
+         if (rc>0) {
+            if (mydb->request) dbrelay_log_warn(mydb->request, "statement in batch failed: %s", mysql_error(mydb->mysql));
+            return FALSE;
+         }
+      }
+      mydb->pending = 0;
+
+      if ((mydb->result = mysql_use_result(mydb->mysql))) {
+         mydb->fields = mysql_fetch_fields(mydb->result);
+         mydb->numcols = mysql_num_fields(mydb->result);
+         return TRUE;
+      }
+      if (mysql_field_count(mydb->mysql)) return FALSE;
+   }
 }
 int dbrelay_mysql_numcols(void *db)
 {
    mysql_db_t *mydb = (mysql_db_t *) db;
-   return mysql_num_fields(mydb->result);
+   return mydb->numcols;
 }
 char *dbrelay_mysql_colname(void *db, int colnum)
 {
    mysql_db_t *mydb = (mysql_db_t *) db;
 
-   mydb->field = mysql_fetch_field_direct(mydb->result, colnum-1);
-   return mydb->field->name;
+   return mydb->fields[colnum-1].name;
 }
 void dbrelay_mysql_coltype(void *db, int colnum, char *dest)
 {
    mysql_db_t *mydb = (mysql_db_t *) db;
 
-   mydb->field = mysql_fetch_field_direct(mydb->result, colnum-1);
-   dbrelay_mysql_get_sqltype_string(dest, mydb->field->type, mydb->field->length);
+   dbrelay_mysql_get_sqltype_string(dest, mydb->fields[colnum-1].type, mydb->fields[colnum-1].length);
 }
+/*
+ * declared length for the column list, the length of the value once a 
+ * row is current so colvalue's buffer fits it (a LONGTEXT declares 4GB)
+ */
 int dbrelay_mysql_collen(void *db, int colnum)
 {
    mysql_db_t *mydb = (mysql_db_t *) db;
 
-   mydb->field = mysql_fetch_field_direct(mydb->result, colnum-1);
-   return mydb->field->length;
+   if (mydb->row) return mydb->lengths[colnum-1] + 1;
+   return mydb->fields[colnum-1].length;
 }
+/* 
+ * max_length is only filled in by mysql_store_result, so precision comes 
+ * from the declared display width: digits plus sign and decimal point
+ */
 int dbrelay_mysql_colprec(void *db, int colnum)
 {
    mysql_db_t *mydb = (mysql_db_t *) db;
+   MYSQL_FIELD *field = &mydb->fields[colnum-1];
+   int prec;
 
-   mydb->field = mysql_fetch_field_direct(mydb->result, colnum-1);
-   return mydb->field->max_length;
+   if (field->type!=MYSQL_TYPE_DECIMAL && field->type!=MYSQL_TYPE_NEWDECIMAL) return 0;
+   prec = field->length;
+   if (field->decimals) prec--;
+   if (!(field->flags & UNSIGNED_FLAG)) prec--;
+   return prec;
 }
 int dbrelay_mysql_colscale(void *db, int colnum)
 {
    mysql_db_t *mydb = (mysql_db_t *) db;
 
-   mydb->field = mysql_fetch_field_direct(mydb->result, colnum-1);
-   return mydb->field->decimals;
+   return mydb->fields[colnum-1].decimals;
 }
 int dbrelay_mysql_fetch_row(void *db)
 {
    mysql_db_t *mydb = (mysql_db_t *) db;
+
    mydb->row = mysql_fetch_row(mydb->result);
-   if (!mydb->row) return FALSE;
+   if (!mydb->row) {
+      if (mysql_errno(mydb->mysql) && mydb->request)
+         dbrelay_log_warn(mydb->request, "fetch failed: %s", mysql_error(mydb->mysql));
+      return FALSE;
+   }
+   mydb->lengths = mysql_fetch_lengths(mydb->result);
    return TRUE;
 }
 char *dbrelay_mysql_colvalue(void *db, int colnum, char *dest)
@@ -287,9 +376,24 @@ char *dbrelay_mysql_colvalue(void *db, int colnum, char *dest)
 
    if (!mydb->row[colnum-1]) return NULL;
 
-   strcpy(dest, mydb->row[colnum-1]);
+   memcpy(dest, mydb->row[colnum-1], mydb->lengths[colnum-1]);
+   dest[mydb->lengths[colnum-1]] = '\0';
    return dest;
 }
+/* mysql_use_result reuses its row buffer, so values are copied out */
+int dbrelay_mysql_fetch_batch(void *db, dbrelay_batch_t *batch)
+{
+   mysql_db_t *mydb = (mysql_db_t *) db;
+   int c, r;
+
+   dbrelay_batch_reset(batch);
+   while (batch->rows < batch->maxrows && dbrelay_mysql_fetch_row(db)) {
+      r = batch->rows++;
+      for (c=0; c<mydb->numcols; c++)
+         dbrelay_batch_copy(batch, c, r, mydb->row[c], mydb->lengths[c]);
+   }
+   return batch->rows;
+}
 
 char *dbrelay_mysql_error(void *db)
 {
@@ -329,4 +433,27 @@ int dbrelay_mysql_isalive(void *db)
   
    return mysql_ping(mydb->mysql);
 }
+/*
+ * MySQL has no out of band cancel, so open a second connection and kill
+ * the running statement by thread id.
+ */
+int dbrelay_mysql_cancel(void *db)
+{
+   mysql_db_t *mydb = (mysql_db_t *) db;
+   dbrelay_request_t *request = mydb->request;
+   MYSQL killer;
+   char sql[50];
+   int ret;
+
+   if (!request || !mydb->mysql) return FALSE;
+   if (mysql_init(&killer)==NULL) return FALSE;
+   if (!mysql_real_connect(&killer,request->sql_server,request->sql_user, IS_SET(request->sql_password) ? request->sql_password : NULL ,NULL,0,NULL,0)) {
+      mysql_close(&killer);
+      return FALSE;
+   }
+   sprintf(sql, "KILL QUERY %lu", mysql_thread_id(mydb->mysql));
+   ret = mysql_real_query(&killer, sql, strlen(sql));
+   mysql_close(&killer);
 
+   return ret==0 ? TRUE : FALSE;
+}
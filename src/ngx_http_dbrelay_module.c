@@ -42,23 +42,84 @@
 #include <sybdb.h>
 #endif
 
+/* nginx before 1.3.15 has neither the constant nor a status line for it */
+#ifndef NGX_HTTP_TOO_MANY_REQUESTS
+#define NGX_HTTP_TOO_MANY_REQUESTS 429
+#endif
+
 typedef struct {
     ngx_http_upstream_conf_t   upstream;
     ngx_str_t   origin;
+    time_t      query_timeout;
+    ngx_msec_t  slow_query_time;
+    ngx_uint_t  connector_sessions;
+    ngx_str_t   dbtype;
+    ngx_msec_t  pool_wait;
+    ngx_uint_t  priority;
+    ngx_array_t *priority_tags;
+    ngx_uint_t  backend_limit;
+    ngx_array_t *rate_limits;
+    ngx_array_t *backends;
+    ngx_array_t *readonly_tags;
 } ngx_http_dbrelay_loc_conf_t;
 
-void parse_post_query_string(ngx_chain_t *bufs, dbrelay_request_t *request);
-void parse_post_query_file(ngx_temp_file_t *bufs, dbrelay_request_t *request);
+typedef struct {
+    ngx_str_t   tag;
+    ngx_uint_t  priority;
+} ngx_http_dbrelay_priority_tag_t;
+
+typedef struct {
+    ngx_str_t   query_log;
+    ngx_uint_t  query_log_sample;
+    ngx_uint_t  standby_connectors;
+} ngx_http_dbrelay_main_conf_t;
+
+/* how often each worker tries to drain the query log ring */
+#define DBRELAY_QUERYLOG_FLUSH 1000
+
+static ngx_fd_t dbrelay_querylog_fd = NGX_INVALID_FILE;
+static ngx_event_t dbrelay_querylog_event;
+
+#define DBRELAY_FORM_CHUNK 8192
+#define DBRELAY_FORM_VALUE_SZ 256
+
+typedef struct {
+   dbrelay_request_t *request;
+   unsigned char target;     /* 0 while reading the key, 1 for the value */
+   unsigned char escape;     /* hex digits still due after a '%' */
+   u_char hex;
+   char key[100];
+   size_t key_len;
+   char *value;
+   size_t value_len;
+   size_t value_sz;
+} dbrelay_form_parser_t;
+
+void parse_post_body(ngx_chain_t *bufs, dbrelay_request_t *request);
 void parse_get_query_string(ngx_str_t args, dbrelay_request_t *request);
 static char *ngx_http_dbrelay_set(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_http_dbrelay_metrics_set(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_http_dbrelay_priority_set(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static int ngx_http_dbrelay_priority(ngx_http_dbrelay_loc_conf_t *lcf, char *query_tag);
+static char *ngx_http_dbrelay_rate_limit_set(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_http_dbrelay_backend_set(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static int ngx_http_dbrelay_is_readonly_tag(ngx_http_dbrelay_loc_conf_t *lcf, char *query_tag);
 //static ngx_int_t ngx_http_dbrelay_create_request(ngx_http_request_t *r);
+static void *ngx_http_dbrelay_create_main_conf(ngx_conf_t *cf);
+static char *ngx_http_dbrelay_init_main_conf(ngx_conf_t *cf, void *conf);
 static void *ngx_http_dbrelay_create_loc_conf(ngx_conf_t *cf);
+static char *ngx_http_dbrelay_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child);
 static ngx_int_t ngx_http_dbrelay_send_response(ngx_http_request_t *r);
 ngx_int_t ngx_http_dbrelay_init_master(ngx_log_t *log);
 void ngx_http_dbrelay_exit_master(ngx_cycle_t *cycle);
+static ngx_int_t ngx_http_dbrelay_init_process(ngx_cycle_t *cycle);
+static void ngx_http_dbrelay_exit_process(ngx_cycle_t *cycle);
 static void write_flag_values(dbrelay_request_t *request, char *value);
 static unsigned int accepts_application_json(ngx_http_request_t *r);
 static u_char *get_header_value(ngx_http_request_t *r, char *header_key);
+static ngx_int_t ngx_http_dbrelay_add_variables(ngx_conf_t *cf);
+static ngx_int_t ngx_http_dbrelay_time_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_dbrelay_count_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v, uintptr_t data);
 
 static ngx_command_t  ngx_http_dbrelay_commands[] = {
 
@@ -69,6 +130,13 @@ static ngx_command_t  ngx_http_dbrelay_commands[] = {
       0,
       NULL },
 
+    { ngx_string("dbrelay_metrics"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_dbrelay_metrics_set,
+      0,
+      0,
+      NULL },
+
     { ngx_string("dbrelay_origin"),
       NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_str_slot,
@@ -76,22 +144,140 @@ static ngx_command_t  ngx_http_dbrelay_commands[] = {
       offsetof(ngx_http_dbrelay_loc_conf_t,origin),
       NULL },
 
+    { ngx_string("dbrelay_query_log"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_str_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_dbrelay_main_conf_t,query_log),
+      NULL },
+
+    { ngx_string("dbrelay_query_log_sample"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_dbrelay_main_conf_t,query_log_sample),
+      NULL },
+
+    { ngx_string("dbrelay_standby_connectors"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_dbrelay_main_conf_t,standby_connectors),
+      NULL },
+
+    { ngx_string("dbrelay_query_timeout"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_sec_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_dbrelay_loc_conf_t,query_timeout),
+      NULL },
+
+    { ngx_string("dbrelay_slow_query_time"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_dbrelay_loc_conf_t,slow_query_time),
+      NULL },
+
+    { ngx_string("dbrelay_connector_sessions"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_dbrelay_loc_conf_t,connector_sessions),
+      NULL },
+
+    { ngx_string("dbrelay_dbtype"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_str_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_dbrelay_loc_conf_t,dbtype),
+      NULL },
+
+    { ngx_string("dbrelay_pool_wait"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_dbrelay_loc_conf_t,pool_wait),
+      NULL },
+
+    { ngx_string("dbrelay_priority"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_dbrelay_priority_set,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("dbrelay_backend_limit"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_dbrelay_loc_conf_t,backend_limit),
+      NULL },
+
+    { ngx_string("dbrelay_rate_limit"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_2MORE,
+      ngx_http_dbrelay_rate_limit_set,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("dbrelay_backend"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE2,
+      ngx_http_dbrelay_backend_set,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("dbrelay_readonly_tags"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_conf_set_str_array_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_dbrelay_loc_conf_t,readonly_tags),
+      NULL },
+
       ngx_null_command
 };
 
+/* filled from the request's timings, usable in log_format */
+static ngx_http_variable_t  ngx_http_dbrelay_vars[] = {
+
+    { ngx_string("dbrelay_shm_wait_time"), NULL, ngx_http_dbrelay_time_variable,
+      offsetof(dbrelay_timings_t, shm_wait), NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("dbrelay_connect_time"), NULL, ngx_http_dbrelay_time_variable,
+      offsetof(dbrelay_timings_t, connect), NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("dbrelay_exec_time"), NULL, ngx_http_dbrelay_time_variable,
+      offsetof(dbrelay_timings_t, exec), NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("dbrelay_fetch_time"), NULL, ngx_http_dbrelay_time_variable,
+      offsetof(dbrelay_timings_t, fetch), NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("dbrelay_serialize_time"), NULL, ngx_http_dbrelay_time_variable,
+      offsetof(dbrelay_timings_t, serialize), NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("dbrelay_rows"), NULL, ngx_http_dbrelay_count_variable,
+      offsetof(dbrelay_timings_t, rows), NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("dbrelay_bytes"), NULL, ngx_http_dbrelay_count_variable,
+      offsetof(dbrelay_timings_t, bytes), NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_null_string, NULL, NULL, 0, 0, 0 }
+};
+
 
 static ngx_http_module_t  ngx_http_dbrelay_module_ctx = {
-    NULL,                          /* preconfiguration */
+    ngx_http_dbrelay_add_variables, /* preconfiguration */
     NULL,                          /* postconfiguration */
 
-    NULL,                          /* create main configuration */
-    NULL,                          /* init main configuration */
+    ngx_http_dbrelay_create_main_conf, /* create main configuration */
+    ngx_http_dbrelay_init_main_conf,   /* init main configuration */
 
     NULL,                          /* create server configuration */
     NULL,                          /* merge server configuration */
 
     ngx_http_dbrelay_create_loc_conf, /* create location configuration */
-    NULL                           /* merge location configuration */
+    ngx_http_dbrelay_merge_loc_conf   /* merge location configuration */
 };
 
 
@@ -102,10 +288,10 @@ ngx_module_t  ngx_http_dbrelay_module = {
     NGX_HTTP_MODULE,               /* module type */
     ngx_http_dbrelay_init_master,  /* init master */
     NULL,                          /* init module */
-    NULL,                          /* init process */
+    ngx_http_dbrelay_init_process, /* init process */
     NULL,                          /* init thread */
     NULL,                          /* exit thread */
-    NULL,                          /* exit process */
+    ngx_http_dbrelay_exit_process, /* exit process */
     ngx_http_dbrelay_exit_master,  /* exit master */
     NGX_MODULE_V1_PADDING
 };
@@ -154,6 +340,67 @@ ngx_http_dbrelay_exit_master(ngx_cycle_t *cycle)
 
    dbrelay_release_shmem(connections);
    dbrelay_destroy_shmem();
+   dbrelay_metrics_destroy();
+   dbrelay_querylog_destroy();
+   dbrelay_slowlog_destroy();
+   dbrelay_statements_destroy();
+   dbrelay_standby_destroy();
+   dbrelay_waitq_destroy();
+   dbrelay_limiter_destroy();
+   dbrelay_ratelimit_destroy();
+   dbrelay_router_destroy();
+}
+
+static void
+ngx_http_dbrelay_querylog_flush(ngx_event_t *ev)
+{
+   dbrelay_querylog_drain(dbrelay_querylog_fd);
+
+   /* a pending timer would hold up a graceful shutdown */
+   if (!ngx_exiting) ngx_add_timer(ev, DBRELAY_QUERYLOG_FLUSH);
+}
+
+/*
+ * every worker runs a drain timer, whichever gets to the ring first writes
+ * out what is there and the others skip their turn.  The first worker up
+ * also starts the standby connector supervisor.
+ */
+static ngx_int_t
+ngx_http_dbrelay_init_process(ngx_cycle_t *cycle)
+{
+   ngx_http_dbrelay_main_conf_t *mcf;
+
+   mcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_dbrelay_module);
+   if (mcf == NULL) return NGX_OK;
+
+   if (mcf->standby_connectors) dbrelay_standby_start(mcf->standby_connectors);
+
+   if (!mcf->query_log.len) return NGX_OK;
+
+   dbrelay_querylog_fd = ngx_open_file(mcf->query_log.data, NGX_FILE_APPEND,
+                                       NGX_FILE_CREATE_OR_OPEN, NGX_FILE_DEFAULT_ACCESS);
+   if (dbrelay_querylog_fd == NGX_INVALID_FILE) {
+      ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                    ngx_open_file_n " \"%s\" failed", mcf->query_log.data);
+      return NGX_ERROR;
+   }
+
+   dbrelay_querylog_event.handler = ngx_http_dbrelay_querylog_flush;
+   dbrelay_querylog_event.log = cycle->log;
+   dbrelay_querylog_event.data = mcf;
+   ngx_add_timer(&dbrelay_querylog_event, DBRELAY_QUERYLOG_FLUSH);
+
+   return NGX_OK;
+}
+
+static void
+ngx_http_dbrelay_exit_process(ngx_cycle_t *cycle)
+{
+   if (dbrelay_querylog_fd == NGX_INVALID_FILE) return;
+
+   dbrelay_querylog_drain(dbrelay_querylog_fd);
+   ngx_close_file(dbrelay_querylog_fd);
+   dbrelay_querylog_fd = NGX_INVALID_FILE;
 }
 static unsigned int
 origin_matches(ngx_http_request_t *r, ngx_str_t origin)
@@ -266,6 +513,7 @@ ngx_http_dbrelay_request_body_handler(ngx_http_request_t *r)
     //ngx_log_error(NGX_LOG_DEBUG, log, 0,
         //"buf: \"%s\"", r->request_body->bufs->buf->pos);
     rc = ngx_http_dbrelay_send_response(r);
+    if (rc == NGX_HTTP_CLIENT_CLOSED_REQUEST) ngx_http_finalize_request(r, rc);
     ngx_log_error(NGX_LOG_INFO, log, 0, "exiting dbrelay_request_body_handler");
 }
 
@@ -420,7 +668,6 @@ ngx_http_dbrelay_handler(ngx_http_request_t *r)
 
     r->root_tested = 1;
 
-    r->request_body_in_file_only = 1;
     r->request_body_in_persistent_file = 1;
     r->request_body_in_clean_file = 1;
 
@@ -473,17 +720,26 @@ ngx_http_dbrelay_send_response(ngx_http_request_t *r)
     dbrelay_request_t *request;
     size_t len;
     int cplength;
+    int cancelled;
+    unsigned int retry_after;
+    ngx_table_elt_t  *h;
     ngx_http_dbrelay_loc_conf_t  *vlcf;
+    ngx_http_dbrelay_main_conf_t  *mcf;
 
     vlcf = ngx_http_get_module_loc_conf(r, ngx_http_dbrelay_module);
+    mcf = ngx_http_get_module_main_conf(r, ngx_http_dbrelay_module);
 
 
     log = r->connection->log;
 
-    request = dbrelay_alloc_request();
+    request = dbrelay_alloc_request(r->pool);
     request->log = log;
     request->log_level = 0;
     request->nginx_request = (void *) r;
+    /* lets the query loop notice the browser hanging up */
+    request->client_sock = r->connection->fd;
+    /* the request lives in r->pool, the log phase reads its timings */
+    ngx_http_set_ctx(r, request, ngx_http_dbrelay_module);
 
     ngx_log_error(NGX_LOG_INFO, log, 0, "parsing query_string");
     /* is GET method? */
@@ -493,17 +749,40 @@ ngx_http_dbrelay_send_response(ngx_http_request_t *r)
 	parse_get_query_string(r->args, request);
     } else
     /* is POST method? */
-    if (r->request_body->temp_file && r->request_body->temp_file->file.fd!=NGX_INVALID_FILE) {
-	parse_post_query_file(r->request_body->temp_file, request);
-    } else if (r->request_body->buf && r->request_body->buf->pos!=NULL) {
-	parse_post_query_string(r->request_body->bufs, request);
+    if (r->request_body && r->request_body->bufs) {
+	parse_post_body(r->request_body->bufs, request);
     } 
     /* FIX ME - need to check to see if we have everything and error if not */
 
+    /* dbrelay_query_timeout is a ceiling, requests may only ask for less */
+    if (vlcf->query_timeout && (!request->query_timeout || request->query_timeout > vlcf->query_timeout))
+       request->query_timeout = vlcf->query_timeout;
+
     if (!request->http_keepalive) {
        r->keepalive = 0;
     }
 
+    if (mcf->query_log.len) request->query_log_sample = mcf->query_log_sample;
+    request->slow_query_time = vlcf->slow_query_time;
+    request->connector_sessions = vlcf->connector_sessions;
+    request->pool_wait = vlcf->pool_wait;
+    request->priority = ngx_http_dbrelay_priority(vlcf, request->query_tag);
+    request->backend_limit = vlcf->backend_limit;
+    if (vlcf->rate_limits) {
+       request->rate_limits = vlcf->rate_limits->elts;
+       request->nrate_limits = vlcf->rate_limits->nelts;
+    }
+    if (vlcf->backends) {
+       request->backends = vlcf->backends->elts;
+       request->nbackends = vlcf->backends->nelts;
+    }
+    if (ngx_http_dbrelay_is_readonly_tag(vlcf, request->query_tag))
+       request->flags |= DBRELAY_FLAG_READONLY;
+
+    /* the location's driver, unless the request names one */
+    if (!strlen(request->sql_dbtype) && vlcf->dbtype.len)
+       dbrelay_copy_string(request->sql_dbtype, (char *) vlcf->dbtype.data, DBRELAY_OBJ_SZ);
+
     ngx_log_error(NGX_LOG_INFO, log, 0, "sql_server: \"%s\"", request->sql_server);
     if (request->sql) ngx_log_error(NGX_LOG_DEBUG, log, 0, "sql: \"%s\"", request->sql);
 	    
@@ -520,8 +799,18 @@ ngx_http_dbrelay_send_response(ngx_http_request_t *r)
     if (strlen(request->cmd)) json_output = (u_char *) dbrelay_db_cmd(request);
     else if (request->status) json_output = (u_char *) dbrelay_db_status(request);
     else json_output = (u_char *) dbrelay_db_run_query(request);
+    request->timings.bytes = strlen((char *) json_output);
+    cancelled = request->cancelled;
+    retry_after = request->retry_after;
     dbrelay_free_request(request);
 
+    /* nobody left to send it to */
+    if (cancelled) {
+       ngx_log_error(NGX_LOG_INFO, log, 0, "client closed connection, query cancelled");
+       free(json_output);
+       return NGX_HTTP_CLIENT_CLOSED_REQUEST;
+    }
+
     /* we need to allocate all before the header would be sent */
     len = ngx_strlen(json_output);
     b = ngx_create_temp_buf(r->pool, len + 1);
@@ -557,6 +846,25 @@ ngx_http_dbrelay_send_response(ngx_http_request_t *r)
        r->headers_out.content_type.data = (u_char *) "text/plain";
     }
     r->headers_out.status = NGX_HTTP_OK;
+
+    /* turned away by dbrelay_rate_limit, say when to come back */
+    if (retry_after) {
+        h = ngx_list_push(&r->headers_out.headers);
+        if (h == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+        h->hash = 1;
+        h->key.len = sizeof("Retry-After") - 1;
+        h->key.data = (u_char *) "Retry-After";
+        h->value.data = ngx_pnalloc(r->pool, NGX_INT_T_LEN);
+        if (h->value.data == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+        h->value.len = ngx_sprintf(h->value.data, "%ui", (ngx_uint_t) retry_after) - h->value.data;
+        r->headers_out.status = NGX_HTTP_TOO_MANY_REQUESTS;
+        r->headers_out.status_line.len = sizeof("429 Too Many Requests") - 1;
+        r->headers_out.status_line.data = (u_char *) "429 Too Many Requests";
+    }
     r->headers_out.content_length_n = len;
     r->headers_out.last_modified_time = 23349600;
     r->allow_ranges = 1;
@@ -582,6 +890,347 @@ ngx_http_dbrelay_set(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     return NGX_CONF_OK;
 }
 
+/*
+ * metrics in the Prometheus text exposition format, answered from shared
+ * memory without touching a database
+ */
+static ngx_int_t
+ngx_http_dbrelay_metrics_handler(ngx_http_request_t *r)
+{
+    ngx_int_t     rc;
+    ngx_buf_t    *b;
+    ngx_chain_t   out;
+    char         *text;
+    size_t        len;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    text = dbrelay_metrics_text();
+    if (text == NULL) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "could not attach metrics segment");
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    len = ngx_strlen(text);
+    b = ngx_create_temp_buf(r->pool, len + 1);
+    if (b == NULL) {
+        free(text);
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+    b->last = ngx_cpymem(b->last, text, len);
+    b->last_buf = 1;
+    free(text);
+
+    out.buf = b;
+    out.next = NULL;
+
+    r->headers_out.content_type.len = sizeof("text/plain; version=0.0.4") - 1;
+    r->headers_out.content_type.data = (u_char *) "text/plain; version=0.0.4";
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = len;
+
+    rc = ngx_http_send_header(r);
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+    return ngx_http_output_filter(r, &out);
+}
+
+static char *
+ngx_http_dbrelay_metrics_set(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_dbrelay_metrics_handler;
+
+    return NGX_CONF_OK;
+}
+
+static ngx_conf_enum_t  ngx_http_dbrelay_priorities[] = {
+    { ngx_string("high"), DBRELAY_PRIORITY_HIGH },
+    { ngx_string("normal"), DBRELAY_PRIORITY_NORMAL },
+    { ngx_string("low"), DBRELAY_PRIORITY_LOW },
+    { ngx_null_string, 0 }
+};
+
+/*
+ * dbrelay_priority class [query_tag ...]
+ * sets the class of the location's requests when waiting on a full pool,
+ * or with tags, the class of requests carrying one of those query_tags
+ */
+static char *
+ngx_http_dbrelay_priority_set(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_dbrelay_loc_conf_t      *lcf = conf;
+    ngx_http_dbrelay_priority_tag_t  *pt;
+    ngx_conf_enum_t                  *e;
+    ngx_str_t                        *value;
+    ngx_uint_t                        i;
+
+    value = cf->args->elts;
+
+    for (e = ngx_http_dbrelay_priorities; e->name.len; e++) {
+        if (e->name.len == value[1].len
+            && ngx_strncasecmp(e->name.data, value[1].data, value[1].len) == 0)
+        {
+            break;
+        }
+    }
+    if (e->name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid priority \"%V\", use high, normal or low", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (cf->args->nelts == 2) {
+        if (lcf->priority != NGX_CONF_UNSET_UINT) {
+            return "is duplicate";
+        }
+        lcf->priority = e->value;
+        return NGX_CONF_OK;
+    }
+
+    if (lcf->priority_tags == NULL) {
+        lcf->priority_tags = ngx_array_create(cf->pool, 4, sizeof(ngx_http_dbrelay_priority_tag_t));
+        if (lcf->priority_tags == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+    for (i = 2; i < cf->args->nelts; i++) {
+        pt = ngx_array_push(lcf->priority_tags);
+        if (pt == NULL) {
+            return NGX_CONF_ERROR;
+        }
+        pt->tag = value[i];
+        pt->priority = e->value;
+    }
+
+    return NGX_CONF_OK;
+}
+
+/* a query_tag mapped by dbrelay_priority wins over the location's class */
+static int
+ngx_http_dbrelay_priority(ngx_http_dbrelay_loc_conf_t *lcf, char *query_tag)
+{
+    ngx_http_dbrelay_priority_tag_t  *pt;
+    size_t                            len;
+    ngx_uint_t                        i;
+
+    len = strlen(query_tag);
+    if (len && lcf->priority_tags) {
+        pt = lcf->priority_tags->elts;
+        for (i = 0; i < lcf->priority_tags->nelts; i++) {
+            if (pt[i].tag.len == len && ngx_strncmp(pt[i].tag.data, query_tag, len) == 0) {
+                return pt[i].priority;
+            }
+        }
+    }
+    return lcf->priority;
+}
+
+/*
+ * dbrelay_rate_limit remote_addr|sql_user|query_tag [rate=Nr/s|Nr/m]
+ *                    [burst=N] [concurrency=N]
+ * a token bucket and/or a cap on running requests for each value of the 
+ * key, shared by all workers. Requests without a value, e.g. untagged ones
+ * under query_tag, are not limited by the rule.
+ */
+static char *
+ngx_http_dbrelay_rate_limit_set(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    static ngx_uint_t             ids;
+    ngx_http_dbrelay_loc_conf_t  *lcf = conf;
+    dbrelay_ratelimit_t          *rule;
+    ngx_str_t                    *value;
+    ngx_uint_t                    i;
+    ngx_int_t                     n;
+    size_t                        len;
+
+    value = cf->args->elts;
+
+    if (lcf->rate_limits == NULL) {
+        lcf->rate_limits = ngx_array_create(cf->pool, DBRELAY_RATELIMIT_RULES, sizeof(dbrelay_ratelimit_t));
+        if (lcf->rate_limits == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+    if (lcf->rate_limits->nelts == DBRELAY_RATELIMIT_RULES) {
+        return "has too many rules for one location";
+    }
+    rule = ngx_array_push(lcf->rate_limits);
+    if (rule == NULL) {
+        return NGX_CONF_ERROR;
+    }
+    ngx_memzero(rule, sizeof(dbrelay_ratelimit_t));
+    rule->id = ++ids;
+
+    if (value[1].len == sizeof("remote_addr") - 1 && ngx_strncmp(value[1].data, "remote_addr", value[1].len) == 0) {
+        rule->key = DBRELAY_RATELIMIT_REMOTE_ADDR;
+    } else if (value[1].len == sizeof("sql_user") - 1 && ngx_strncmp(value[1].data, "sql_user", value[1].len) == 0) {
+        rule->key = DBRELAY_RATELIMIT_SQL_USER;
+    } else if (value[1].len == sizeof("query_tag") - 1 && ngx_strncmp(value[1].data, "query_tag", value[1].len) == 0) {
+        rule->key = DBRELAY_RATELIMIT_QUERY_TAG;
+    } else {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid key \"%V\", use remote_addr, sql_user or query_tag", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "rate=", 5) == 0) {
+            len = value[i].len;
+            if (len > 8 && ngx_strncmp(value[i].data + len - 3, "r/s", 3) == 0) {
+                n = ngx_atoi(value[i].data + 5, len - 8);
+                if (n > 0) rule->rate = n * 60000;
+            } else if (len > 8 && ngx_strncmp(value[i].data + len - 3, "r/m", 3) == 0) {
+                n = ngx_atoi(value[i].data + 5, len - 8);
+                if (n > 0) rule->rate = n * 1000;
+            }
+            if (!rule->rate) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid rate \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "burst=", 6) == 0) {
+            n = ngx_atoi(value[i].data + 6, value[i].len - 6);
+            if (n == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid burst \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+            rule->burst = n;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "concurrency=", 12) == 0) {
+            n = ngx_atoi(value[i].data + 12, value[i].len - 12);
+            if (n <= 0 || n > DBRELAY_RATELIMIT_CONCURRENCY) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid concurrency \"%V\", at most %d", &value[i], DBRELAY_RATELIMIT_CONCURRENCY);
+                return NGX_CONF_ERROR;
+            }
+            rule->concurrency = n;
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (!rule->rate && !rule->concurrency) {
+        return "needs a rate or a concurrency";
+    }
+
+    return NGX_CONF_OK;
+}
+
+/*
+ * dbrelay_backend primary|replica host[:port]
+ * adds a server to the location's group, requests that do not give a
+ * sql_server are routed within it
+ */
+static char *
+ngx_http_dbrelay_backend_set(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_dbrelay_loc_conf_t  *lcf = conf;
+    dbrelay_route_backend_t      *backend;
+    ngx_str_t                    *value;
+    u_char                       *colon;
+    size_t                        len;
+
+    value = cf->args->elts;
+
+    if (lcf->backends == NULL) {
+        lcf->backends = ngx_array_create(cf->pool, 4, sizeof(dbrelay_route_backend_t));
+        if (lcf->backends == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+    backend = ngx_array_push(lcf->backends);
+    if (backend == NULL) {
+        return NGX_CONF_ERROR;
+    }
+    ngx_memzero(backend, sizeof(dbrelay_route_backend_t));
+
+    if (value[1].len == sizeof("primary") - 1 && ngx_strncmp(value[1].data, "primary", value[1].len) == 0) {
+        backend->replica = 0;
+    } else if (value[1].len == sizeof("replica") - 1 && ngx_strncmp(value[1].data, "replica", value[1].len) == 0) {
+        backend->replica = 1;
+    } else {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid role \"%V\", use primary or replica", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    len = value[2].len;
+    colon = ngx_strlchr(value[2].data, value[2].data + value[2].len, ':');
+    if (colon) {
+        len = colon - value[2].data;
+        if ((size_t) (value[2].data + value[2].len - colon - 1) >= sizeof(backend->sql_port)) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid port in \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+        ngx_memcpy(backend->sql_port, colon + 1, value[2].data + value[2].len - colon - 1);
+    }
+    if (len == 0 || len >= sizeof(backend->sql_server)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid server \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+    ngx_memcpy(backend->sql_server, value[2].data, len);
+
+    return NGX_CONF_OK;
+}
+
+static int
+ngx_http_dbrelay_is_readonly_tag(ngx_http_dbrelay_loc_conf_t *lcf, char *query_tag)
+{
+    ngx_str_t   *tags;
+    size_t       len;
+    ngx_uint_t   i;
+
+    len = strlen(query_tag);
+    if (!len || lcf->readonly_tags == NULL || lcf->readonly_tags == NGX_CONF_UNSET_PTR) {
+        return 0;
+    }
+    tags = lcf->readonly_tags->elts;
+    for (i = 0; i < lcf->readonly_tags->nelts; i++) {
+        if (tags[i].len == len && ngx_strncmp(tags[i].data, query_tag, len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void *
+ngx_http_dbrelay_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_dbrelay_main_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_dbrelay_main_conf_t));
+    if (conf == NULL) {
+        return NGX_CONF_ERROR;
+    }
+    conf->query_log_sample = NGX_CONF_UNSET_UINT;
+    conf->standby_connectors = NGX_CONF_UNSET_UINT;
+    return conf;
+}
+static char *
+ngx_http_dbrelay_init_main_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_http_dbrelay_main_conf_t *mcf = conf;
+
+    ngx_conf_init_uint_value(mcf->query_log_sample, 1);
+    ngx_conf_init_uint_value(mcf->standby_connectors, 0);
+
+    return NGX_CONF_OK;
+}
 static void *
 ngx_http_dbrelay_create_loc_conf(ngx_conf_t *cf)
 {
@@ -597,79 +1246,286 @@ ngx_http_dbrelay_create_loc_conf(ngx_conf_t *cf)
         return NGX_CONF_ERROR;
     }
     //conf->origin = default_origin;
+    conf->query_timeout = NGX_CONF_UNSET;
+    conf->slow_query_time = NGX_CONF_UNSET_MSEC;
+    conf->connector_sessions = NGX_CONF_UNSET_UINT;
+    conf->pool_wait = NGX_CONF_UNSET_MSEC;
+    conf->priority = NGX_CONF_UNSET_UINT;
+    conf->backend_limit = NGX_CONF_UNSET_UINT;
+    conf->readonly_tags = NGX_CONF_UNSET_PTR;
     return conf;
 }
-static void 
+static char *
+ngx_http_dbrelay_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_dbrelay_loc_conf_t *prev = parent;
+    ngx_http_dbrelay_loc_conf_t *conf = child;
+
+    ngx_conf_merge_sec_value(conf->query_timeout, prev->query_timeout, 0);
+    ngx_conf_merge_msec_value(conf->slow_query_time, prev->slow_query_time, 0);
+    ngx_conf_merge_uint_value(conf->connector_sessions, prev->connector_sessions, 1);
+    ngx_conf_merge_str_value(conf->dbtype, prev->dbtype, "");
+    ngx_conf_merge_msec_value(conf->pool_wait, prev->pool_wait, 0);
+    ngx_conf_merge_uint_value(conf->priority, prev->priority, DBRELAY_PRIORITY_NORMAL);
+    if (conf->priority_tags == NULL) {
+        conf->priority_tags = prev->priority_tags;
+    }
+    if (conf->rate_limits == NULL) {
+        conf->rate_limits = prev->rate_limits;
+    }
+    if (conf->backends == NULL) {
+        conf->backends = prev->backends;
+    }
+    ngx_conf_merge_ptr_value(conf->readonly_tags, prev->readonly_tags, NULL);
+    if (conf->connector_sessions > DBRELAY_CONNECTOR_SESSIONS) 
+        conf->connector_sessions = DBRELAY_CONNECTOR_SESSIONS;
+    ngx_conf_merge_uint_value(conf->backend_limit, prev->backend_limit, 0);
+    if (conf->backend_limit > DBRELAY_LIMITER_MAX) 
+        conf->backend_limit = DBRELAY_LIMITER_MAX;
+
+    return NGX_CONF_OK;
+}
+static ngx_int_t
+ngx_http_dbrelay_add_variables(ngx_conf_t *cf)
+{
+    ngx_http_variable_t  *var, *v;
+
+    for (v = ngx_http_dbrelay_vars; v->name.len; v++) {
+        var = ngx_http_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+    }
+    return NGX_OK;
+}
+/*
+ * phase times in seconds with millisecond resolution, like
+ * $upstream_response_time
+ */
+static ngx_int_t
+ngx_http_dbrelay_time_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v, uintptr_t data)
+{
+    dbrelay_request_t *request;
+    unsigned long usecs;
+    u_char *p;
+
+    request = ngx_http_get_module_ctx(r, ngx_http_dbrelay_module);
+    if (request == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+    usecs = *(unsigned long *) ((char *) &request->timings + data);
+
+    p = ngx_palloc(r->pool, NGX_INT_T_LEN + 4);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+    v->len = ngx_sprintf(p, "%ul.%03ul", usecs / 1000000, (usecs / 1000) % 1000) - p;
+    v->valid = 1;
+    v->no_cacheable = 1;
+    v->not_found = 0;
+    v->data = p;
+    return NGX_OK;
+}
+static ngx_int_t
+ngx_http_dbrelay_count_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v, uintptr_t data)
+{
+    dbrelay_request_t *request;
+    u_char *p;
+
+    request = ngx_http_get_module_ctx(r, ngx_http_dbrelay_module);
+    if (request == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+    p = ngx_palloc(r->pool, NGX_INT_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+    v->len = ngx_sprintf(p, "%ul", *(unsigned long *) ((char *) &request->timings + data)) - p;
+    v->valid = 1;
+    v->no_cacheable = 1;
+    v->not_found = 0;
+    v->data = p;
+    return NGX_OK;
+}
+/*
+ * request keys are dispatched through a perfect hash on length, first and
+ * last character, checked by a single strcmp against the slot.  If you add
+ * a key, make sure it lands in an empty slot.
+ */
+#define DBRELAY_KEY_HASH(k, len) ((((len) * 3) + (u_char) (k)[0] + ((u_char) (k)[(len)-1] * 24)) & 31)
+
+enum {
+   KEY_NONE = 0,
+   KEY_CMD,
+   KEY_STATUS,
+   KEY_SQL_DBTYPE,
+   KEY_SQL_DATABASE,
+   KEY_SQL_SERVER,
+   KEY_SQL_USER,
+   KEY_SQL_PORT,
+   KEY_SQL,
+   KEY_QUERY_TAG,
+   KEY_SQL_PASSWORD,
+   KEY_CONNECTION_NAME,
+   KEY_CONNECTION_TIMEOUT,
+   KEY_QUERY_TIMEOUT,
+   KEY_HTTP_KEEPALIVE,
+   KEY_LOG_LEVEL,
+   KEY_LOG_LEVEL_SCOPE,
+   KEY_FLAGS,
+   KEY_JS_CALLBACK,
+   KEY_JS_ERROR
+};
+
+static struct {
+   char *name;
+   int id;
+} request_keys[32] = {
+   { NULL, KEY_NONE },
+   { "sql_server", KEY_SQL_SERVER },                 /* 1 */
+   { NULL, KEY_NONE },
+   { NULL, KEY_NONE },
+   { NULL, KEY_NONE },
+   { NULL, KEY_NONE },
+   { NULL, KEY_NONE },
+   { "log_level", KEY_LOG_LEVEL },                   /* 7 */
+   { "connection_name", KEY_CONNECTION_NAME },       /* 8 */
+   { "sql_dbtype", KEY_SQL_DBTYPE },                 /* 9 */
+   { "http_keepalive", KEY_HTTP_KEEPALIVE },         /* 10 */
+   { "sql_port", KEY_SQL_PORT },                     /* 11 */
+   { "cmd", KEY_CMD },                               /* 12 */
+   { "status", KEY_STATUS },                         /* 13 */
+   { NULL, KEY_NONE },
+   { "sql_database", KEY_SQL_DATABASE },             /* 15 */
+   { NULL, KEY_NONE },
+   { "log_level_scope", KEY_LOG_LEVEL_SCOPE },       /* 17 */
+   { "js_error", KEY_JS_ERROR },                     /* 18 */
+   { "js_callback", KEY_JS_CALLBACK },               /* 19 */
+   { "query_tag", KEY_QUERY_TAG },                   /* 20 */
+   { NULL, KEY_NONE },
+   { NULL, KEY_NONE },
+   { "sql_password", KEY_SQL_PASSWORD },             /* 23 */
+   { "query_timeout", KEY_QUERY_TIMEOUT },           /* 24 */
+   { "connection_timeout", KEY_CONNECTION_TIMEOUT }, /* 25 */
+   { NULL, KEY_NONE },
+   { "sql_user", KEY_SQL_USER },                     /* 27 */
+   { "sql", KEY_SQL },                               /* 28 */
+   { "flags", KEY_FLAGS },                           /* 29 */
+   { NULL, KEY_NONE },
+   { NULL, KEY_NONE }
+};
+
+static int
+lookup_key(char *key)
+{
+   size_t len = strlen(key);
+   int slot;
+
+   if (!len) return KEY_NONE;
+   slot = DBRELAY_KEY_HASH(key, len);
+   if (request_keys[slot].name && !strcmp(request_keys[slot].name, key))
+      return request_keys[slot].id;
+   return KEY_NONE;
+}
+/*
+ * store an unescaped key/value pair in the request. Returns 1 if the 
+ * request took ownership of value (a malloc'd buffer), 0 otherwise.
+ * Short values are copied into the request pool.
+ */
+static int 
 write_value(dbrelay_request_t *request, char *key, char *value)
 {
-   u_char *dst, *src;
    unsigned int i;
    unsigned char noprint=0;
+   int kept=0;
    char *log_levels[] = { "debug", "informational", "notice", "warning", "error", "critical" };
    char *log_level_scopes[] = { "server", "connection", "query" };
 
-
-   /* simple unescape of '+', ngx_unescape_uri doesn't do this for us */
-   for (i=0;i<strlen(value);i++) {
-      if (value[i]=='+') value[i]=' ';
-   }
-
-   dst = (u_char *) value; src = (u_char *) value;
-   ngx_unescape_uri(&dst, &src, strlen(value), 0);
-   *dst = '\0';
-
-   if (!strcmp(key, "cmd")) {
-      dbrelay_copy_string(request->cmd, value, DBRELAY_OBJ_SZ);
-   } else if (!strcmp(key, "status")) {
-      request->status = 1;
-   } else if (!strcmp(key, "sql_dbtype")) {
-      dbrelay_copy_string(request->sql_dbtype, value, DBRELAY_OBJ_SZ);
-   } else if (!strcmp(key, "sql_database")) {
-      dbrelay_copy_string(request->sql_database, value, DBRELAY_OBJ_SZ);
-   } else if (!strcmp(key, "sql_server")) {
-      dbrelay_copy_string(request->sql_server, value, DBRELAY_NAME_SZ);
-   } else if (!strcmp(key, "sql_user")) {
-      dbrelay_copy_string(request->sql_user, value, DBRELAY_OBJ_SZ);
-   } else if (!strcmp(key, "sql_port")) {
-      dbrelay_copy_string(request->sql_port, value, 6);
-   } else if (!strcmp(key, "sql")) {
-      request->sql = strdup(value);
-   } else if (!strcmp(key, "query_tag")) {
-      dbrelay_copy_string(request->query_tag, value, DBRELAY_NAME_SZ);
-   } else if (!strcmp(key, "sql_password")) {
-      dbrelay_copy_string(request->sql_password, value, DBRELAY_OBJ_SZ);
-      noprint = 1;
-   } else if (!strcmp(key, "connection_name")) {
-      dbrelay_copy_string(request->connection_name, value, DBRELAY_NAME_SZ);
-   } else if (!strcmp(key, "connection_timeout")) {
-      request->connection_timeout = atol(value);
-   } else if (!strcmp(key, "http_keepalive")) {
-      request->http_keepalive = atoi(value);
-   } else if (!strcmp(key, "log_level")) {
-      for (i=0; i<sizeof(log_levels)/sizeof(char *); i++)
-         if (!strcmp(value,log_levels[i])) request->log_level = i;
-   } else if (!strcmp(key, "log_level_scope")) {
-      for (i=0; i<sizeof(log_level_scopes)/sizeof(char *); i++)
-         if (!strcmp(value,log_level_scopes[i])) request->log_level_scope = i;
-   } else if (!strncmp(key, "param", 5)) {
-      i = atoi(&key[5]);
-      if (i>DBRELAY_MAX_PARAMS) {
-         dbrelay_log_error(request, "param%d exceeds DBRELAY_MAX_PARAMS", i);
-      } else if (i>0) {
-         request->params[i-1] = strdup(value);
-      }
-   } else if (!strcmp(key, "flags")) {
-      write_flag_values(request, value);
-   } else if (!strcmp(key, "js_callback")) {
-      dbrelay_copy_string(request->js_callback, value, DBRELAY_NAME_SZ);
-   } else if (!strcmp(key, "js_error")) {
-      dbrelay_copy_string(request->js_error, value, DBRELAY_NAME_SZ);
+   switch (lookup_key(key)) {
+      case KEY_CMD:
+         dbrelay_copy_string(request->cmd, value, DBRELAY_OBJ_SZ);
+         break;
+      case KEY_STATUS:
+         request->status = 1;
+         break;
+      case KEY_SQL_DBTYPE:
+         dbrelay_copy_string(request->sql_dbtype, value, DBRELAY_OBJ_SZ);
+         break;
+      case KEY_SQL_DATABASE:
+         dbrelay_copy_string(request->sql_database, value, DBRELAY_OBJ_SZ);
+         break;
+      case KEY_SQL_SERVER:
+         dbrelay_copy_string(request->sql_server, value, DBRELAY_NAME_SZ);
+         break;
+      case KEY_SQL_USER:
+         dbrelay_copy_string(request->sql_user, value, DBRELAY_OBJ_SZ);
+         break;
+      case KEY_SQL_PORT:
+         dbrelay_copy_string(request->sql_port, value, 6);
+         break;
+      case KEY_SQL:
+         /* sql can be large, hand over the parser's buffer instead of copying */
+         if (request->sql) free(request->sql);
+         request->sql = value;
+         kept = 1;
+         break;
+      case KEY_QUERY_TAG:
+         dbrelay_copy_string(request->query_tag, value, DBRELAY_NAME_SZ);
+         break;
+      case KEY_SQL_PASSWORD:
+         dbrelay_copy_string(request->sql_password, value, DBRELAY_OBJ_SZ);
+         noprint = 1;
+         break;
+      case KEY_CONNECTION_NAME:
+         dbrelay_copy_string(request->connection_name, value, DBRELAY_NAME_SZ);
+         break;
+      case KEY_CONNECTION_TIMEOUT:
+         request->connection_timeout = atol(value);
+         break;
+      case KEY_QUERY_TIMEOUT:
+         request->query_timeout = atol(value);
+         break;
+      case KEY_HTTP_KEEPALIVE:
+         request->http_keepalive = atoi(value);
+         break;
+      case KEY_LOG_LEVEL:
+         for (i=0; i<sizeof(log_levels)/sizeof(char *); i++)
+            if (!strcmp(value,log_levels[i])) request->log_level = i;
+         break;
+      case KEY_LOG_LEVEL_SCOPE:
+         for (i=0; i<sizeof(log_level_scopes)/sizeof(char *); i++)
+            if (!strcmp(value,log_level_scopes[i])) request->log_level_scope = i;
+         break;
+      case KEY_FLAGS:
+         write_flag_values(request, value);
+         break;
+      case KEY_JS_CALLBACK:
+         dbrelay_copy_string(request->js_callback, value, DBRELAY_NAME_SZ);
+         break;
+      case KEY_JS_ERROR:
+         dbrelay_copy_string(request->js_error, value, DBRELAY_NAME_SZ);
+         break;
+      default:
+         if (!strncmp(key, "param", 5)) {
+            i = atoi(&key[5]);
+            if (i>DBRELAY_MAX_PARAMS) {
+               dbrelay_log_error(request, "param%d exceeds DBRELAY_MAX_PARAMS", i);
+            } else if (i>0) {
+               dbrelay_request_set_param(request, i-1, value);
+            }
+         }
+         break;
    }
    
    if (!noprint) {
       dbrelay_log_debug(request, "key %s", key);
       dbrelay_log_debug(request, "value %s", value);
    }
+   return kept;
 }
 static void 
 write_flag_values(dbrelay_request_t *request, char *value)
@@ -683,148 +1539,175 @@ write_flag_values(dbrelay_request_t *request, char *value)
       else if (!strcmp(tok, "xact")) request->flags|=DBRELAY_FLAG_XACT; 
       else if (!strcmp(tok, "embedcsv")) request->flags|=DBRELAY_FLAG_EMBEDCSV; 
       else if (!strcmp(tok, "nomagic")) request->flags|=DBRELAY_FLAG_NOMAGIC; 
+      else if (!strcmp(tok, "timings")) request->flags|=DBRELAY_FLAG_TIMINGS;
+      else if (!strcmp(tok, "prepare")) request->flags|=DBRELAY_FLAG_PREPARE;
+      else if (!strcmp(tok, "readonly")) request->flags|=DBRELAY_FLAG_READONLY;
    }
    free(flags);
 }
-void parse_post_query_file(ngx_temp_file_t *temp_file, dbrelay_request_t *request)
+/*
+ * Incremental x-www-form-urlencoded parser. Chunks are fed in as they are
+ * read, '+' and %XX escapes are decoded on the way through, and each pair
+ * is handed to write_value() as soon as its '&' is seen, so the body is
+ * never held in memory as a whole.
+ */
+static void
+form_parser_init(dbrelay_form_parser_t *p, dbrelay_request_t *request)
+{
+   memset(p, 0, sizeof(dbrelay_form_parser_t));
+   p->request = request;
+}
+static void
+form_parser_put(dbrelay_form_parser_t *p, u_char c)
 {
-   ssize_t bytes_read;
-   u_char *buf;
-   char key[100];
-   char *value;
-   char *s, *k = key, *v;
-   int target = 0;
-   unsigned long bufsz = 0;
-   int chop = 0;
-   struct stat statbuf;
-
-   dbrelay_log_debug(request, "entering parse_post_query_file");
-
-   fstat(temp_file->file.fd, &statbuf);
-   buf = (u_char *) malloc(statbuf.st_size);
-
-   lseek(temp_file->file.fd, 0, SEEK_SET);
-   while ((bytes_read = read(temp_file->file.fd, &buf[bufsz], statbuf.st_size-bufsz))>0 && bufsz<=(unsigned long)statbuf.st_size) 
-   {
-      bufsz += bytes_read;
+   if (!p->target) {
+      if (p->key_len < sizeof(p->key) - 1) p->key[p->key_len++] = c;
+      return;
    }
-   
-   value = (char *) malloc(bufsz);
-   v = value;
-   ngx_log_error(NGX_LOG_DEBUG, request->log, 0, "post data %l bytes", bufsz);
+   if (p->value_len + 1 >= p->value_sz) {
+      p->value_sz = p->value_sz ? p->value_sz * 2 : DBRELAY_FORM_VALUE_SZ;
+      p->value = (char *) realloc(p->value, p->value_sz);
+   }
+   p->value[p->value_len++] = c;
+}
+static void
+form_parser_emit(dbrelay_form_parser_t *p)
+{
+   if (!p->value) {
+      p->value_sz = 1;
+      p->value = (char *) malloc(p->value_sz);
+   }
+   p->key[p->key_len] = '\0';
+   p->value[p->value_len] = '\0';
+   if (p->key_len && write_value(p->request, p->key, p->value)) {
+      /* request kept the buffer */
+      p->value = NULL;
+      p->value_sz = 0;
+   }
+   p->key_len = 0;
+   p->value_len = 0;
+   p->target = 0;
+}
+static int
+form_hexval(u_char c)
+{
+   if (c >= '0' && c <= '9') return c - '0';
+   c |= 0x20;
+   if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+   return -1;
+}
+static void
+form_parser_plain(dbrelay_form_parser_t *p, u_char c)
+{
+   switch (c) {
+      case '&':
+         form_parser_emit(p);
+         break;
+      case '=':
+         if (!p->target) p->target = 1;
+         else form_parser_put(p, c);
+         break;
+      case '+':
+         form_parser_put(p, ' ');
+         break;
+      case '%':
+         p->escape = 1;
+         break;
+      default:
+         form_parser_put(p, c);
+   }
+}
+static void
+form_parser_feed(dbrelay_form_parser_t *p, u_char *data, size_t len)
+{
+   u_char *s;
+   int h;
 
-   for (s= (char *)buf; s !=  (char *)&buf[bufsz]; s++)
-   { 
-	      if (*s=='&') {
-		  *k='\0';
-		  *v='\0';
-		  write_value(request, key, value);
-		  target=0;
-		  k=key;
-	      } else if (*s=='=') {
-		  target=1;
-		  v=value;
-	      } else if (target==0) {
-		  *k++=*s;
-	      } else {
-		  *v++=*s;
-	      }
+   for (s = data; s < data + len; s++) {
+      if (!p->escape) {
+         form_parser_plain(p, *s);
+         continue;
+      }
+      h = form_hexval(*s);
+      if (h < 0) {
+         /* not an escape after all, keep it as is */
+         form_parser_put(p, '%');
+         if (p->escape == 2) form_parser_put(p, p->hex);
+         p->escape = 0;
+         form_parser_plain(p, *s);
+      } else if (p->escape == 1) {
+         p->hex = *s;
+         p->escape = 2;
+      } else {
+         form_parser_put(p, (u_char) ((form_hexval(p->hex) << 4) | h));
+         p->escape = 0;
+      }
    }
-   *k='\0';
-   while (v>=value && (*v=='\n' || *v=='\r')) {
-     *v--='\0';
-     chop = 1;
+}
+static void
+form_parser_finish(dbrelay_form_parser_t *p)
+{
+   if (p->escape) {
+      form_parser_put(p, '%');
+      if (p->escape == 2) form_parser_put(p, p->hex);
+      p->escape = 0;
    }
-   if (!chop) *v='\0';
-   write_value(request, key, value);
-   free(value);
-   free(buf);
-   dbrelay_log_debug(request, "leaving parse_post_query_file");
+   /* trailing newline from curl -d @file and friends */
+   while (p->value_len && (p->value[p->value_len-1]=='\n' || p->value[p->value_len-1]=='\r'))
+      p->value_len--;
+   form_parser_emit(p);
+   if (p->value) free(p->value);
+   p->value = NULL;
 }
-void parse_post_query_string(ngx_chain_t *bufs, dbrelay_request_t *request)
+/*
+ * walk the request body chain, reading in place from memory buffers and
+ * in DBRELAY_FORM_CHUNK pieces from the temp file when nginx spooled it
+ */
+void parse_post_body(ngx_chain_t *bufs, dbrelay_request_t *request)
 {
-   char key[100];
-   char *value;
-   char *s, *k = key, *v;
-   int target = 0;
-   ngx_buf_t *buf;
+   dbrelay_form_parser_t parser;
    ngx_chain_t *chain;
+   ngx_buf_t *buf;
+   u_char chunk[DBRELAY_FORM_CHUNK];
+   off_t offset;
+   ssize_t n;
+   size_t want;
    unsigned long bufsz = 0;
-   int chop = 0;
 
-   dbrelay_log_debug(request, "entering parse_post_query_string");
-
-   for (chain = bufs; chain!=NULL; chain = chain->next) 
-   {
-      buf = chain->buf;
-      bufsz += (buf->last - buf->pos) + 1;
-   }
-   value = (char *) malloc(bufsz);
-   v = value;
-   ngx_log_error(NGX_LOG_DEBUG, request->log, 0, "post data %l bytes", bufsz);
+   dbrelay_log_debug(request, "entering parse_post_body");
 
+   form_parser_init(&parser, request);
    for (chain = bufs; chain!=NULL; chain = chain->next) 
    {
       buf = chain->buf;
-      for (s= (char *)buf->pos; s !=  (char *)buf->last; s++)
-      { 
-	      if (*s=='&') {
-		  *k='\0';
-		  *v='\0';
-		  write_value(request, key, value);
-		  target=0;
-		  k=key;
-	      } else if (*s=='=') {
-		  target=1;
-		  v=value;
-	      } else if (target==0) {
-		  *k++=*s;
-	      } else {
-		  *v++=*s;
-	      }
+      if (buf->in_file) {
+         for (offset = buf->file_pos; offset < buf->file_last; offset += n) {
+            want = buf->file_last - offset > DBRELAY_FORM_CHUNK ? DBRELAY_FORM_CHUNK : buf->file_last - offset;
+            n = ngx_read_file(buf->file, chunk, want, offset);
+            if (n <= 0) {
+               dbrelay_log_error(request, "failed reading request body from temp file");
+               break;
+            }
+            form_parser_feed(&parser, chunk, n);
+            bufsz += n;
+         }
+      } else {
+         form_parser_feed(&parser, buf->pos, buf->last - buf->pos);
+         bufsz += buf->last - buf->pos;
       }
    }
-   *k='\0';
-   while (v>=value && (*v=='\n' || *v=='\r')) {
-     *v--='\0';
-     chop = 1;
-   }
-   if (!chop) *v='\0';
-   write_value(request, key, value);
-   free(value);
-   dbrelay_log_debug(request, "leaving parse_post_query_string");
+   form_parser_finish(&parser);
+
+   ngx_log_error(NGX_LOG_DEBUG, request->log, 0, "post data %l bytes", bufsz);
+   dbrelay_log_debug(request, "leaving parse_post_body");
 }
 void parse_get_query_string(ngx_str_t args, dbrelay_request_t *request)
 {
-   char key[100];
-   char value[4000];
-   char *s, *k = key, *v = value;
-   int target = 0;
+   dbrelay_form_parser_t parser;
 
    if (args.len==0) return;
 
-   for (s=(char *)args.data; *s && s < (((char *)args.data) + args.len); s++)
-   { 
-      if (*s=='&') {
-         *k='\0';
-	 *v='\0';
-         ngx_log_error(NGX_LOG_DEBUG, request->log, 0, "escaped value %s", value);
-	 write_value(request, key, value);
-         target=0;
-         k=key;
-      } else if (*s=='=') {
-         target=1;
-         v=value;
-      } else if (target==0) {
-         *k++=*s;
-      } else {
-	 *v++=*s;
-      }
-   }
-   *k='\0';
-   while (v>=value && (*v=='\n' || *v=='\r')) *v--='\0';
-   *v='\0';
-   ngx_log_error(NGX_LOG_DEBUG, request->log, 0, "escaped value %s", value);
-   write_value(request, key, value);
+   form_parser_init(&parser, request);
+   form_parser_feed(&parser, args.data, args.len);
+   form_parser_finish(&parser);
 }
-
@@ -32,12 +32,18 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <pthread.h>
 #include "stringbuf.h"
 #include "vodbc.h"
 
 #define IS_SET(x) (x && strlen(x)>0)
 
 static void dbrelay_odbc_get_error(void *db);
+static void dbrelay_odbc_free_cols(odbc_db_t *odbc);
+
+/* one environment per process, so the driver manager can pool connections */
+static SQLHENV odbc_env = SQL_NULL_HANDLE;
+static pthread_once_t odbc_env_once = PTHREAD_ONCE_INIT;
 
 dbrelay_dbapi_t dbrelay_odbc_api = 
 {
@@ -61,11 +67,26 @@ dbrelay_dbapi_t dbrelay_odbc_api =
    &dbrelay_odbc_colvalue,
    &dbrelay_odbc_error,
    &dbrelay_odbc_catalogsql,
-   &dbrelay_odbc_isalive
+   &dbrelay_odbc_isalive,
+   &dbrelay_odbc_cancel,
+   NULL,
+   &dbrelay_odbc_fetch_batch
 };
 
+static void dbrelay_odbc_init_env()
+{
+   /* must be set before the environment is allocated */
+   SQLSetEnvAttr(SQL_NULL_HANDLE, SQL_ATTR_CONNECTION_POOLING, (SQLPOINTER) SQL_CP_ONE_PER_HENV, SQL_IS_UINTEGER);
+   if (!SQL_SUCCEEDED(SQLAllocHandle(SQL_HANDLE_ENV, SQL_NULL_HANDLE, &odbc_env))) {
+      odbc_env = SQL_NULL_HANDLE;
+      return;
+   }
+   SQLSetEnvAttr(odbc_env, SQL_ATTR_ODBC_VERSION, (SQLPOINTER) (SQL_OV_ODBC3), SQL_IS_UINTEGER);
+   SQLSetEnvAttr(odbc_env, SQL_ATTR_CP_MATCH, (SQLPOINTER) SQL_CP_RELAXED_MATCH, SQL_IS_UINTEGER);
+}
 void dbrelay_odbc_init()
 {
+   pthread_once(&odbc_env_once, dbrelay_odbc_init_env);
 }
 void *dbrelay_odbc_connect(dbrelay_request_t *request)
 {
@@ -75,9 +96,13 @@ void *dbrelay_odbc_connect(dbrelay_request_t *request)
    SQLCHAR message[255];
    SQLINTEGER errnum;
 
-   SQLAllocHandle(SQL_HANDLE_ENV, SQL_NULL_HANDLE, &odbc->env);
-   SQLSetEnvAttr(odbc->env, SQL_ATTR_ODBC_VERSION, (SQLPOINTER) (SQL_OV_ODBC3), SQL_IS_UINTEGER);
-   SQLAllocHandle(SQL_HANDLE_DBC, odbc->env, &odbc->dbc);
+   memset(odbc, 0, sizeof(odbc_db_t));
+   odbc->request = request;
+   dbrelay_odbc_init();
+   if (!odbc_env || !SQL_SUCCEEDED(SQLAllocHandle(SQL_HANDLE_DBC, odbc_env, &odbc->dbc))) {
+      free(odbc);
+      return NULL;
+   }
 
    ret = SQLConnect(odbc->dbc, (SQLCHAR *) request->sql_server, SQL_NTS, (SQLCHAR *) request->sql_user, SQL_NTS, (SQLCHAR *) request->sql_password, SQL_NTS);
 
@@ -85,7 +110,6 @@ void *dbrelay_odbc_connect(dbrelay_request_t *request)
       SQLGetDiagRec(SQL_HANDLE_DBC, odbc->dbc, 1, sqlstate, &errnum, message, sizeof(message), NULL);
       //fprintf(stderr, "sqlstate %s %ld (%s)\n", sqlstate, errnum, message);
       if (odbc->dbc) SQLFreeHandle(SQL_HANDLE_DBC, odbc->dbc);
-      if (odbc->env) SQLFreeHandle(SQL_HANDLE_ENV, odbc->env);
       free(odbc);
       return NULL;
    }
@@ -95,28 +119,35 @@ void *dbrelay_odbc_connect(dbrelay_request_t *request)
 void dbrelay_odbc_close(void *db)
 {
    odbc_db_t *odbc = (odbc_db_t *) db;
+   int i;
 
-   if (odbc->stmt) SQLFreeHandle(SQL_HANDLE_STMT, odbc->stmt);
+   dbrelay_odbc_free_cols(odbc);
+   for (i=0; i<DBRELAY_ODBC_PREPARED; i++) {
+      if (odbc->prepared[i].stmt) SQLFreeHandle(SQL_HANDLE_STMT, odbc->prepared[i].stmt);
+      if (odbc->prepared[i].sql) free(odbc->prepared[i].sql);
+   }
+   memset(odbc->prepared, 0, sizeof(odbc->prepared));
+   if (odbc->direct) SQLFreeHandle(SQL_HANDLE_STMT, odbc->direct);
+   /* with pooling on this hands the connection back to the driver manager */
    if (odbc->dbc) {
       SQLDisconnect(odbc->dbc);
       SQLFreeHandle(SQL_HANDLE_DBC, odbc->dbc);
    }
-   if (odbc->env) SQLFreeHandle(SQL_HANDLE_ENV, odbc->env);
    odbc->stmt=NULL;
+   odbc->direct=NULL;
    odbc->dbc=NULL;
-   odbc->env=NULL;
 }
 void dbrelay_odbc_assign_request(void *db, dbrelay_request_t *request)
 {
+   odbc_db_t *odbc = (odbc_db_t *) db;
+
+   odbc->request = request;
 }
 int dbrelay_odbc_is_quoted(void *db, int colnum)
 {
    odbc_db_t *odbc = (odbc_db_t *) db;
-   SQLSMALLINT coltype;
-   
-   SQLDescribeCol(odbc->stmt, colnum, NULL, 0, NULL, &coltype, NULL, NULL, NULL); 
 
-   switch (coltype) {
+   switch (odbc->cols[colnum-1].type) {
       case SQL_CHAR:
       case SQL_VARCHAR:
       case SQL_LONGVARCHAR:
@@ -246,14 +277,92 @@ int dbrelay_odbc_change_db(void *db, char *database)
 {
    return TRUE;
 }
+/*
+ * find the statement prepared for sql on this connection, preparing it
+ * in place of the least recently used one if there is none
+ */
+static SQLHSTMT dbrelay_odbc_prepare(odbc_db_t *odbc, char *sql)
+{
+   odbc_prepared_t *p, *victim = &odbc->prepared[0];
+   SQLHSTMT stmt = NULL;
+   int i;
+
+   for (i=0; i<DBRELAY_ODBC_PREPARED; i++) {
+      p = &odbc->prepared[i];
+      if (p->sql && !strcmp(p->sql, sql)) {
+         p->last_used = ++odbc->uses;
+         return p->stmt;
+      }
+      if (p->last_used < victim->last_used) victim = p;
+   }
+
+   if (victim->stmt) SQLFreeHandle(SQL_HANDLE_STMT, victim->stmt);
+   if (victim->sql) free(victim->sql);
+   memset(victim, 0, sizeof(odbc_prepared_t));
+
+   if (!SQL_SUCCEEDED(SQLAllocHandle(SQL_HANDLE_STMT, odbc->dbc, &stmt))) {
+      strcpy((char *) odbc->error_message, "Could not allocate statement handle");
+      return NULL;
+   }
+   if (!SQL_SUCCEEDED(SQLPrepare(stmt, (SQLCHAR *) sql, SQL_NTS))) {
+      odbc->stmt = stmt;
+      dbrelay_odbc_get_error(odbc);
+      odbc->stmt = NULL;
+      SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+      return NULL;
+   }
+   victim->sql = strdup(sql);
+   victim->stmt = stmt;
+   victim->last_used = ++odbc->uses;
+   return stmt;
+}
 int dbrelay_odbc_exec(void *db, char *sql)
 {
    odbc_db_t *odbc = (odbc_db_t *) db;
    SQLRETURN ret;
+   useconds_t nap = 1000;
+   time_t last_check;
+   int cancelled = 0;
+   int prepared = odbc->request && (odbc->request->flags & DBRELAY_FLAG_PREPARE);
+   long timeout = odbc->request ? odbc->request->query_timeout : 0;
 
-   SQLAllocHandle(SQL_HANDLE_STMT, odbc->dbc, &odbc->stmt);
+   /* handles are reused, close whatever the last statement left open */
+   dbrelay_odbc_free_cols(odbc);
+   if (odbc->stmt) SQLFreeStmt(odbc->stmt, SQL_CLOSE);
+   odbc->stmt = NULL;
 
-   ret = SQLExecDirect(odbc->stmt, (SQLCHAR *) sql, SQL_NTS);
+   if (prepared) {
+      if (!(odbc->stmt = dbrelay_odbc_prepare(odbc, sql))) return FALSE;
+   } else {
+      if (!odbc->direct && !SQL_SUCCEEDED(SQLAllocHandle(SQL_HANDLE_STMT, odbc->dbc, &odbc->direct))) {
+         odbc->direct = NULL;
+         strcpy((char *) odbc->error_message, "Could not allocate statement handle");
+         return FALSE;
+      }
+      odbc->stmt = odbc->direct;
+   }
+
+   SQLSetStmtAttr(odbc->stmt, SQL_ATTR_QUERY_TIMEOUT, (SQLPOINTER) timeout, SQL_IS_UINTEGER);
+
+   /*
+    * run asynchronously so we can notice a client disconnect and
+    * SQLCancel() the statement. Drivers without async support just
+    * return the final status from the first call.
+    */
+   SQLSetStmtAttr(odbc->stmt, SQL_ATTR_ASYNC_ENABLE, (SQLPOINTER) SQL_ASYNC_ENABLE_ON, SQL_IS_UINTEGER);
+   time(&last_check);
+   while ((ret = prepared ? SQLExecute(odbc->stmt) : SQLExecDirect(odbc->stmt, (SQLCHAR *) sql, SQL_NTS)) == SQL_STILL_EXECUTING) {
+      usleep(nap);
+      if (nap < 100000) nap *= 2;
+      if (!cancelled && odbc->request && time(NULL) - last_check >= DBRELAY_CANCEL_POLL) {
+         time(&last_check);
+         if (dbrelay_db_check_cancel(odbc->request)) {
+            SQLCancel(odbc->stmt);
+            cancelled = 1;
+         }
+      }
+   }
+   SQLSetStmtAttr(odbc->stmt, SQL_ATTR_ASYNC_ENABLE, (SQLPOINTER) SQL_ASYNC_ENABLE_OFF, SQL_IS_UINTEGER);
    odbc->querying = 1;
 
    if (SQL_SUCCEEDED(ret)) return TRUE;
@@ -272,105 +381,330 @@ int dbrelay_odbc_rowcount(void *db)
    
    return rowcount;
 }
+static void dbrelay_odbc_free_cols(odbc_db_t *odbc)
+{
+   int i;
+
+   if (!odbc->cols) return;
+   if (odbc->stmt) {
+      SQLFreeStmt(odbc->stmt, SQL_UNBIND);
+      /* the handle may be reused, don't leave it pointing at freed arrays */
+      SQLSetStmtAttr(odbc->stmt, SQL_ATTR_ROW_STATUS_PTR, NULL, 0);
+      SQLSetStmtAttr(odbc->stmt, SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER) 1, SQL_IS_UINTEGER);
+   }
+   for (i=0; i<odbc->numcols; i++) {
+      if (odbc->cols[i].data) free(odbc->cols[i].data);
+      if (odbc->cols[i].ind) free(odbc->cols[i].ind);
+      if (odbc->cols[i].value) free(odbc->cols[i].value);
+   }
+   free(odbc->cols);
+   if (odbc->status) free(odbc->status);
+   odbc->cols = NULL;
+   odbc->status = NULL;
+   odbc->numcols = 0;
+   odbc->fetched = 0;
+   odbc->row = -1;
+}
+/* width of a column converted to SQL_C_CHAR, 0 if it should not be bound */
+static SQLLEN dbrelay_odbc_bind_width(odbc_col_t *col)
+{
+   SQLLEN width;
+
+   switch (col->type) {
+      case SQL_LONGVARCHAR:
+      case SQL_WLONGVARCHAR:
+      case SQL_LONGVARBINARY:
+         return 0;
+      case SQL_WCHAR:
+      case SQL_WVARCHAR:
+         /* up to 4 bytes per character once converted */
+         width = col->size * 4 + 1;
+         break;
+      case SQL_BINARY:
+      case SQL_VARBINARY:
+         /* hex digits */
+         width = col->size * 2 + 1;
+         break;
+      case SQL_DECIMAL:
+      case SQL_NUMERIC:
+         /* sign, decimal point and leading zero */
+         width = col->size + 4;
+         break;
+      case SQL_SMALLINT:
+      case SQL_INTEGER:
+      case SQL_TINYINT:
+      case SQL_BIGINT:
+      case SQL_BIT:
+         width = 22;
+         break;
+      case SQL_REAL:
+      case SQL_FLOAT:
+      case SQL_DOUBLE:
+         width = 32;
+         break;
+      default:
+         if (col->size==0) return 0;
+         width = col->size + 1;
+         if (width < 64) width = 64;
+         break;
+   }
+   if (col->size==0 || width > DBRELAY_ODBC_MAX_BIND) return 0;
+   return width;
+}
+/*
+ * describe the result set once and bind it column-wise so SQLFetch
+ * returns a block of rows at a time. Columns from the first long or
+ * unbounded one onward are left unbound and read with SQLGetData,
+ * which drivers only allow past the last bound column and, in general,
+ * with a rowset of one.
+ */
+static void dbrelay_odbc_bind_cols(odbc_db_t *odbc)
+{
+   SQLSMALLINT numcols = 0, namelen;
+   SQLLEN rowsize = 0;
+   SQLULEN rows;
+   odbc_col_t *col;
+   int i, unbound = 0;
+
+   SQLNumResultCols(odbc->stmt, &numcols);
+   odbc->numcols = numcols;
+   odbc->fetched = 0;
+   odbc->row = -1;
+   if (numcols<=0) return;
+
+   odbc->cols = (odbc_col_t *) calloc(numcols, sizeof(odbc_col_t));
+   for (i=0; i<numcols; i++) {
+      col = &odbc->cols[i];
+      namelen = 0;
+      SQLDescribeCol(odbc->stmt, i + 1, (SQLCHAR *) col->name, sizeof(col->name), &namelen, &col->type, &col->size, &col->digits, NULL);
+      if (namelen < 0 || namelen >= (SQLSMALLINT) sizeof(col->name)) namelen = sizeof(col->name) - 1;
+      col->name[namelen]='\0';
+      if (!unbound) col->width = dbrelay_odbc_bind_width(col);
+      if (col->width==0) unbound = 1;
+      rowsize += col->width;
+   }
+
+   if (unbound || rowsize==0) rows = 1;
+   else {
+      rows = DBRELAY_ODBC_BLOCK_BYTES / rowsize;
+      if (rows > DBRELAY_ODBC_BLOCK_ROWS) rows = DBRELAY_ODBC_BLOCK_ROWS;
+      if (rows < 1) rows = 1;
+   }
+
+   for (i=0; i<numcols; i++) {
+      col = &odbc->cols[i];
+      if (!col->width) break;
+      col->data = (char *) malloc(col->width * rows);
+      col->ind = (SQLLEN *) malloc(sizeof(SQLLEN) * rows);
+      SQLBindCol(odbc->stmt, i + 1, SQL_C_CHAR, col->data, col->width, col->ind);
+   }
+
+   odbc->status = (SQLUSMALLINT *) malloc(sizeof(SQLUSMALLINT) * rows);
+   SQLSetStmtAttr(odbc->stmt, SQL_ATTR_ROW_BIND_TYPE, (SQLPOINTER) SQL_BIND_BY_COLUMN, SQL_IS_UINTEGER);
+   SQLSetStmtAttr(odbc->stmt, SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER) rows, SQL_IS_UINTEGER);
+   SQLSetStmtAttr(odbc->stmt, SQL_ATTR_ROW_STATUS_PTR, (SQLPOINTER) odbc->status, 0);
+   SQLSetStmtAttr(odbc->stmt, SQL_ATTR_ROWS_FETCHED_PTR, (SQLPOINTER) &odbc->fetched, 0);
+}
 int dbrelay_odbc_has_results(void *db)
 {
    odbc_db_t *odbc = (odbc_db_t *) db;
    SQLRETURN ret;
 
+   dbrelay_odbc_free_cols(odbc);
+
    if (odbc->querying) {
       odbc->querying = 0;
-      return TRUE;
+   } else {
+      ret = SQLMoreResults(odbc->stmt);
+      if (ret==SQL_NO_DATA) return FALSE;
    }
 
-   ret = SQLMoreResults(odbc->stmt);
-   if (ret==SQL_NO_DATA) return FALSE;
+   dbrelay_odbc_bind_cols(odbc);
    return TRUE;
 }
 int dbrelay_odbc_numcols(void *db)
 {
    odbc_db_t *odbc = (odbc_db_t *) db;
-   SQLRETURN ret;
-   SQLSMALLINT numcols;
 
-   ret = SQLNumResultCols(odbc->stmt, &numcols);
-   return numcols;
+   return odbc->numcols;
 }
 char *dbrelay_odbc_colname(void *db, int colnum)
 {
    odbc_db_t *odbc = (odbc_db_t *) db;
-   SQLSMALLINT namelen;
-   char tmpbuf[256];
-
-   SQLDescribeCol(odbc->stmt, colnum, (SQLCHAR *) odbc->tmpbuf, 256, &namelen, NULL, NULL, NULL, NULL); 
-   tmpbuf[namelen]='\0';
 
-   return odbc->tmpbuf;
+   return odbc->cols[colnum-1].name;
 }
 void dbrelay_odbc_coltype(void *db, int colnum, char *dest)
 {
    odbc_db_t *odbc = (odbc_db_t *) db;
-   SQLSMALLINT coltype;
-   SQLULEN collen;
-   
-   SQLDescribeCol(odbc->stmt, colnum, NULL, 0, NULL, &coltype, &collen, NULL, NULL); 
-   dbrelay_odbc_get_sqltype_string(dest, coltype, collen);
+   odbc_col_t *col = &odbc->cols[colnum-1];
+
+   dbrelay_odbc_get_sqltype_string(dest, col->type, col->size);
+}
+/*
+ * read an unbound column of the current row in pieces, growing the
+ * buffer as needed. Returns SQL_NULL_DATA for NULLs.
+ */
+static SQLLEN dbrelay_odbc_get_long(odbc_db_t *odbc, int colnum)
+{
+   odbc_col_t *col = &odbc->cols[colnum-1];
+   SQLRETURN ret;
+   SQLLEN ind, len = 0;
+
+   if (col->loaded) return col->len;
+   col->loaded = 1;
+
+   for (;;) {
+      if (col->valsz - len < DBRELAY_ODBC_PIECE) {
+         col->valsz = col->valsz * 2 + DBRELAY_ODBC_PIECE;
+         col->value = (char *) realloc(col->value, col->valsz);
+      }
+      ret = SQLGetData(odbc->stmt, colnum, SQL_C_CHAR, col->value + len, col->valsz - len, &ind);
+      if (ret==SQL_NO_DATA) break;
+      if (!SQL_SUCCEEDED(ret)) {
+         dbrelay_odbc_get_error(odbc);
+         break;
+      }
+      if (ind==SQL_NULL_DATA) {
+         col->len = SQL_NULL_DATA;
+         return col->len;
+      }
+      /* last piece, ind is what was left */
+      if (ret==SQL_SUCCESS && ind!=SQL_NO_TOTAL) {
+         len += ind;
+         break;
+      }
+      /* buffer filled less the terminator */
+      len = col->valsz - 1;
+   }
+   col->value[len]='\0';
+   col->len = len;
+   return col->len;
 }
 int dbrelay_odbc_collen(void *db, int colnum)
 {
    odbc_db_t *odbc = (odbc_db_t *) db;
-   SQLULEN collen;
+   odbc_col_t *col = &odbc->cols[colnum-1];
+   SQLLEN len;
 
-   SQLDescribeCol(odbc->stmt, colnum, NULL, 0, NULL, NULL, &collen, NULL, NULL); 
+   /* before the first fetch, the declared size */
+   if (odbc->row < 0) return col->size;
 
-   return collen;
+   if (col->data) {
+      len = col->ind[odbc->row];
+      if (len==SQL_NULL_DATA) return 0;
+      if (len==SQL_NO_TOTAL || len >= col->width) return col->width;
+      return len + 1;
+   }
+   len = dbrelay_odbc_get_long(odbc, colnum);
+   if (len==SQL_NULL_DATA) return 0;
+   return len + 1;
 }
 int dbrelay_odbc_colprec(void *db, int colnum)
 {
    odbc_db_t *odbc = (odbc_db_t *) db;
-   SQLSMALLINT coltype;
-   SQLULEN collen;
-   
-   SQLDescribeCol(odbc->stmt, colnum, NULL, 0, NULL, &coltype, &collen, NULL, NULL); 
-   if (dbrelay_odbc_has_prec(coltype)) {
-       return collen;
+   odbc_col_t *col = &odbc->cols[colnum-1];
+
+   if (dbrelay_odbc_has_prec(col->type)) {
+       return col->size;
     }
     return 0;
 }
 int dbrelay_odbc_colscale(void *db, int colnum)
 {
    odbc_db_t *odbc = (odbc_db_t *) db;
-   SQLSMALLINT digits;
 
-   SQLDescribeCol(odbc->stmt, colnum, NULL, 0, NULL, NULL, NULL, &digits, NULL); 
-   return digits;
+   return odbc->cols[colnum-1].digits;
 }
 int dbrelay_odbc_fetch_row(void *db)
 {
    odbc_db_t *odbc = (odbc_db_t *) db;
    SQLRETURN ret;
+   int i;
 
-   ret = SQLFetch(odbc->stmt);
-   if (SQL_SUCCEEDED(ret)) return TRUE;
-   return FALSE;
+   for (i=0; i<odbc->numcols; i++) odbc->cols[i].loaded = 0;
+
+   /* step through the block, fetching the next one when it runs out */
+   for (;;) {
+      odbc->row++;
+      if (odbc->row >= (SQLLEN) odbc->fetched) {
+         odbc->fetched = 0;
+         odbc->row = -1;
+         ret = SQLFetch(odbc->stmt);
+         if (!SQL_SUCCEEDED(ret) || odbc->fetched==0) return FALSE;
+         odbc->row = 0;
+      }
+      if (odbc->status[odbc->row]!=SQL_ROW_ERROR && odbc->status[odbc->row]!=SQL_ROW_NOROW)
+         return TRUE;
+   }
 }
 char *dbrelay_odbc_colvalue(void *db, int colnum, char *dest)
 {
    odbc_db_t *odbc = (odbc_db_t *) db;
-   SQLLEN null;
+   odbc_col_t *col = &odbc->cols[colnum-1];
+   SQLLEN len;
 
-   SQLGetData(odbc->stmt, colnum, SQL_C_CHAR, dest, 256, &null);
-   if (null==SQL_NULL_DATA) return NULL;
+   if (col->data) {
+      len = col->ind[odbc->row];
+      if (len==SQL_NULL_DATA) return NULL;
+      if (len==SQL_NO_TOTAL || len >= col->width) len = col->width - 1;
+      memcpy(dest, col->data + col->width * odbc->row, len);
+   } else {
+      len = dbrelay_odbc_get_long(odbc, colnum);
+      if (len==SQL_NULL_DATA) return NULL;
+      memcpy(dest, col->value, len);
+   }
+   dest[len]='\0';
 
    return dest;
 }
+/*
+ * bound columns are handed out straight from the block arrays, so a batch
+ * ends with the block it started in. With unbound columns the rowset is
+ * a single row, then everything is copied instead.
+ */
+int dbrelay_odbc_fetch_batch(void *db, dbrelay_batch_t *batch)
+{
+   odbc_db_t *odbc = (odbc_db_t *) db;
+   odbc_col_t *col;
+   SQLLEN len;
+   int c, r;
+   int copy = odbc->numcols && !odbc->cols[odbc->numcols-1].data;
+
+   dbrelay_batch_reset(batch);
+   while (batch->rows < batch->maxrows) {
+      if (!copy && batch->rows && odbc->row + 1 >= (SQLLEN) odbc->fetched) break;
+      if (!dbrelay_odbc_fetch_row(db)) break;
+      r = batch->rows++;
+      for (c=0; c<odbc->numcols; c++) {
+         col = &odbc->cols[c];
+         if (col->data) {
+            len = col->ind[odbc->row];
+            if (len==SQL_NULL_DATA) {
+               dbrelay_batch_set(batch, c, r, NULL, 0);
+               continue;
+            }
+            if (len==SQL_NO_TOTAL || len >= col->width) len = col->width - 1;
+            if (copy) dbrelay_batch_copy(batch, c, r, col->data + col->width * odbc->row, len);
+            else dbrelay_batch_set(batch, c, r, col->data + col->width * odbc->row, len);
+         } else {
+            len = dbrelay_odbc_get_long(odbc, c + 1);
+            dbrelay_batch_copy(batch, c, r, len==SQL_NULL_DATA ? NULL : col->value, len);
+         }
+      }
+   }
+   return batch->rows;
+}
 
 static void dbrelay_odbc_get_error(void *db)
 {
    odbc_db_t *odbc = (odbc_db_t *) db;
-   SQLCHAR sqlstate[6];
+   SQLCHAR sqlstate[6] = "";
    SQLINTEGER errnum;
 
    SQLGetDiagRec(SQL_HANDLE_STMT, odbc->stmt, 1, sqlstate, &errnum, odbc->error_message, sizeof(odbc->error_message)-1, NULL);
+   /* SQL_ATTR_QUERY_TIMEOUT expired */
+   if (odbc->request && !strcmp((char *) sqlstate, "HYT00")) odbc->request->timed_out = 1;
 }
 
 char *dbrelay_odbc_error(void *db)
@@ -388,3 +722,10 @@ int dbrelay_odbc_isalive(void *db)
    /* XXX - stub for now */
    return 1;
 }
+int dbrelay_odbc_cancel(void *db)
+{
+   odbc_db_t *odbc = (odbc_db_t *) db;
+
+   if (!odbc || !odbc->stmt) return FALSE;
+   return SQL_SUCCEEDED(SQLCancel(odbc->stmt));
+}
@@ -0,0 +1,264 @@
+/*
+ * DB Relay is an HTTP module built on the NGiNX webserver platform which 
+ * communicates with a variety of database servers and returns JSON formatted 
+ * data.
+ * 
+ * Copyright (C) 2008-2010 Getco LLC
+ * 
+ * This program is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by the Free 
+ * Software Foundation, either version 3 of the License, or (at your option) 
+ * any later version. In addition, redistributions in source code and in binary 
+ * form must 
+ * include the above copyright notices, and each of the following disclaimers. 
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS “AS IS” 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANY COPYRIGHT OWNERS OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Placeholder substitution for parameterized queries. The statement is 
+ * tokenized once, skipping string literals, quoted identifiers and 
+ * comments, the size of the result is worked out up front and the new 
+ * statement is written into a single buffer.
+ *
+ * The same tokenizer produces query fingerprints for the query log.
+ */
+
+#include <ctype.h>
+#include "dbrelay.h"
+
+typedef struct {
+   size_t pos;        /* offset of the '?' in the original sql */
+   char *value;
+   size_t len;
+   int quoted;
+} dbrelay_hole_t;
+
+static char *quoted_types[] = { "char", "varchar", "datetime", "smalldatetime", NULL };
+
+/* params are "type:value", character and date types get single quotes */
+static int
+is_quoted_type(char *param, size_t typelen)
+{
+   int i;
+
+   for (i=0; quoted_types[i]; i++) {
+      if (strlen(quoted_types[i])==typelen && !strncasecmp(param, quoted_types[i], typelen))
+         return 1;
+   }
+   return 0;
+}
+/* 
+ * returns the offset of the character ending the token starting at sql[i],
+ * or i itself for anything that isn't a literal or comment
+ */
+static size_t
+skip_token(char *sql, size_t i, size_t len)
+{
+   char *s;
+
+   switch (sql[i]) {
+      case '\'':
+      case '"':
+         /* a doubled quote just ends one literal and starts the next */
+         s = memchr(&sql[i+1], sql[i], len - i - 1);
+         return s ? (size_t) (s - sql) : len - 1;
+      case '-':
+         if (i + 1 < len && sql[i+1]=='-') {
+            s = memchr(&sql[i], '\n', len - i);
+            return s ? (size_t) (s - sql) : len - 1;
+         }
+         break;
+      case '/':
+         if (i + 1 < len && sql[i+1]=='*') {
+            s = strstr(&sql[i+2], "*/");
+            return s ? (size_t) (s - sql) + 1 : len - 1;
+         }
+         break;
+   }
+   return i;
+}
+/*
+ * Substitute params (a NULL terminated array of "type:value" strings) 
+ * for the ? placeholders in sql, in order. Params without a placeholder
+ * left are ignored. prefix, if set, is prepended to the result. 
+ * Returns a malloc'd string.
+ */
+char *
+dbrelay_sql_bind_params(char *sql, char **params, char *prefix)
+{
+   size_t len = strlen(sql);
+   size_t prefixlen = prefix ? strlen(prefix) : 0;
+   size_t nparams = 0, nholes = 0;
+   size_t i, prev, outlen;
+   dbrelay_hole_t *holes = NULL;
+   char *colon, *out, *o;
+
+   while (params && params[nparams]) nparams++;
+   if (nparams) holes = (dbrelay_hole_t *) malloc(sizeof(dbrelay_hole_t) * nparams);
+
+   for (i=0; i<len && nholes<nparams; i++) {
+      if (sql[i]=='?') holes[nholes++].pos = i;
+      else i = skip_token(sql, i, len);
+   }
+
+   outlen = prefixlen + len;
+   for (i=0; i<nholes; i++) {
+      colon = strchr(params[i], ':');
+      if (colon) {
+         holes[i].value = colon + 1;
+         holes[i].quoted = is_quoted_type(params[i], colon - params[i]);
+      } else {
+         holes[i].value = params[i];
+         holes[i].quoted = 0;
+      }
+      holes[i].len = strlen(holes[i].value);
+      outlen += holes[i].len - 1 + (holes[i].quoted ? 2 : 0);
+   }
+
+   o = out = (char *) malloc(outlen + 1);
+   if (prefixlen) {
+      memcpy(o, prefix, prefixlen);
+      o += prefixlen;
+   }
+   prev = 0;
+   for (i=0; i<nholes; i++) {
+      memcpy(o, &sql[prev], holes[i].pos - prev);
+      o += holes[i].pos - prev;
+      if (holes[i].quoted) *o++ = '\'';
+      memcpy(o, holes[i].value, holes[i].len);
+      o += holes[i].len;
+      if (holes[i].quoted) *o++ = '\'';
+      prev = holes[i].pos + 1;
+   }
+   memcpy(o, &sql[prev], len - prev);
+   o += len - prev;
+   *o = '\0';
+
+   if (holes) free(holes);
+   return out;
+}
+
+typedef struct {
+   unsigned long long hash;
+   char *norm;
+   size_t normsz;
+   size_t normlen;
+   char last;          /* last character emitted */
+   int space;          /* whitespace seen since then */
+   int comma;          /* a ',' following a literal, held back */
+} dbrelay_fingerprint_t;
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+static int
+is_word_char(char c)
+{
+   return isalnum((unsigned char) c) || c=='_' || c=='@' || c=='#' || c=='$';
+}
+static void
+fingerprint_put(dbrelay_fingerprint_t *fp, char c)
+{
+   fp->hash = (fp->hash ^ (unsigned char) c) * FNV_PRIME;
+   if (fp->norm && fp->normlen + 1 < fp->normsz) fp->norm[fp->normlen++] = c;
+   fp->last = c;
+}
+/* emit c, keeping a single space only where two words would run together */
+static void
+fingerprint_emit(dbrelay_fingerprint_t *fp, char c)
+{
+   if (fp->comma) {
+      fingerprint_put(fp, ',');
+      fp->comma = 0;
+   }
+   if ((fp->space || fp->last=='?') && fp->last && (is_word_char(fp->last) || fp->last=='?' || fp->last=='"') 
+       && (is_word_char(c) || c=='?' || c=='"'))
+      fingerprint_put(fp, ' ');
+   fp->space = 0;
+   fingerprint_put(fp, c);
+}
+/* a literal, runs of literals separated by commas fold into one ? */
+static void
+fingerprint_literal(dbrelay_fingerprint_t *fp)
+{
+   if (fp->comma) {
+      fp->comma = 0;
+      fp->space = 0;
+      return;
+   }
+   fingerprint_emit(fp, '?');
+}
+/*
+ * Normalized form of a statement used to group executions of the same 
+ * query: string and numeric literals and placeholders become ?, lists of
+ * them fold to a single ?, comments are dropped, whitespace is collapsed 
+ * and everything outside double quotes is lowercased. Up to normsz - 1 
+ * characters of it are copied to norm if that is set.
+ * Returns a 64 bit FNV-1a hash of the normalized text.
+ */
+unsigned long long
+dbrelay_sql_fingerprint(char *sql, char *norm, size_t normsz)
+{
+   dbrelay_fingerprint_t fp;
+   size_t len = strlen(sql);
+   size_t i, end;
+   int prev_word = 0;
+
+   memset(&fp, 0, sizeof(fp));
+   fp.hash = FNV_OFFSET;
+   fp.norm = norm;
+   fp.normsz = normsz;
+
+   for (i=0; i<len; i++) {
+      end = skip_token(sql, i, len);
+      if (end!=i) {
+         /* 'it''s' is one literal */
+         if (sql[i]=='\'') {
+            while (end + 1 < len && sql[end+1]=='\'') end = skip_token(sql, end + 1, len);
+            fingerprint_literal(&fp);
+         }
+         else if (sql[i]=='"') {
+            for (; i<=end; i++) fingerprint_emit(&fp, sql[i]);
+         } else fp.space = 1;     /* comment */
+         i = end;
+         prev_word = 0;
+      } else if (isspace((unsigned char) sql[i])) {
+         fp.space = 1;
+         prev_word = 0;
+      } else if (sql[i]=='?' || (!prev_word && isdigit((unsigned char) sql[i]))) {
+         if (sql[i]!='?')
+            while (i + 1 < len && (isalnum((unsigned char) sql[i+1]) || sql[i+1]=='.')) i++;
+         fingerprint_literal(&fp);
+         prev_word = 0;
+      } else if (sql[i]==',' && fp.last=='?' && !fp.comma) {
+         fp.comma = 1;
+         fp.space = 0;
+         prev_word = 0;
+      } else {
+         fingerprint_emit(&fp, tolower((unsigned char) sql[i]));
+         prev_word = is_word_char(sql[i]);
+      }
+   }
+   if (fp.comma) fingerprint_put(&fp, ',');
+   if (norm && normsz) norm[fp.normlen] = '\0';
+
+   return fp.hash;
+}
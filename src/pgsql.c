@@ -0,0 +1,1188 @@
+/*
+ * DB Relay is an HTTP module built on the NGiNX webserver platform which 
+ * communicates with a variety of database servers and returns JSON formatted 
+ * data.
+ * 
+ * Copyright (C) 2008-2010 Getco LLC
+ * 
+ * This program is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by the Free 
+ * Software Foundation, either version 3 of the License, or (at your option) 
+ * any later version. In addition, redistributions in source code and in binary 
+ * form must 
+ * include the above copyright notices, and each of the following disclaimers. 
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS “AS IS” 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANY COPYRIGHT OWNERS OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * PostgreSQL driver on libpq.  Statements go out in pipeline mode, one
+ * extended protocol query each, and come back a row (or a chunk of rows)
+ * at a time so large results are never held whole.  Numeric, temporal
+ * and text columns are fetched in binary once a statement has been seen
+ * to return only types decoded here.
+ */
+
+#include <poll.h>
+#include <errno.h>
+#include <ctype.h>
+#include <math.h>
+#include "stringbuf.h"
+#include "vpgsql.h"
+
+#define IS_SET(x) (x && strlen(x)>0)
+
+/* pgsql_format_t.binary */
+#define PGSQL_FMT_BINARY   1
+#define PGSQL_FMT_TEMPORAL 2  /* needs DateStyle ISO to match text output */
+#define PGSQL_FMT_UTC      4  /* timestamptz, needs TimeZone UTC */
+
+#define PGSQL_USECS_PER_DAY 86400000000LL
+
+dbrelay_dbapi_t dbrelay_pgsql_api = 
+{
+   &dbrelay_pgsql_init,
+   &dbrelay_pgsql_connect,
+   &dbrelay_pgsql_close,
+   &dbrelay_pgsql_assign_request,
+   &dbrelay_pgsql_is_quoted,
+   &dbrelay_pgsql_connected,
+   &dbrelay_pgsql_change_db,
+   &dbrelay_pgsql_exec,
+   &dbrelay_pgsql_rowcount,
+   &dbrelay_pgsql_has_results,
+   &dbrelay_pgsql_numcols,
+   &dbrelay_pgsql_colname,
+   &dbrelay_pgsql_coltype,
+   &dbrelay_pgsql_collen,
+   &dbrelay_pgsql_colprec,
+   &dbrelay_pgsql_colscale,
+   &dbrelay_pgsql_fetch_row,
+   &dbrelay_pgsql_colvalue,
+   &dbrelay_pgsql_error,
+   &dbrelay_pgsql_catalogsql,
+   &dbrelay_pgsql_isalive,
+   &dbrelay_pgsql_cancel,
+   NULL,
+   &dbrelay_pgsql_fetch_batch
+};
+
+/* there is no connection to hang a failed login's message on */
+static __thread char login_error[256];
+
+static void pgsql_set_error(pgsql_db_t *pg, char *msg)
+{
+   size_t len;
+
+   free(pg->error);
+   pg->error = strdup(msg ? msg : "");
+   len = strlen(pg->error);
+   while (len && (pg->error[len-1]=='\n' || pg->error[len-1]==' ')) pg->error[--len]='\0';
+}
+static unsigned int pgsql_uint16(const char *p)
+{
+   const unsigned char *u = (const unsigned char *) p;
+   return (u[0] << 8) | u[1];
+}
+static unsigned int pgsql_uint32(const char *p)
+{
+   const unsigned char *u = (const unsigned char *) p;
+   return ((unsigned int) u[0] << 24) | (u[1] << 16) | (u[2] << 8) | u[3];
+}
+static unsigned long long pgsql_uint64(const char *p)
+{
+   return ((unsigned long long) pgsql_uint32(p) << 32) | pgsql_uint32(p+4);
+}
+static unsigned long long pgsql_hash(char *s)
+{
+   unsigned long long h = 14695981039346656037ULL;
+
+   while (*s) {
+      h ^= (unsigned char) *s++;
+      h *= 1099511628211ULL;
+   }
+   return h ? h : 1;
+}
+static unsigned long long pgsql_types(PGresult *res)
+{
+   unsigned long long h = 14695981039346656037ULL;
+   int col;
+
+   for (col=0; col<PQnfields(res); col++) {
+      h ^= PQftype(res, col);
+      h *= 1099511628211ULL;
+   }
+   return h;
+}
+
+void dbrelay_pgsql_init()
+{
+}
+void *dbrelay_pgsql_connect(dbrelay_request_t *request)
+{
+   const char *keys[7], *values[7];
+   char appname[DBRELAY_NAME_SZ + sizeof("dbrelay ()")];
+   int n = 0;
+   PGconn *conn;
+   pgsql_db_t *pg;
+
+   snprintf(appname, sizeof(appname), "dbrelay (%s)", 
+      IS_SET(request->connection_name) ? request->connection_name : request->remote_addr);
+
+   keys[n] = "host"; values[n++] = request->sql_server;
+   if (IS_SET(request->sql_port)) { keys[n] = "port"; values[n++] = request->sql_port; }
+   if (IS_SET(request->sql_database)) { keys[n] = "dbname"; values[n++] = request->sql_database; }
+   keys[n] = "user"; values[n++] = request->sql_user;
+   if (IS_SET(request->sql_password)) { keys[n] = "password"; values[n++] = request->sql_password; }
+   keys[n] = "application_name"; values[n++] = appname;
+   keys[n] = NULL; values[n] = NULL;
+
+   conn = PQconnectdbParams(keys, values, 0);
+   if (!conn || PQstatus(conn)!=CONNECTION_OK) {
+      dbrelay_copy_string(login_error, conn ? PQerrorMessage(conn) : "out of memory", sizeof(login_error));
+      n = strlen(login_error);
+      if (n && login_error[n-1]=='\n') login_error[n-1]='\0';
+      PQfinish(conn);
+      return NULL;
+   }
+   /* sends are flushed by hand so a big batch can't wedge against the server */
+   PQsetnonblocking(conn, 1);
+
+   pg = (pgsql_db_t *) malloc(sizeof(pgsql_db_t));
+   memset(pg, 0, sizeof(pgsql_db_t));
+   pg->conn = conn;
+   pg->request = request;
+   pg->row = -1;
+   pg->affected = -1;
+
+   return (void *) pg;
+}
+/* results kept for a batch, single row mode gives one per row */
+static void pgsql_hold(pgsql_db_t *pg, PGresult *res)
+{
+   if (pg->nheld==pg->heldsz) {
+      pg->heldsz = pg->heldsz ? pg->heldsz * 2 : DBRELAY_BATCH_ROWS;
+      pg->held = (PGresult **) realloc(pg->held, sizeof(PGresult *) * pg->heldsz);
+   }
+   pg->held[pg->nheld++] = res;
+}
+static void pgsql_release(pgsql_db_t *pg)
+{
+   int i;
+
+   for (i=0; i<pg->nheld; i++) PQclear(pg->held[i]);
+   pg->nheld = 0;
+}
+/* done with the results of an exec */
+static void pgsql_done(pgsql_db_t *pg)
+{
+   pg->busy = 0;
+   pg->in_rows = 0;
+#ifdef LIBPQ_HAS_PIPELINING
+   if (pg->pipeline) PQexitPipelineMode(pg->conn);
+#endif
+   pg->pipeline = 0;
+   free(pg->hashes);
+   pg->hashes = NULL;
+   pg->nstmts = 0;
+}
+void dbrelay_pgsql_close(void *db)
+{
+   pgsql_db_t *pg = (pgsql_db_t *) db;
+
+   if (!pg) return;
+   if (pg->next) PQclear(pg->next);
+   if (pg->result) PQclear(pg->result);
+   pgsql_release(pg);
+   free(pg->held);
+   if (pg->conn) PQfinish(pg->conn);
+   free(pg->hashes);
+   free(pg->error);
+   free(pg);
+}
+void dbrelay_pgsql_assign_request(void *db, dbrelay_request_t *request)
+{
+   pgsql_db_t *pg = (pgsql_db_t *) db;
+
+   pg->request = request;
+}
+/* NaN and the infinities aren't JSON numbers */
+static int pgsql_is_special(pgsql_db_t *pg, int col)
+{
+   char *v = PQgetvalue(pg->result, pg->row, col);
+   int len = PQgetlength(pg->result, pg->row, col);
+   union { unsigned int i; float f; } f4;
+   union { unsigned long long i; double d; } f8;
+
+   if (PQfformat(pg->result, col)==0) 
+      return v[0]=='N' || v[0]=='I' || (v[0]=='-' && v[1]=='I');
+
+   switch (PQftype(pg->result, col)) {
+      case PGSQL_FLOAT4OID:
+         f4.i = pgsql_uint32(v);
+         return isnan(f4.f) || isinf(f4.f);
+      case PGSQL_FLOAT8OID:
+         f8.i = pgsql_uint64(v);
+         return isnan(f8.d) || isinf(f8.d);
+      case PGSQL_NUMERICOID:
+         return len>=8 && pgsql_uint16(v+4) >= 0xC000;
+   }
+   return 0;
+}
+int dbrelay_pgsql_is_quoted(void *db, int colnum)
+{
+   pgsql_db_t *pg = (pgsql_db_t *) db;
+
+   switch (PQftype(pg->result, colnum-1)) {
+      case PGSQL_BOOLOID:
+      case PGSQL_INT2OID:
+      case PGSQL_INT4OID:
+      case PGSQL_INT8OID:
+      case PGSQL_OIDOID:
+         return 0;
+      case PGSQL_FLOAT4OID:
+      case PGSQL_FLOAT8OID:
+      case PGSQL_NUMERICOID:
+         /* asked per column before the first row, specials are caught per row */
+         if (pg->row<0 || PQgetisnull(pg->result, pg->row, colnum-1)) return 0;
+         return pgsql_is_special(pg, colnum-1);
+   }
+   return 1;
+}
+int dbrelay_pgsql_connected(void *db)
+{
+   pgsql_db_t *pg = (pgsql_db_t *) db;
+
+   if (!pg || pg->conn==NULL) return FALSE;
+   return TRUE;
+}
+/* a PostgreSQL session can't switch databases, it is chosen at connect */
+int dbrelay_pgsql_change_db(void *db, char *database)
+{
+   pgsql_db_t *pg = (pgsql_db_t *) db;
+
+   if (!IS_SET(database) || !strcmp(PQdb(pg->conn), database)) return TRUE;
+   return FALSE;
+}
+/*
+ * cut a batch into statements at top level semicolons, the extended 
+ * protocol takes one at a time.  Statements holding nothing but 
+ * whitespace and comments are dropped.
+ */
+static int pgsql_is_ident(char c)
+{
+   return isalnum((unsigned char) c) || c=='_' || c=='$';
+}
+static int pgsql_split(char *sql, char **stmts)
+{
+   char *p = sql, *start = sql, *q;
+   int depth = 0, content = 0, escape, nest, n = 0;
+   size_t taglen;
+
+   while (*p) {
+      if (p[0]=='-' && p[1]=='-') {
+         while (*p && *p!='\n') p++;
+         continue;
+      }
+      if (p[0]=='/' && p[1]=='*') {
+         for (p+=2, nest=1; *p && nest; p++) {
+            if (p[0]=='/' && p[1]=='*') { nest++; p++; }
+            else if (p[0]=='*' && p[1]=='/') { nest--; p++; }
+         }
+         continue;
+      }
+      if (!isspace((unsigned char) *p) && *p!=';') content = 1;
+      if (*p=='\'') {
+         /* E'' strings take backslash escapes */
+         escape = p>sql && (p[-1]=='E' || p[-1]=='e') && (p-1==sql || !pgsql_is_ident(p[-2]));
+         for (p++; *p; p++) {
+            if (escape && *p=='\\' && p[1]) p++;
+            else if (*p=='\'' && p[1]=='\'') p++;
+            else if (*p=='\'') break;
+         }
+         if (*p) p++;
+         continue;
+      }
+      if (*p=='"') {
+         for (p++; *p && *p!='"'; p++);
+         if (*p) p++;
+         continue;
+      }
+      if (*p=='$' && (p==sql || !pgsql_is_ident(p[-1]))) {
+         /* $tag$ ... $tag$, but not a $1 parameter */
+         q = p+1;
+         if (isalpha((unsigned char) *q) || *q=='_') 
+            while (pgsql_is_ident(*q) && *q!='$') q++;
+         if (*q=='$') {
+            taglen = q - p + 1;
+            for (q++; *q && strncmp(q, p, taglen); q++);
+            p = *q ? q + taglen : q;
+            continue;
+         }
+      }
+      if (*p=='(') depth++;
+      else if (*p==')' && depth) depth--;
+      else if (*p==';' && !depth) {
+         *p = '\0';
+         if (content) stmts[n++] = start;
+         start = p+1;
+         content = 0;
+      }
+      p++;
+   }
+   if (content) stmts[n++] = start;
+
+   return n;
+}
+static int pgsql_iso_dates(pgsql_db_t *pg)
+{
+   const char *style = PQparameterStatus(pg->conn, "DateStyle");
+   const char *idt = PQparameterStatus(pg->conn, "integer_datetimes");
+
+   return style && !strncmp(style, "ISO", 3) && idt && !strcmp(idt, "on");
+}
+static int pgsql_utc(pgsql_db_t *pg)
+{
+   const char *tz = PQparameterStatus(pg->conn, "TimeZone");
+
+   return tz && (!strcmp(tz, "UTC") || !strcmp(tz, "Etc/UTC") || !strcmp(tz, "GMT"));
+}
+/* 
+ * result format for a statement, binary if it has run before and every 
+ * column was of a type decoded below, with output matching the text form
+ */
+static int pgsql_format(pgsql_db_t *pg, unsigned long long hash)
+{
+   pgsql_format_t *f = &pg->formats[hash % DBRELAY_PGSQL_FORMATS];
+
+   if (f->hash!=hash || !(f->binary & PGSQL_FMT_BINARY)) return 0;
+   if ((f->binary & PGSQL_FMT_TEMPORAL) && !pgsql_iso_dates(pg)) return 0;
+   if ((f->binary & PGSQL_FMT_UTC) && !pgsql_utc(pg)) return 0;
+   return 1;
+}
+/* PGSQL_FMT_* needed to fetch these columns in binary, 0 if not decoded here */
+static int pgsql_binary_flags(PGresult *res)
+{
+   int col, binary = PGSQL_FMT_BINARY;
+
+   for (col=0; col<PQnfields(res); col++) {
+      switch (PQftype(res, col)) {
+         case PGSQL_BOOLOID:
+         case PGSQL_BYTEAOID:
+         case PGSQL_NAMEOID:
+         case PGSQL_INT8OID:
+         case PGSQL_INT2OID:
+         case PGSQL_INT4OID:
+         case PGSQL_TEXTOID:
+         case PGSQL_OIDOID:
+         case PGSQL_JSONOID:
+         case PGSQL_FLOAT4OID:
+         case PGSQL_FLOAT8OID:
+         case PGSQL_BPCHAROID:
+         case PGSQL_VARCHAROID:
+         case PGSQL_NUMERICOID:
+         case PGSQL_UUIDOID:
+            break;
+         case PGSQL_TIMESTAMPTZOID:
+            binary |= PGSQL_FMT_UTC;
+            /* fall through */
+         case PGSQL_DATEOID:
+         case PGSQL_TIMEOID:
+         case PGSQL_TIMESTAMPOID:
+            binary |= PGSQL_FMT_TEMPORAL;
+            break;
+         default:
+            binary = 0;
+      }
+      if (!binary) break;
+   }
+   return binary;
+}
+static void pgsql_learn_format(pgsql_db_t *pg, PGresult *res)
+{
+   pgsql_format_t *f;
+   unsigned long long hash;
+
+   if (pg->stmt >= pg->nstmts || !PQnfields(res) || PQfformat(res, 0)!=0) return;
+   hash = pg->hashes[pg->stmt];
+   f = &pg->formats[hash % DBRELAY_PGSQL_FORMATS];
+   f->hash = hash;
+   f->types = pgsql_types(res);
+   f->binary = pgsql_binary_flags(res);
+}
+/*
+ * a binary result is only decodable if its columns are still the types
+ * the format was learned with, or at least ones decoded here. A table or 
+ * view changed since can bring back anything.
+ */
+static int pgsql_check_format(pgsql_db_t *pg, PGresult *res)
+{
+   pgsql_format_t *f;
+   int binary;
+
+   if (pg->stmt >= pg->nstmts || !PQnfields(res) || PQfformat(res, 0)==0) return TRUE;
+   f = &pg->formats[pg->hashes[pg->stmt] % DBRELAY_PGSQL_FORMATS];
+   if (f->hash==pg->hashes[pg->stmt] && f->types==pgsql_types(res)) return TRUE;
+
+   binary = pgsql_binary_flags(res);
+   if (!binary || ((binary & PGSQL_FMT_TEMPORAL) && !pgsql_iso_dates(pg)) || 
+       ((binary & PGSQL_FMT_UTC) && !pgsql_utc(pg))) return FALSE;
+   if (f->hash==pg->hashes[pg->stmt]) {
+      f->types = pgsql_types(res);
+      f->binary = binary;
+   }
+   return TRUE;
+}
+static void pgsql_forget_format(pgsql_db_t *pg)
+{
+   pgsql_format_t *f;
+
+   if (pg->stmt >= pg->nstmts) return;
+   f = &pg->formats[pg->hashes[pg->stmt] % DBRELAY_PGSQL_FORMATS];
+   if (f->hash==pg->hashes[pg->stmt]) f->binary = 0;
+}
+static void pgsql_row_mode(pgsql_db_t *pg)
+{
+#ifdef LIBPQ_HAS_CHUNK_MODE
+   PQsetChunkedRowsMode(pg->conn, DBRELAY_PGSQL_CHUNK_ROWS);
+#else
+   PQsetSingleRowMode(pg->conn);
+#endif
+}
+/*
+ * wait for the next result, waking up periodically to see if the client 
+ * went away or query_timeout passed, in which case the statement is 
+ * cancelled server side and the error comes back as its result.
+ */
+static int pgsql_wait(pgsql_db_t *pg)
+{
+   struct pollfd pfd;
+   int rc, cancelled = 0;
+
+   pfd.fd = PQsocket(pg->conn);
+   pfd.events = POLLIN;
+   while (PQisBusy(pg->conn)) {
+      rc = poll(&pfd, 1, DBRELAY_CANCEL_POLL * 1000);
+      if (rc==0) {
+         if (!cancelled && pg->request && 
+             (dbrelay_db_check_cancel(pg->request) || dbrelay_db_check_timeout(pg->request))) {
+            dbrelay_pgsql_cancel(pg);
+            cancelled = 1;
+         }
+         continue;
+      }
+      if (rc<0 && errno==EINTR) continue;
+      if (rc<0 || !PQconsumeInput(pg->conn)) return FALSE;
+   }
+   return TRUE;
+}
+static int pgsql_flush(pgsql_db_t *pg)
+{
+   struct pollfd pfd;
+   int rc;
+
+   pfd.fd = PQsocket(pg->conn);
+   pfd.events = POLLIN | POLLOUT;
+   while ((rc = PQflush(pg->conn))==1) {
+      if (poll(&pfd, 1, DBRELAY_CANCEL_POLL * 1000)<0 && errno!=EINTR) return FALSE;
+      if ((pfd.revents & POLLIN) && !PQconsumeInput(pg->conn)) return FALSE;
+   }
+   return rc==0;
+}
+/* 
+ * next result of the running exec, NULL at the end of each statement 
+ * in a pipeline and once everything has been read
+ */
+static PGresult *pgsql_result(pgsql_db_t *pg)
+{
+   PGresult *res;
+
+   if (pg->next) {
+      res = pg->next;
+      pg->next = NULL;
+      return res;
+   }
+   if (!pg->busy) return NULL;
+   if (pg->row_mode) {
+      pgsql_row_mode(pg);
+      pg->row_mode = 0;
+   }
+   if (!pgsql_wait(pg)) {
+      pgsql_set_error(pg, PQerrorMessage(pg->conn));
+      pgsql_done(pg);
+      return NULL;
+   }
+   res = PQgetResult(pg->conn);
+   if (!res) {
+      if (pg->pipeline) {
+         pg->stmt++;
+         pg->row_mode = 1;
+      } else pgsql_done(pg);
+   }
+   return res;
+}
+int dbrelay_pgsql_exec(void *db, char *sql)
+{
+   pgsql_db_t *pg = (pgsql_db_t *) db;
+   PGresult *res;
+   int sent = 0;
+#ifdef LIBPQ_HAS_PIPELINING
+   char *batch, *p, **stmts;
+   int i, n = 1;
+#endif
+
+   /* anything left over from the last query, e.g. after a cancel */
+   while (pg->busy && dbrelay_pgsql_has_results(db));
+   if (pg->result) PQclear(pg->result);
+   pg->result = NULL;
+   free(pg->error);
+   pg->error = NULL;
+   pg->stmt = 0;
+   if (pg->request) pg->request->failed = 0;
+
+#ifdef LIBPQ_HAS_PIPELINING
+   for (p = sql; *p; p++) if (*p==';') n++;
+   batch = strdup(sql);
+   stmts = (char **) malloc(n * sizeof(char *));
+   n = pgsql_split(batch, stmts);
+   if (n && PQenterPipelineMode(pg->conn)) {
+      pg->pipeline = 1;
+      pg->hashes = (unsigned long long *) malloc(n * sizeof(unsigned long long));
+      pg->nstmts = n;
+      for (i=0; i<n; i++) {
+         pg->hashes[i] = pgsql_hash(stmts[i]);
+         if (!PQsendQueryParams(pg->conn, stmts[i], 0, NULL, NULL, NULL, NULL, pgsql_format(pg, pg->hashes[i]))) break;
+      }
+      sent = i==n && PQpipelineSync(pg->conn);
+   }
+   free(stmts);
+   free(batch);
+   if (!pg->pipeline)
+#endif
+   sent = PQsendQuery(pg->conn, sql);
+
+   pg->busy = 1;
+   pg->row_mode = 1;
+   if (!sent || !pgsql_flush(pg)) {
+      pgsql_set_error(pg, PQerrorMessage(pg->conn));
+      pgsql_done(pg);
+      return FALSE;
+   }
+
+   /* wait for the first statement, the rest is read by has_results */
+   res = pgsql_result(pg);
+   if (!res) return FALSE;
+   if (PQresultStatus(res)==PGRES_FATAL_ERROR) {
+      pgsql_set_error(pg, PQresultErrorMessage(res));
+      PQclear(res);
+      while (pg->busy && dbrelay_pgsql_has_results(db));
+      return FALSE;
+   }
+   pg->next = res;
+
+   return TRUE;
+}
+int dbrelay_pgsql_rowcount(void *db)
+{
+   pgsql_db_t *pg = (pgsql_db_t *) db;
+
+   if (pg->result && PQnfields(pg->result)) return pg->rows;
+   return pg->affected;
+}
+/* 
+ * a statement failed after the first, or came back in a format that 
+ * can't be decoded. The batch runs as one implicit transaction, so on a 
+ * server error what came before is rolled back too, and the request is 
+ * marked failed rather than answered with the earlier rows.
+ */
+static void pgsql_statement_error(pgsql_db_t *pg, char *msg)
+{
+   pgsql_set_error(pg, msg);
+   if (pg->request) {
+      dbrelay_log_warn(pg->request, "statement %d failed: %s", pg->stmt + 1, pg->error);
+      pg->request->failed = 1;
+   }
+   pg->in_rows = 0;
+}
+/* read through the remaining rows of the current statement */
+static void pgsql_skip_rows(pgsql_db_t *pg)
+{
+   PGresult *res;
+
+   while (pg->in_rows && (res = pgsql_result(pg))) {
+      switch (PQresultStatus(res)) {
+         case PGRES_SINGLE_TUPLE:
+#ifdef LIBPQ_HAS_CHUNK_MODE
+         case PGRES_TUPLES_CHUNK:
+#endif
+            break;
+         case PGRES_TUPLES_OK:
+            pg->in_rows = 0;
+            break;
+         default:
+            pgsql_statement_error(pg, PQresultErrorMessage(res));
+      }
+      PQclear(res);
+   }
+   pg->in_rows = 0;
+}
+int dbrelay_pgsql_has_results(void *db)
+{
+   pgsql_db_t *pg = (pgsql_db_t *) db;
+   PGresult *res;
+   char *buf;
+
+   pgsql_skip_rows(pg);
+   pgsql_release(pg);
+   if (pg->result) PQclear(pg->result);
+   pg->result = NULL;
+   pg->row = -1;
+   pg->ntuples = 0;
+   pg->rows = 0;
+   pg->affected = -1;
+
+   for (;;) {
+      if (!(res = pgsql_result(pg))) {
+         if (!pg->busy) return FALSE;
+         continue;
+      }
+      switch (PQresultStatus(res)) {
+         case PGRES_SINGLE_TUPLE:
+#ifdef LIBPQ_HAS_CHUNK_MODE
+         case PGRES_TUPLES_CHUNK:
+#endif
+            pg->in_rows = 1;
+            /* fall through */
+         case PGRES_TUPLES_OK:
+            if (!pgsql_check_format(pg, res)) {
+               PQclear(res);
+               pgsql_skip_rows(pg);
+               pgsql_forget_format(pg);
+               pgsql_statement_error(pg, "column types changed since the statement last ran, please retry");
+               continue;
+            }
+            pg->result = res;
+            pg->ntuples = PQntuples(res);
+            pgsql_learn_format(pg, res);
+            return TRUE;
+         case PGRES_COMMAND_OK:
+            pg->result = res;
+            if (*PQcmdTuples(res)) pg->affected = atol(PQcmdTuples(res));
+            return TRUE;
+#ifdef LIBPQ_HAS_PIPELINING
+         case PGRES_PIPELINE_SYNC:
+            PQclear(res);
+            pgsql_done(pg);
+            return FALSE;
+         case PGRES_PIPELINE_ABORTED:
+#endif
+         case PGRES_EMPTY_QUERY:
+            break;
+         /* COPY has no place in a JSON response, refuse it and move on */
+         case PGRES_COPY_IN:
+            PQputCopyEnd(pg->conn, "COPY FROM STDIN is not supported");
+            break;
+         case PGRES_COPY_OUT:
+            while (PQgetCopyData(pg->conn, &buf, 0)>0) PQfreemem(buf);
+            break;
+         default:
+            pgsql_statement_error(pg, PQresultErrorMessage(res));
+      }
+      PQclear(res);
+   }
+}
+int dbrelay_pgsql_numcols(void *db)
+{
+   pgsql_db_t *pg = (pgsql_db_t *) db;
+
+   return pg->result ? PQnfields(pg->result) : 0;
+}
+char *dbrelay_pgsql_colname(void *db, int colnum)
+{
+   pgsql_db_t *pg = (pgsql_db_t *) db;
+
+   return PQfname(pg->result, colnum-1);
+}
+static char *pgsql_get_sqltype_string(char *dest, Oid type)
+{
+   switch (type) {
+      case PGSQL_BOOLOID: strcpy(dest, "bool"); break;
+      case PGSQL_BYTEAOID: strcpy(dest, "bytea"); break;
+      case PGSQL_CHAROID: strcpy(dest, "char"); break;
+      case PGSQL_NAMEOID: strcpy(dest, "name"); break;
+      case PGSQL_INT8OID: strcpy(dest, "int8"); break;
+      case PGSQL_INT2OID: strcpy(dest, "int2"); break;
+      case PGSQL_INT4OID: strcpy(dest, "int4"); break;
+      case PGSQL_TEXTOID: strcpy(dest, "text"); break;
+      case PGSQL_OIDOID: strcpy(dest, "oid"); break;
+      case PGSQL_JSONOID: strcpy(dest, "json"); break;
+      case PGSQL_FLOAT4OID: strcpy(dest, "float4"); break;
+      case PGSQL_FLOAT8OID: strcpy(dest, "float8"); break;
+      case PGSQL_BPCHAROID: strcpy(dest, "char"); break;
+      case PGSQL_VARCHAROID: strcpy(dest, "varchar"); break;
+      case PGSQL_DATEOID: strcpy(dest, "date"); break;
+      case PGSQL_TIMEOID: strcpy(dest, "time"); break;
+      case PGSQL_TIMESTAMPOID: strcpy(dest, "timestamp"); break;
+      case PGSQL_TIMESTAMPTZOID: strcpy(dest, "timestamptz"); break;
+      case PGSQL_NUMERICOID: strcpy(dest, "numeric"); break;
+      case PGSQL_UUIDOID: strcpy(dest, "uuid"); break;
+      case PGSQL_JSONBOID: strcpy(dest, "jsonb"); break;
+      default: sprintf(dest, "oid %u", type);
+   }
+   return dest;
+}
+void dbrelay_pgsql_coltype(void *db, int colnum, char *dest)
+{
+   pgsql_db_t *pg = (pgsql_db_t *) db;
+
+   pgsql_get_sqltype_string(dest, PQftype(pg->result, colnum-1));
+}
+/*
+ * declared length for the column list, then for sizing colvalue's buffer 
+ * once a row is current, the decoded value can be longer than the binary
+ */
+int dbrelay_pgsql_collen(void *db, int colnum)
+{
+   pgsql_db_t *pg = (pgsql_db_t *) db;
+   int col = colnum-1, len, fmod, weight;
+   char *v;
+
+   if (pg->row<0 || pg->row>=pg->ntuples) {
+      if (PQfsize(pg->result, col)>0) return PQfsize(pg->result, col);
+      fmod = PQfmod(pg->result, col);
+      switch (PQftype(pg->result, col)) {
+         case PGSQL_BPCHAROID:
+         case PGSQL_VARCHAROID:
+            return fmod>=4 ? fmod - 4 : 0;
+      }
+      return 0;
+   }
+
+   len = PQgetlength(pg->result, pg->row, col);
+   if (PQfformat(pg->result, col)==0) return len + 1;
+
+   switch (PQftype(pg->result, col)) {
+      case PGSQL_NUMERICOID:
+         v = PQgetvalue(pg->result, pg->row, col);
+         if (len<8) return 64;
+         weight = (short) pgsql_uint16(v+2);
+         return (weight>0 ? weight+1 : 1) * 4 + pgsql_uint16(v+6) + 16;
+      case PGSQL_BYTEAOID:
+         return len * 2 + 3;
+   }
+   return len + 64;
+}
+int dbrelay_pgsql_colprec(void *db, int colnum)
+{
+   pgsql_db_t *pg = (pgsql_db_t *) db;
+   int fmod = PQfmod(pg->result, colnum-1);
+
+   if (PQftype(pg->result, colnum-1)!=PGSQL_NUMERICOID || fmod<4) return 0;
+   return ((fmod - 4) >> 16) & 0xffff;
+}
+int dbrelay_pgsql_colscale(void *db, int colnum)
+{
+   pgsql_db_t *pg = (pgsql_db_t *) db;
+   int fmod = PQfmod(pg->result, colnum-1);
+
+   if (PQftype(pg->result, colnum-1)!=PGSQL_NUMERICOID || fmod<4) return 0;
+   return (fmod - 4) & 0xffff;
+}
+int dbrelay_pgsql_fetch_row(void *db)
+{
+   pgsql_db_t *pg = (pgsql_db_t *) db;
+   PGresult *res;
+
+   if (!pg->result || !PQnfields(pg->result)) return FALSE;
+   if (++pg->row < pg->ntuples) {
+      pg->rows++;
+      return TRUE;
+   }
+
+   while (pg->in_rows && (res = pgsql_result(pg))) {
+      switch (PQresultStatus(res)) {
+         case PGRES_TUPLES_OK:
+            pg->in_rows = 0;
+            /* fall through */
+         case PGRES_SINGLE_TUPLE:
+#ifdef LIBPQ_HAS_CHUNK_MODE
+         case PGRES_TUPLES_CHUNK:
+#endif
+            if (pg->hold) pgsql_hold(pg, pg->result);
+            else PQclear(pg->result);
+            pg->result = res;
+            pg->row = 0;
+            pg->ntuples = PQntuples(res);
+            if (pg->ntuples) {
+               pg->rows++;
+               return TRUE;
+            }
+            break;
+         default:
+            pgsql_statement_error(pg, PQresultErrorMessage(res));
+            PQclear(res);
+      }
+   }
+   pg->in_rows = 0;
+   return FALSE;
+}
+/* shortest of digits..digits+2 significant digits that reads back the same */
+static void pgsql_float(char *dest, double d, int digits, int single)
+{
+   int p;
+
+   if (isnan(d)) {
+      strcpy(dest, "NaN");
+      return;
+   }
+   if (isinf(d)) {
+      strcpy(dest, d<0 ? "-Infinity" : "Infinity");
+      return;
+   }
+   for (p=digits; p<digits+2; p++) {
+      sprintf(dest, "%.*g", p, d);
+      if (single ? (float) strtod(dest, NULL)==(float) d : strtod(dest, NULL)==d) return;
+   }
+   sprintf(dest, "%.*g", p, d);
+}
+/* base 10000 digits, laid out as numeric_send() does */
+static void pgsql_numeric(char *dest, char *v, int len)
+{
+   int ndigits, weight, sign, dscale, d, dig;
+   char *p = dest, *end;
+
+   if (len<8) {
+      strcpy(dest, "NaN");
+      return;
+   }
+   ndigits = (short) pgsql_uint16(v);
+   weight = (short) pgsql_uint16(v+2);
+   sign = pgsql_uint16(v+4);
+   dscale = pgsql_uint16(v+6);
+   if (ndigits<0 || len < 8 + ndigits * 2) ndigits = 0;
+
+   switch (sign) {
+      case 0xC000: strcpy(dest, "NaN"); return;
+      case 0xD000: strcpy(dest, "Infinity"); return;
+      case 0xF000: strcpy(dest, "-Infinity"); return;
+      case 0x4000: *p++ = '-'; break;
+   }
+
+   if (weight<0) *p++ = '0';
+   for (d=0; d<=weight; d++) {
+      dig = d<ndigits ? pgsql_uint16(v + 8 + d*2) : 0;
+      p += sprintf(p, d ? "%04d" : "%d", dig);
+   }
+   if (dscale>0) {
+      *p++ = '.';
+      end = p + dscale;
+      for (d=weight+1; p<end; d++) {
+         dig = d>=0 && d<ndigits ? pgsql_uint16(v + 8 + d*2) : 0;
+         p += sprintf(p, "%04d", dig);
+      }
+      p = end;
+   }
+   *p = '\0';
+}
+/* days since 2000-01-01 as an ISO date, BC years are flagged for the caller */
+static char *pgsql_date(char *dest, long long days, int *bc)
+{
+   long long z = days + 10957 + 719468, era, doe, yoe, y, doy, mp, d, m;
+
+   era = (z>=0 ? z : z - 146096) / 146097;
+   doe = z - era * 146097;
+   yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+   y = yoe + era * 400;
+   doy = doe - (365*yoe + yoe/4 - yoe/100);
+   mp = (5*doy + 2) / 153;
+   d = doy - (153*mp + 2) / 5 + 1;
+   m = mp<10 ? mp + 3 : mp - 9;
+   if (m<=2) y++;
+
+   *bc = y<=0;
+   return dest + sprintf(dest, "%04lld-%02lld-%02lld", *bc ? 1 - y : y, m, d);
+}
+static char *pgsql_time(char *dest, long long usecs)
+{
+   char *p = dest + sprintf(dest, "%02lld:%02lld:%02lld", 
+      usecs / 3600000000LL, usecs / 60000000LL % 60, usecs / 1000000LL % 60);
+   int frac = usecs % 1000000LL;
+
+   if (frac) {
+      p += sprintf(p, ".%06d", frac);
+      while (p[-1]=='0') *--p = '\0';
+   }
+   return p;
+}
+static void pgsql_timestamp(char *dest, long long usecs, int tz)
+{
+   long long days;
+   int bc;
+   char *p;
+
+   if (usecs==0x7FFFFFFFFFFFFFFFLL) { strcpy(dest, "infinity"); return; }
+   if (usecs==(-0x7FFFFFFFFFFFFFFFLL - 1)) { strcpy(dest, "-infinity"); return; }
+
+   days = usecs / PGSQL_USECS_PER_DAY;
+   usecs %= PGSQL_USECS_PER_DAY;
+   if (usecs<0) {
+      usecs += PGSQL_USECS_PER_DAY;
+      days--;
+   }
+   p = pgsql_date(dest, days, &bc);
+   *p++ = ' ';
+   p = pgsql_time(p, usecs);
+   if (tz) p += sprintf(p, "+00");
+   if (bc) strcpy(p, " BC");
+}
+static char *pgsql_binary_value(pgsql_db_t *pg, int col, char *v, int len, char *dest)
+{
+   union { unsigned int i; float f; } f4;
+   union { unsigned long long i; double d; } f8;
+   int i, bc, days;
+   char *p;
+
+   switch (PQftype(pg->result, col)) {
+      case PGSQL_BOOLOID:
+         strcpy(dest, v[0] ? "true" : "false");
+         break;
+      case PGSQL_INT2OID:
+         sprintf(dest, "%d", (short) pgsql_uint16(v));
+         break;
+      case PGSQL_INT4OID:
+         sprintf(dest, "%d", (int) pgsql_uint32(v));
+         break;
+      case PGSQL_OIDOID:
+         sprintf(dest, "%u", pgsql_uint32(v));
+         break;
+      case PGSQL_INT8OID:
+         sprintf(dest, "%lld", (long long) pgsql_uint64(v));
+         break;
+      case PGSQL_FLOAT4OID:
+         f4.i = pgsql_uint32(v);
+         pgsql_float(dest, f4.f, 6, 1);
+         break;
+      case PGSQL_FLOAT8OID:
+         f8.i = pgsql_uint64(v);
+         pgsql_float(dest, f8.d, 15, 0);
+         break;
+      case PGSQL_NUMERICOID:
+         pgsql_numeric(dest, v, len);
+         break;
+      case PGSQL_DATEOID:
+         days = (int) pgsql_uint32(v);
+         if (days==0x7FFFFFFF) strcpy(dest, "infinity");
+         else if (days==(-0x7FFFFFFF - 1)) strcpy(dest, "-infinity");
+         else {
+            p = pgsql_date(dest, days, &bc);
+            if (bc) strcpy(p, " BC");
+         }
+         break;
+      case PGSQL_TIMEOID:
+         pgsql_time(dest, (long long) pgsql_uint64(v));
+         break;
+      case PGSQL_TIMESTAMPOID:
+      case PGSQL_TIMESTAMPTZOID:
+         pgsql_timestamp(dest, (long long) pgsql_uint64(v), PQftype(pg->result, col)==PGSQL_TIMESTAMPTZOID);
+         break;
+      case PGSQL_UUIDOID:
+         for (i=0, p=dest; i<16 && i<len; i++) {
+            if (i==4 || i==6 || i==8 || i==10) *p++ = '-';
+            p += sprintf(p, "%02x", (unsigned char) v[i]);
+         }
+         break;
+      case PGSQL_TEXTOID:
+      case PGSQL_VARCHAROID:
+      case PGSQL_BPCHAROID:
+      case PGSQL_NAMEOID:
+      case PGSQL_JSONOID:
+         memcpy(dest, v, len);
+         dest[len] = '\0';
+         break;
+      case PGSQL_BYTEAOID:
+      default:
+         p = dest + sprintf(dest, "\\x");
+         for (i=0; i<len; i++) p += sprintf(p, "%02x", (unsigned char) v[i]);
+         break;
+   }
+   return dest;
+}
+char *dbrelay_pgsql_colvalue(void *db, int colnum, char *dest)
+{
+   pgsql_db_t *pg = (pgsql_db_t *) db;
+   int col = colnum-1, len;
+   char *v;
+
+   if (PQgetisnull(pg->result, pg->row, col)) return NULL;
+
+   v = PQgetvalue(pg->result, pg->row, col);
+   len = PQgetlength(pg->result, pg->row, col);
+   if (PQfformat(pg->result, col)) return pgsql_binary_value(pg, col, v, len, dest);
+
+   if (PQftype(pg->result, col)==PGSQL_BOOLOID) {
+      strcpy(dest, v[0]=='t' ? "true" : "false");
+   } else {
+      memcpy(dest, v, len);
+      dest[len] = '\0';
+   }
+   return dest;
+}
+/*
+ * text values are handed out from the PGresults themselves, which are 
+ * held rather than cleared until the next batch. Binary ones are decoded 
+ * into the batch.
+ */
+int dbrelay_pgsql_fetch_batch(void *db, dbrelay_batch_t *batch)
+{
+   pgsql_db_t *pg = (pgsql_db_t *) db;
+   int col, r, len;
+   char *v;
+
+   dbrelay_batch_reset(batch);
+   pgsql_release(pg);
+   pg->hold = 1;
+   while (batch->rows < batch->maxrows) {
+      if (!dbrelay_pgsql_fetch_row(db)) break;
+      r = batch->rows++;
+      for (col=0; col<batch->numcols; col++) {
+         if (PQgetisnull(pg->result, pg->row, col)) {
+            dbrelay_batch_set(batch, col, r, NULL, 0);
+            continue;
+         }
+         v = PQgetvalue(pg->result, pg->row, col);
+         len = PQgetlength(pg->result, pg->row, col);
+         if (PQfformat(pg->result, col)) {
+            v = pgsql_binary_value(pg, col, v, len, dbrelay_batch_alloc(batch, dbrelay_pgsql_collen(db, col + 1)));
+            len = strlen(v);
+         } else if (PQftype(pg->result, col)==PGSQL_BOOLOID) {
+            v = v[0]=='t' ? "true" : "false";
+            len = strlen(v);
+         }
+         dbrelay_batch_set(batch, col, r, v, len);
+         if (!batch->quoted[col] && dbrelay_pgsql_is_quoted(db, col + 1)) dbrelay_batch_quote(batch, col, r);
+      }
+   }
+   pg->hold = 0;
+   return batch->rows;
+}
+
+char *dbrelay_pgsql_error(void *db)
+{
+   pgsql_db_t *pg = (pgsql_db_t *) db;
+
+   if (!pg) return login_error;
+   if (pg->error) return pg->error;
+   return PQerrorMessage(pg->conn);
+}
+
+/* 
+ * [schema.]table as given to cmd=columns/pkey, unquoted names are folded 
+ * to lower case the way the server does
+ */
+static void split_tablename(char *orig, char *schema, char *table)
+{
+   char *out = schema;
+   int quote = 0, dot = 0;
+
+   for (; *orig; orig++) {
+      if (*orig=='"') {
+         if (quote && orig[1]=='"') *out++ = *orig++;
+         else quote = !quote;
+      } else if (!quote && !dot && *orig=='.') {
+         *out = '\0';
+         out = table;
+         dot = 1;
+      } else if (*orig=='\'') {
+         *out++ = '\'';
+         *out++ = '\'';
+      } else {
+         *out++ = quote ? *orig : tolower((unsigned char) *orig);
+      }
+   }
+   *out = '\0';
+   if (!dot) {
+      strcpy(table, schema);
+      schema[0] = '\0';
+   }
+}
+char *dbrelay_pgsql_catalogsql(int dbcmd, char **params)
+{
+   char *sql, *schema, *table, *where;
+   char *columns_mask = "SELECT column_name AS \"COLUMN_NAME\", is_nullable AS \"IS_NULLABLE\", data_type AS \"DATA_TYPE\", character_maximum_length AS \"CHARACTER_MAXIMUM_LENGTH\", numeric_scale AS \"NUMERIC_SCALE\", CASE WHEN column_default IS NULL THEN 0 ELSE 1 END AS \"HAS_DEFAULT\", CASE WHEN is_identity = 'YES' OR column_default LIKE 'nextval(%%' THEN 1 ELSE 0 END AS \"IS_IDENTITY\" FROM information_schema.columns WHERE table_name = '%s' AND table_schema %s ORDER BY ordinal_position";
+   char *pkey_mask = "SELECT c.column_name AS \"COLUMN_NAME\" \
+FROM information_schema.table_constraints pk \
+JOIN information_schema.key_column_usage c \
+ON c.constraint_schema = pk.constraint_schema \
+AND c.constraint_name = pk.constraint_name \
+AND c.table_name = pk.table_name \
+WHERE pk.constraint_type = 'PRIMARY KEY' \
+AND pk.table_name = '%s' \
+AND pk.table_schema %s \
+ORDER BY c.ordinal_position";
+
+   switch (dbcmd) {
+      case DBRELAY_DBCMD_BEGIN:
+         return strdup("BEGIN");
+      case DBRELAY_DBCMD_COMMIT:
+         return strdup("COMMIT");
+      case DBRELAY_DBCMD_ROLLBACK:
+         return strdup("ROLLBACK");
+      case DBRELAY_DBCMD_TABLES:
+         return strdup("SELECT * FROM information_schema.tables WHERE table_type = 'BASE TABLE' AND table_schema NOT IN ('pg_catalog', 'information_schema')");
+      case DBRELAY_DBCMD_COLUMNS:
+      case DBRELAY_DBCMD_PKEY:
+         if (!params || !params[0]) return NULL;
+         schema = (char *) malloc(strlen(params[0])*2 + 1);
+         table = (char *) malloc(strlen(params[0])*2 + 1);
+         where = (char *) malloc(strlen(params[0])*2 + 40);
+         split_tablename(params[0], schema, table);
+         if (strlen(schema)) sprintf(where, "= '%s'", schema);
+         else strcpy(where, "= ANY (current_schemas(false))");
+         sql = dbcmd==DBRELAY_DBCMD_COLUMNS ? columns_mask : pkey_mask;
+         sql = malloc(strlen(sql) + strlen(table) + strlen(where) + 1);
+         sprintf(sql, dbcmd==DBRELAY_DBCMD_COLUMNS ? columns_mask : pkey_mask, table, where);
+         free(where);
+         free(table);
+         free(schema);
+         return sql;
+   }
+   return NULL;
+}
+
+int dbrelay_pgsql_isalive(void *db)
+{
+   pgsql_db_t *pg = (pgsql_db_t *) db;
+
+   return pg && pg->conn && PQstatus(pg->conn)==CONNECTION_OK;
+}
+int dbrelay_pgsql_cancel(void *db)
+{
+   pgsql_db_t *pg = (pgsql_db_t *) db;
+   PGcancel *cancel;
+   char errbuf[256];
+   int ret;
+
+   if (!pg || !pg->conn) return FALSE;
+   if (!(cancel = PQgetCancel(pg->conn))) return FALSE;
+   ret = PQcancel(cancel, errbuf, sizeof(errbuf));
+   PQfreeCancel(cancel);
+
+   return ret ? TRUE : FALSE;
+}
@@ -0,0 +1,267 @@
+/*
+ * DB Relay is an HTTP module built on the NGiNX webserver platform which 
+ * communicates with a variety of database servers and returns JSON formatted 
+ * data.
+ * 
+ * Copyright (C) 2008-2010 Getco LLC
+ * 
+ * This program is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by the Free 
+ * Software Foundation, either version 3 of the License, or (at your option) 
+ * any later version. In addition, redistributions in source code and in binary 
+ * form must 
+ * include the above copyright notices, and each of the following disclaimers. 
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS “AS IS” 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANY COPYRIGHT OWNERS OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Structured query log.  Requests drop a fixed size record into a ring in
+ * shared memory and go on, a single drainer at a time formats the records
+ * as JSON lines and writes them out in batches.  When the ring is full 
+ * records are dropped and counted rather than waited for.
+ *
+ * Each entry carries a state that encodes the lap of the ring it belongs
+ * to: 2*lap while free for the producer of that lap, 2*lap+1 once written.
+ * A zero filled segment is therefore an empty ring.
+ */
+
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <signal.h>
+#include "dbrelay.h"
+#include "../include/dbrelay_config.h"
+
+#define DBRELAY_QUERYLOG_ENTRIES 2048
+#define DBRELAY_QUERYLOG_ERR_SZ 256
+/* give up on an entry claimed by a producer that never finished it */
+#define DBRELAY_QUERYLOG_STALL 5
+
+typedef struct {
+   volatile unsigned long state;
+   struct timeval ts;
+   unsigned long long fingerprint;
+   char query_tag[DBRELAY_NAME_SZ];
+   char sql_server[DBRELAY_NAME_SZ];
+   char sql_database[DBRELAY_OBJ_SZ];
+   dbrelay_timings_t timings;
+   int err_class;
+   char error[DBRELAY_QUERYLOG_ERR_SZ];
+} dbrelay_querylog_entry_t;
+
+typedef struct {
+   volatile unsigned long head;
+   volatile unsigned long tail;
+   volatile pid_t drainer;
+   time_t stalled_since;
+   unsigned long sampled;
+   unsigned long dropped;
+   dbrelay_querylog_entry_t entries[DBRELAY_QUERYLOG_ENTRIES];
+} dbrelay_querylog_t;
+
+static dbrelay_querylog_t *ring;
+
+static key_t dbrelay_querylog_ipc_key()
+{
+   return ftok(DBRELAY_PREFIX, 3);
+}
+/* readers pass create=0 so a disabled log costs no segment */
+static dbrelay_querylog_t *dbrelay_querylog_get(int create)
+{
+   int shmid;
+   void *p;
+
+   if (ring) return ring;
+
+   shmid = shmget(dbrelay_querylog_ipc_key(), sizeof(dbrelay_querylog_t), (create ? IPC_CREAT : 0) | 0600);
+   if (shmid==-1) return NULL;
+   p = shmat(shmid, NULL, 0);
+   if (p==(void *) -1) return NULL;
+   ring = (dbrelay_querylog_t *) p;
+
+   return ring;
+}
+void dbrelay_querylog_destroy()
+{
+   int shmid;
+
+   if (ring) shmdt(ring);
+   ring = NULL;
+   shmid = shmget(dbrelay_querylog_ipc_key(), sizeof(dbrelay_querylog_t), 0600);
+   if (shmid!=-1) shmctl(shmid, IPC_RMID, NULL);
+}
+/*
+ * called once a request is answered, request->query_log_sample picks one
+ * in N successful queries, errors are always kept
+ */
+void dbrelay_querylog_append(dbrelay_request_t *request, int err_class, char *error)
+{
+   dbrelay_querylog_t *q;
+   dbrelay_querylog_entry_t *e;
+   unsigned long pos, lap, state;
+
+   if (!request->query_log_sample) return;
+   if (!(q = dbrelay_querylog_get(1))) return;
+
+   if (err_class==DBRELAY_ERR_NONE && request->query_log_sample > 1 &&
+       __sync_fetch_and_add(&q->sampled, 1) % request->query_log_sample)
+      return;
+
+   for (;;) {
+      pos = q->head;
+      e = &q->entries[pos % DBRELAY_QUERYLOG_ENTRIES];
+      lap = pos / DBRELAY_QUERYLOG_ENTRIES;
+      state = e->state;
+      if (state==2 * lap) {
+         if (__sync_bool_compare_and_swap(&q->head, pos, pos + 1)) break;
+      } else if (state < 2 * lap) {
+         /* the drainer is a full lap behind */
+         __sync_fetch_and_add(&q->dropped, 1);
+         return;
+      }
+   }
+
+   gettimeofday(&e->ts, NULL);
+   e->fingerprint = request->fingerprint;
+   dbrelay_copy_string(e->query_tag, request->query_tag, sizeof(e->query_tag));
+   dbrelay_copy_string(e->sql_server, request->sql_server, sizeof(e->sql_server));
+   dbrelay_copy_string(e->sql_database, request->sql_database, sizeof(e->sql_database));
+   memcpy(&e->timings, &request->timings, sizeof(e->timings));
+   e->err_class = err_class;
+   dbrelay_copy_string(e->error, error ? error : "", sizeof(e->error));
+   /* fails only if the drainer gave up waiting on us */
+   __sync_bool_compare_and_swap(&e->state, 2 * lap, 2 * lap + 1);
+}
+static char *dbrelay_querylog_escape(char *dest, char *src)
+{
+   for (; *src; src++) {
+      switch (*src) {
+         case '"':  *dest++ = '\\'; *dest++ = '"'; break;
+         case '\\': *dest++ = '\\'; *dest++ = '\\'; break;
+         case '\n': *dest++ = '\\'; *dest++ = 'n'; break;
+         case '\r': *dest++ = '\\'; *dest++ = 'r'; break;
+         case '\t': *dest++ = '\\'; *dest++ = 't'; break;
+         default:
+            if ((unsigned char) *src < 0x20) dest += sprintf(dest, "\\u%04x", *src);
+            else *dest++ = *src;
+      }
+   }
+   *dest = '\0';
+   return dest;
+}
+static size_t dbrelay_querylog_format(char *buf, dbrelay_querylog_entry_t *e)
+{
+   char *p = buf;
+   struct tm tm;
+
+   gmtime_r(&e->ts.tv_sec, &tm);
+   p += strftime(p, 32, "{\"ts\":\"%Y-%m-%dT%H:%M:%S", &tm);
+   p += sprintf(p, ".%03ldZ\",\"query_tag\":\"", (long) e->ts.tv_usec / 1000);
+   p = dbrelay_querylog_escape(p, e->query_tag);
+   p += sprintf(p, "\",\"fingerprint\":\"%016llx\",\"sql_server\":\"", e->fingerprint);
+   p = dbrelay_querylog_escape(p, e->sql_server);
+   p += sprintf(p, "\",\"sql_database\":\"");
+   p = dbrelay_querylog_escape(p, e->sql_database);
+   p += sprintf(p, "\",\"timings\":{\"shm_wait_us\":%lu,\"connect_us\":%lu,\"exec_us\":%lu,"
+      "\"fetch_us\":%lu,\"serialize_us\":%lu,\"total_us\":%lu},\"rows\":%lu,\"bytes\":%lu",
+      e->timings.shm_wait, e->timings.connect, e->timings.exec, e->timings.fetch,
+      e->timings.serialize, e->timings.total, e->timings.rows, e->timings.bytes);
+   if (e->err_class!=DBRELAY_ERR_NONE && e->err_class<DBRELAY_ERR_CLASSES) {
+      p += sprintf(p, ",\"error\":{\"class\":\"%s\",\"message\":\"", dbrelay_error_class_names[e->err_class]);
+      p = dbrelay_querylog_escape(p, e->error);
+      p += sprintf(p, "\"}");
+   }
+   p += sprintf(p, "}\n");
+
+   return p - buf;
+}
+static void dbrelay_querylog_write(int fd, char *buf, size_t len)
+{
+   ssize_t t;
+
+   while (len) {
+      t = write(fd, buf, len);
+      if (t<=0) return;
+      buf += t;
+      len -= t;
+   }
+}
+/*
+ * Write out whatever is ready to fd.  Only one process drains at a time,
+ * the rest return 0 straight away.  Returns the number of records written.
+ */
+int dbrelay_querylog_drain(int fd)
+{
+   dbrelay_querylog_t *q;
+   dbrelay_querylog_entry_t *e;
+   /* worst case every label character escaped as \uXXXX */
+   char line[(DBRELAY_NAME_SZ * 2 + DBRELAY_OBJ_SZ + DBRELAY_QUERYLOG_ERR_SZ) * 6 + 512];
+   char buf[65536];
+   size_t buflen = 0, len;
+   unsigned long pos, lap;
+   pid_t me = getpid(), holder;
+   int n = 0;
+
+   if (!(q = dbrelay_querylog_get(0))) return 0;
+
+   holder = q->drainer;
+   /* take over from a drainer that died holding the ring */
+   if (holder && holder!=me && kill(holder, 0)==-1)
+      __sync_bool_compare_and_swap(&q->drainer, holder, 0);
+   if (!__sync_bool_compare_and_swap(&q->drainer, 0, me)) return 0;
+
+   for (;;) {
+      pos = q->tail;
+      if (pos==q->head) break;
+      e = &q->entries[pos % DBRELAY_QUERYLOG_ENTRIES];
+      lap = pos / DBRELAY_QUERYLOG_ENTRIES;
+
+      if (e->state!=2 * lap + 1) {
+         /* claimed but not written yet */
+         if (!q->stalled_since) q->stalled_since = time(NULL);
+         if (time(NULL) - q->stalled_since < DBRELAY_QUERYLOG_STALL) break;
+         __sync_fetch_and_add(&q->dropped, 1);
+      } else {
+         len = dbrelay_querylog_format(line, e);
+         if (buflen + len > sizeof(buf)) {
+            dbrelay_querylog_write(fd, buf, buflen);
+            buflen = 0;
+         }
+         memcpy(&buf[buflen], line, len);
+         buflen += len;
+         n++;
+      }
+      q->stalled_since = 0;
+      __sync_synchronize();
+      e->state = 2 * (lap + 1);
+      q->tail = pos + 1;
+   }
+   if (buflen) dbrelay_querylog_write(fd, buf, buflen);
+
+   q->drainer = 0;
+   return n;
+}
+unsigned long dbrelay_querylog_dropped()
+{
+   dbrelay_querylog_t *q = dbrelay_querylog_get(0);
+
+   return q ? q->dropped : 0;
+}
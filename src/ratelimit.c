@@ -0,0 +1,316 @@
+/*
+ * DB Relay is an HTTP module built on the NGiNX webserver platform which 
+ * communicates with a variety of database servers and returns JSON formatted 
+ * data.
+ * 
+ * Copyright (C) 2008-2010 Getco LLC
+ * 
+ * This program is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by the Free 
+ * Software Foundation, either version 3 of the License, or (at your option) 
+ * any later version. In addition, redistributions in source code and in binary 
+ * form must 
+ * include the above copyright notices, and each of the following disclaimers. 
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS “AS IS” 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANY COPYRIGHT OWNERS OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Rate and concurrency limits per client, keyed on remote_addr, sql_user
+ * or query_tag as each location's dbrelay_rate_limit rules say.  Buckets
+ * live in a SysV segment shared by all workers, found by open addressing
+ * on the rule and key, and each is guarded by its own spinlock since the
+ * token count and refill time must change together.  Buckets idle long 
+ * enough to have refilled are reused for new keys; if none can be found
+ * the request goes unlimited rather than failing.
+ */
+
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/time.h>
+#include <sched.h>
+#include <signal.h>
+#include "dbrelay.h"
+#include "../include/dbrelay_config.h"
+
+#define DBRELAY_RATELIMIT_BUCKETS 4096
+/* slots looked at before giving up on a key */
+#define DBRELAY_RATELIMIT_PROBE 64
+/* secs a bucket with nothing running must sit unused to be reused */
+#define DBRELAY_RATELIMIT_IDLE 600
+
+/* tokens are kept in thousandths of a request */
+#define TOKEN 1000
+/* rates are per minute, the clock is in usecs */
+#define MINUTE 60000000UL
+
+#define BUCKET_FREE 0
+#define BUCKET_READY 1
+
+typedef struct {
+   volatile int lock;
+   volatile unsigned int state;
+   unsigned int hash;
+   unsigned int rule;
+   char key[DBRELAY_NAME_SZ];
+   unsigned long tokens;
+   unsigned long refilled;   /* usecs since the epoch */
+   time_t used;
+   int inflight;
+   pid_t holders[DBRELAY_RATELIMIT_CONCURRENCY];
+} dbrelay_bucket_t;
+
+typedef struct {
+   dbrelay_bucket_t buckets[DBRELAY_RATELIMIT_BUCKETS];
+} dbrelay_ratelimits_t;
+
+static dbrelay_ratelimits_t *ratelimits;
+
+static key_t dbrelay_ratelimit_ipc_key()
+{
+   return ftok(DBRELAY_PREFIX, 9);
+}
+static dbrelay_ratelimits_t *dbrelay_ratelimit_get()
+{
+   int shmid;
+   void *p;
+
+   if (ratelimits) return ratelimits;
+
+   shmid = shmget(dbrelay_ratelimit_ipc_key(), sizeof(dbrelay_ratelimits_t), IPC_CREAT | 0600);
+   if (shmid==-1) return NULL;
+   p = shmat(shmid, NULL, 0);
+   if (p==(void *) -1) return NULL;
+   ratelimits = (dbrelay_ratelimits_t *) p;
+
+   return ratelimits;
+}
+void dbrelay_ratelimit_destroy()
+{
+   int shmid;
+
+   if (ratelimits) shmdt(ratelimits);
+   ratelimits = NULL;
+   shmid = shmget(dbrelay_ratelimit_ipc_key(), sizeof(dbrelay_ratelimits_t), 0600);
+   if (shmid!=-1) shmctl(shmid, IPC_RMID, NULL);
+}
+static void dbrelay_bucket_lock(dbrelay_bucket_t *b)
+{
+   while (__sync_lock_test_and_set(&b->lock, 1)) sched_yield();
+}
+static void dbrelay_bucket_unlock(dbrelay_bucket_t *b)
+{
+   __sync_lock_release(&b->lock);
+}
+static unsigned long dbrelay_ratelimit_now()
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return (unsigned long) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+static char *key_names[] = { "remote_addr", "sql_user", "query_tag" };
+
+static char *dbrelay_ratelimit_key(dbrelay_request_t *request, dbrelay_ratelimit_t *rule)
+{
+   switch (rule->key) {
+      case DBRELAY_RATELIMIT_SQL_USER: return request->sql_user;
+      case DBRELAY_RATELIMIT_QUERY_TAG: return request->query_tag;
+      default: return request->remote_addr;
+   }
+}
+static int dbrelay_bucket_matches(dbrelay_bucket_t *b, unsigned int hash, unsigned int rule, char *key)
+{
+   return b->state==BUCKET_READY && b->hash==hash && b->rule==rule && !strcmp(b->key, key);
+}
+static int dbrelay_bucket_reusable(dbrelay_bucket_t *b, time_t now)
+{
+   return b->state==BUCKET_FREE || (b->inflight==0 && b->used + DBRELAY_RATELIMIT_IDLE < now);
+}
+/*
+ * the bucket for rule and key, locked, or NULL if there is no room. A
+ * match found without the lock is checked again once it is held.
+ */
+static dbrelay_bucket_t *dbrelay_ratelimit_bucket(dbrelay_ratelimits_t *rl, dbrelay_ratelimit_t *rule, char *key)
+{
+   dbrelay_bucket_t *b, *spare = NULL;
+   unsigned int hash = 5381 + rule->id * 33;
+   time_t now = time(NULL);
+   char *s;
+   int n;
+
+   for (s=key; *s; s++) hash = hash * 33 + (unsigned char) *s;
+
+   for (n=0; n<DBRELAY_RATELIMIT_PROBE; n++) {
+      b = &rl->buckets[(hash + n) % DBRELAY_RATELIMIT_BUCKETS];
+      if (dbrelay_bucket_matches(b, hash, rule->id, key)) {
+         dbrelay_bucket_lock(b);
+         if (dbrelay_bucket_matches(b, hash, rule->id, key)) return b;
+         dbrelay_bucket_unlock(b);
+      }
+      if (!spare && dbrelay_bucket_reusable(b, now)) spare = b;
+      if (b->state==BUCKET_FREE) break;
+   }
+   if (!spare) return NULL;
+
+   dbrelay_bucket_lock(spare);
+   if (!dbrelay_bucket_reusable(spare, now)) {
+      dbrelay_bucket_unlock(spare);
+      return NULL;
+   }
+   spare->hash = hash;
+   spare->rule = rule->id;
+   dbrelay_copy_string(spare->key, key, sizeof(spare->key));
+   spare->tokens = (rule->burst + 1) * TOKEN;
+   spare->refilled = dbrelay_ratelimit_now();
+   spare->used = now;
+   spare->inflight = 0;
+   memset(spare->holders, 0, sizeof(spare->holders));
+   spare->state = BUCKET_READY;
+   return spare;
+}
+/* returns places held by workers that died mid query, bucket locked */
+static void dbrelay_bucket_reap(dbrelay_bucket_t *b)
+{
+   int i;
+
+   for (i=0; i<DBRELAY_RATELIMIT_CONCURRENCY; i++) {
+      if (b->holders[i] && kill(b->holders[i], 0)) {
+         b->holders[i] = 0;
+         b->inflight--;
+      }
+   }
+}
+/* put back the tokens taken under rules checked before the one that failed */
+static void dbrelay_ratelimit_refund(dbrelay_request_t *request, dbrelay_bucket_t **charged)
+{
+   dbrelay_bucket_t *b;
+   unsigned long cap;
+   int i;
+
+   for (i=0; i<request->nrate_limits; i++) {
+      if (!(b = charged[i])) continue;
+      cap = (request->rate_limits[i].burst + 1) * TOKEN;
+      dbrelay_bucket_lock(b);
+      b->tokens += TOKEN;
+      if (b->tokens > cap) b->tokens = cap;
+      dbrelay_bucket_unlock(b);
+   }
+}
+/*
+ * apply the request's rules in turn. Returns the rule it breaks, with
+ * request->retry_after set, having given back anything taken under the
+ * others, or NULL if it may go ahead.
+ */
+dbrelay_ratelimit_t *dbrelay_ratelimit_acquire(dbrelay_request_t *request)
+{
+   dbrelay_ratelimits_t *rl;
+   dbrelay_ratelimit_t *rule;
+   dbrelay_bucket_t *b, *charged[DBRELAY_RATELIMIT_RULES];
+   unsigned long now, cap, added;
+   char *key;
+   int i, h;
+
+   memset(request->rate_held, 0, sizeof(request->rate_held));
+   memset(charged, 0, sizeof(charged));
+   request->retry_after = 0;
+   if (!request->nrate_limits || !(rl = dbrelay_ratelimit_get())) return NULL;
+
+   for (i=0; i<request->nrate_limits; i++) {
+      rule = &request->rate_limits[i];
+      key = dbrelay_ratelimit_key(request, rule);
+      /* nothing to count by, e.g. no query_tag, so the rule doesn't apply */
+      if (!*key) continue;
+      if (!(b = dbrelay_ratelimit_bucket(rl, rule, key))) continue;
+
+      if (rule->rate) {
+         now = dbrelay_ratelimit_now();
+         cap = (rule->burst + 1) * TOKEN;
+         /* only the time turned into tokens is used up, the rest carries over */
+         if (now > b->refilled) {
+            /* no longer than it takes to fill, so a long idle bucket can't overflow */
+            added = now - b->refilled;
+            if (added > cap * MINUTE / rule->rate) added = cap * MINUTE / rule->rate;
+            added = added * rule->rate / MINUTE;
+            b->tokens += added;
+            b->refilled += added * MINUTE / rule->rate;
+         }
+         if (b->tokens >= cap) {
+            b->tokens = cap;
+            b->refilled = now;
+         }
+         if (b->tokens < TOKEN) {
+            /* secs until a whole token, rounded up */
+            request->retry_after = ((TOKEN - b->tokens) * MINUTE / rule->rate + 999999) / 1000000;
+            if (!request->retry_after) request->retry_after = 1;
+            dbrelay_bucket_unlock(b);
+            dbrelay_log_warn(request, "rate limit for %s '%s' exceeded", key_names[rule->key], key);
+            dbrelay_ratelimit_refund(request, charged);
+            dbrelay_ratelimit_release(request);
+            return rule;
+         }
+      }
+      if (rule->concurrency) {
+         if (b->inflight >= (int) rule->concurrency) dbrelay_bucket_reap(b);
+         for (h=0; h<DBRELAY_RATELIMIT_CONCURRENCY && b->holders[h]; h++);
+         if (b->inflight >= (int) rule->concurrency || h==DBRELAY_RATELIMIT_CONCURRENCY) {
+            request->retry_after = 1;
+            dbrelay_bucket_unlock(b);
+            dbrelay_log_warn(request, "%d requests already running for %s '%s'", b->inflight, key_names[rule->key], key);
+            dbrelay_ratelimit_refund(request, charged);
+            dbrelay_ratelimit_release(request);
+            return rule;
+         }
+         b->holders[h] = getpid();
+         b->inflight++;
+         request->rate_held[i] = (b - rl->buckets) * DBRELAY_RATELIMIT_CONCURRENCY + h + 1;
+      }
+      if (rule->rate) {
+         b->tokens -= TOKEN;
+         charged[i] = b;
+      }
+      b->used = time(NULL);
+      dbrelay_bucket_unlock(b);
+   }
+   return NULL;
+}
+/* give back the concurrency places taken by acquire */
+void dbrelay_ratelimit_release(dbrelay_request_t *request)
+{
+   dbrelay_bucket_t *b;
+   int i, h;
+
+   if (!ratelimits) return;
+
+   for (i=0; i<DBRELAY_RATELIMIT_RULES; i++) {
+      if (!request->rate_held[i]) continue;
+      b = &ratelimits->buckets[(request->rate_held[i] - 1) / DBRELAY_RATELIMIT_CONCURRENCY];
+      h = (request->rate_held[i] - 1) % DBRELAY_RATELIMIT_CONCURRENCY;
+      dbrelay_bucket_lock(b);
+      if (b->holders[h]) {
+         b->holders[h] = 0;
+         b->inflight--;
+      }
+      b->used = time(NULL);
+      dbrelay_bucket_unlock(b);
+      request->rate_held[i] = 0;
+   }
+}
@@ -0,0 +1,219 @@
+/*
+ * DB Relay is an HTTP module built on the NGiNX webserver platform which 
+ * communicates with a variety of database servers and returns JSON formatted 
+ * data.
+ * 
+ * Copyright (C) 2008-2010 Getco LLC
+ * 
+ * This program is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by the Free 
+ * Software Foundation, either version 3 of the License, or (at your option) 
+ * any later version. In addition, redistributions in source code and in binary 
+ * form must 
+ * include the above copyright notices, and each of the following disclaimers. 
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS “AS IS” 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANY COPYRIGHT OWNERS OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Routing across a location's group of backends.  A request that does not
+ * name its own sql_server is sent to one of the group's replicas if it is
+ * read only, by flag or by query_tag, and to a primary otherwise, always
+ * one within a transaction.  Of the candidates the one with the fewest 
+ * queries outstanding, counted by all workers in a SysV segment, is taken.
+ */
+
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <signal.h>
+#include "dbrelay.h"
+#include "../include/dbrelay_config.h"
+
+#define DBRELAY_ROUTER_SERVERS 64
+/* requests one server can have outstanding before it is not tracked */
+#define DBRELAY_ROUTER_HOLDERS 256
+/* secs between sweeps for requests lost with their worker */
+#define DBRELAY_ROUTER_REAP 5
+
+#define SERVER_FREE 0
+#define SERVER_CLAIMED 1
+#define SERVER_READY 2
+
+typedef struct {
+   volatile unsigned int state;
+   unsigned int hash;
+   char sql_server[DBRELAY_NAME_SZ];
+   char sql_port[6];
+   volatile int outstanding;
+   volatile pid_t holders[DBRELAY_ROUTER_HOLDERS];
+} dbrelay_route_t;
+
+typedef struct {
+   dbrelay_route_t servers[DBRELAY_ROUTER_SERVERS];
+} dbrelay_router_t;
+
+static dbrelay_router_t *router;
+static time_t router_reaped;
+static unsigned int router_turn;
+
+static key_t dbrelay_router_ipc_key()
+{
+   return ftok(DBRELAY_PREFIX, 10);
+}
+static dbrelay_router_t *dbrelay_router_get()
+{
+   int shmid;
+   void *p;
+
+   if (router) return router;
+
+   shmid = shmget(dbrelay_router_ipc_key(), sizeof(dbrelay_router_t), IPC_CREAT | 0600);
+   if (shmid==-1) return NULL;
+   p = shmat(shmid, NULL, 0);
+   if (p==(void *) -1) return NULL;
+   router = (dbrelay_router_t *) p;
+
+   return router;
+}
+void dbrelay_router_destroy()
+{
+   int shmid;
+
+   if (router) shmdt(router);
+   router = NULL;
+   shmid = shmget(dbrelay_router_ipc_key(), sizeof(dbrelay_router_t), 0600);
+   if (shmid!=-1) shmctl(shmid, IPC_RMID, NULL);
+}
+/* find or claim the entry for a server, NULL once the table is full */
+static dbrelay_route_t *dbrelay_router_server(dbrelay_router_t *rt, dbrelay_route_backend_t *backend)
+{
+   dbrelay_route_t *r;
+   unsigned int hash = 5381;
+   char *s;
+   int i, n;
+
+   for (s=backend->sql_server; *s; s++) hash = hash * 33 + (unsigned char) *s;
+   hash = hash * 33 + ':';
+   for (s=backend->sql_port; *s; s++) hash = hash * 33 + (unsigned char) *s;
+
+   for (n=0; n<DBRELAY_ROUTER_SERVERS; n++) {
+      i = (hash + n) % DBRELAY_ROUTER_SERVERS;
+      r = &rt->servers[i];
+      if (r->state==SERVER_FREE && __sync_bool_compare_and_swap(&r->state, SERVER_FREE, SERVER_CLAIMED)) {
+         r->hash = hash;
+         strcpy(r->sql_server, backend->sql_server);
+         strcpy(r->sql_port, backend->sql_port);
+         __sync_synchronize();
+         r->state = SERVER_READY;
+         return r;
+      }
+      while (r->state==SERVER_CLAIMED);
+      if (r->hash==hash && 
+          !strcmp(r->sql_server, backend->sql_server) &&
+          !strcmp(r->sql_port, backend->sql_port))
+         return r;
+   }
+   return NULL;
+}
+/* forget requests whose worker died before they finished */
+static void dbrelay_router_reap(dbrelay_router_t *rt)
+{
+   dbrelay_route_t *r;
+   pid_t pid;
+   int i, h;
+
+   for (i=0; i<DBRELAY_ROUTER_SERVERS; i++) {
+      r = &rt->servers[i];
+      if (r->state!=SERVER_READY || !r->outstanding) continue;
+      for (h=0; h<DBRELAY_ROUTER_HOLDERS; h++) {
+         pid = r->holders[h];
+         if (pid && kill(pid, 0) && __sync_bool_compare_and_swap(&r->holders[h], pid, 0))
+            __sync_fetch_and_add(&r->outstanding, -1);
+      }
+   }
+}
+static int dbrelay_router_is_readonly(dbrelay_request_t *request)
+{
+   if (request->flags & DBRELAY_FLAG_XACT) return 0;
+   return (request->flags & DBRELAY_FLAG_READONLY)!=0;
+}
+/*
+ * pick a backend from the request's group and fill in sql_server and
+ * sql_port. Does nothing for a request that names its own server.
+ */
+void dbrelay_router_route(dbrelay_request_t *request)
+{
+   dbrelay_router_t *rt;
+   dbrelay_route_backend_t *backend, *best = NULL;
+   dbrelay_route_t *r, *best_r = NULL;
+   int i, n, h, replica, have_replica = 0;
+
+   request->routed = 0;
+   if (!request->nbackends || strlen(request->sql_server)) return;
+
+   for (i=0; i<request->nbackends; i++) 
+      if (request->backends[i].replica) have_replica = 1;
+   replica = have_replica && dbrelay_router_is_readonly(request);
+
+   if ((rt = dbrelay_router_get()) && time(NULL) - router_reaped >= DBRELAY_ROUTER_REAP) {
+      router_reaped = time(NULL);
+      dbrelay_router_reap(rt);
+   }
+
+   /* start at a different place each time so ties are spread out */
+   router_turn++;
+   for (n=0; n<request->nbackends; n++) {
+      backend = &request->backends[(router_turn + n) % request->nbackends];
+      if (backend->replica!=replica) continue;
+      r = rt ? dbrelay_router_server(rt, backend) : NULL;
+      /* an untracked backend (the table is full) only wins if nothing else is tracked */
+      if (!best || (r && (!best_r || r->outstanding < best_r->outstanding))) {
+         best = backend;
+         best_r = r;
+      }
+   }
+   /* every backend is a replica, writes have nowhere better to go */
+   if (!best) best = &request->backends[router_turn % request->nbackends];
+
+   dbrelay_copy_string(request->sql_server, best->sql_server, sizeof(request->sql_server));
+   dbrelay_copy_string(request->sql_port, best->sql_port, sizeof(request->sql_port));
+   dbrelay_log_info(request, "routed %s request to %s", replica ? "read only" : "read/write", best->sql_server);
+
+   if (!best_r) return;
+   for (h=0; h<DBRELAY_ROUTER_HOLDERS; h++) {
+      if (!best_r->holders[h] && __sync_bool_compare_and_swap(&best_r->holders[h], 0, getpid())) {
+         __sync_fetch_and_add(&best_r->outstanding, 1);
+         request->routed = (best_r - rt->servers) * DBRELAY_ROUTER_HOLDERS + h + 1;
+         return;
+      }
+   }
+}
+/* the routed request is finished */
+void dbrelay_router_done(dbrelay_request_t *request)
+{
+   dbrelay_route_t *r;
+
+   if (!request->routed || !router) return;
+   r = &router->servers[(request->routed - 1) / DBRELAY_ROUTER_HOLDERS];
+   if (__sync_bool_compare_and_swap(&r->holders[(request->routed - 1) % DBRELAY_ROUTER_HOLDERS], getpid(), 0))
+      __sync_fetch_and_add(&r->outstanding, -1);
+   request->routed = 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * DB Relay is an HTTP module built on the NGiNX webserver platform which 
+ * communicates with a variety of database servers and returns JSON formatted 
+ * data.
+ * 
+ * Copyright (C) 2008-2010 Getco LLC
+ * 
+ * This program is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by the Free 
+ * Software Foundation, either version 3 of the License, or (at your option) 
+ * any later version. In addition, redistributions in source code and in binary 
+ * form must 
+ * include the above copyright notices, and each of the following disclaimers. 
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS “AS IS” 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANY COPYRIGHT OWNERS OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Slow query capture.  The last DBRELAY_SLOWLOG_ENTRIES requests that ran
+ * longer than their slow_query_time are kept in a SysV segment, newer ones
+ * overwriting the oldest.  Writers claim a position with an atomic add and
+ * guard the entry with a sequence number, odd while it is being written, 
+ * so readers can tell a torn copy and skip it.
+ */
+
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include "dbrelay.h"
+#include "../include/dbrelay_config.h"
+
+#define DBRELAY_SLOWLOG_ENTRIES 256
+
+typedef struct {
+   volatile unsigned long head;
+   dbrelay_slowlog_entry_t entries[DBRELAY_SLOWLOG_ENTRIES];
+} dbrelay_slowlog_t;
+
+static dbrelay_slowlog_t *slowlog;
+
+static key_t dbrelay_slowlog_ipc_key()
+{
+   return ftok(DBRELAY_PREFIX, 4);
+}
+static dbrelay_slowlog_t *dbrelay_slowlog_get(int create)
+{
+   int shmid;
+   void *p;
+
+   if (slowlog) return slowlog;
+
+   shmid = shmget(dbrelay_slowlog_ipc_key(), sizeof(dbrelay_slowlog_t), (create ? IPC_CREAT : 0) | 0600);
+   if (shmid==-1) return NULL;
+   p = shmat(shmid, NULL, 0);
+   if (p==(void *) -1) return NULL;
+   slowlog = (dbrelay_slowlog_t *) p;
+
+   return slowlog;
+}
+void dbrelay_slowlog_destroy()
+{
+   int shmid;
+
+   if (slowlog) shmdt(slowlog);
+   slowlog = NULL;
+   shmid = shmget(dbrelay_slowlog_ipc_key(), sizeof(dbrelay_slowlog_t), 0600);
+   if (shmid!=-1) shmctl(shmid, IPC_RMID, NULL);
+}
+/* request->timings.total must be set */
+void dbrelay_slowlog_append(dbrelay_request_t *request)
+{
+   dbrelay_slowlog_t *sl;
+   dbrelay_slowlog_entry_t *e;
+   unsigned long pos;
+   int nparams = 0;
+
+   if (!request->slow_query_time || request->timings.total < request->slow_query_time * 1000) return;
+   if (!(sl = dbrelay_slowlog_get(1))) return;
+
+   pos = __sync_fetch_and_add(&sl->head, 1);
+   e = &sl->entries[pos % DBRELAY_SLOWLOG_ENTRIES];
+
+   e->seq = 2 * pos + 1;
+   __sync_synchronize();
+
+   e->ts = time(NULL);
+   if (request->sql) {
+      e->sql_len = strlen(request->sql);
+      dbrelay_copy_string(e->sql, request->sql, sizeof(e->sql));
+   } else {
+      e->sql_len = 0;
+      e->sql[0] = '\0';
+   }
+   while (request->params && request->params[nparams]) nparams++;
+   e->nparams = nparams;
+   dbrelay_copy_string(e->sql_server, request->sql_server, sizeof(e->sql_server));
+   dbrelay_copy_string(e->sql_database, request->sql_database, sizeof(e->sql_database));
+   dbrelay_copy_string(e->query_tag, request->query_tag, sizeof(e->query_tag));
+   memcpy(&e->timings, &request->timings, sizeof(e->timings));
+
+   __sync_synchronize();
+   e->seq = 2 * pos + 2;
+}
+/*
+ * copy up to max entries into out, newest first, returns the number copied
+ */
+int dbrelay_slowlog_read(dbrelay_slowlog_entry_t *out, int max)
+{
+   dbrelay_slowlog_t *sl;
+   dbrelay_slowlog_entry_t *e;
+   unsigned long head, pos, seq;
+   int n = 0;
+
+   if (!(sl = dbrelay_slowlog_get(0))) return 0;
+
+   head = sl->head;
+   for (pos = head; pos > 0 && head - pos < DBRELAY_SLOWLOG_ENTRIES && n < max; pos--) {
+      e = &sl->entries[(pos - 1) % DBRELAY_SLOWLOG_ENTRIES];
+      seq = e->seq;
+      if (seq!=2 * (pos - 1) + 2) continue;   /* being written or already reused */
+      __sync_synchronize();
+      memcpy(&out[n], e, sizeof(dbrelay_slowlog_entry_t));
+      __sync_synchronize();
+      if (e->seq!=seq) continue;
+      n++;
+   }
+   return n;
+}
@@ -51,6 +51,7 @@
 #define DBRELAY_SOCKET_BUFSIZE 20
 #define HAVE_SO_NOSIGPIPE 1
 #define NET_FLAGS 0
+#define DBRELAY_SOCKET_TIMEOUT -2
 #endif
 
 #define DEBUG 0
@@ -201,10 +202,12 @@ dbrelay_socket_recv_string(int s, char *in_buf, int *in_ptr, char *out_buf, int
       if (DEBUG) printf("ptr %d\n", *in_ptr);
       if (*in_ptr >= DBRELAY_SOCKET_BUFSIZE - 1) *in_ptr=-1;
       if (*in_ptr==-1) {
-         if ((ret=dbrelay_socket_wait(s, SEL_READ, timeout))==-1) {
+         /* only time out between lines, a partial line is always finished */
+         if ((ret=dbrelay_socket_wait(s, SEL_READ, out_ptr ? 0 : timeout))==-1) {
             if (DEBUG) fprintf(stderr, "wait for socket read failed\n"); 
             return ret;
          }
+         if (ret==0) return DBRELAY_SOCKET_TIMEOUT;
          if ((t=recv(s, in_buf, DBRELAY_SOCKET_BUFSIZE - 1, NET_FLAGS))<=0) {
 	   if (t < 0) {
              if (errno==EINTR) {
@@ -261,6 +264,21 @@ dbrelay_socket_recv_string(int s, char *in_buf, int *in_ptr, char *out_buf, int
    if (DEBUG) printf("returning %s\n", out_buf);
    return 1; 
 }
+/*
+ * look at what the peer has sent without blocking or consuming it.  Returns
+ * the number of bytes copied into buf, 0 if the peer closed the connection,
+ * -1 on error and DBRELAY_SOCKET_TIMEOUT if nothing is pending.
+ */
+int
+dbrelay_socket_peek(int s, char *buf, int sz)
+{
+   int t;
+
+   t = recv(s, buf, sz, MSG_PEEK | MSG_DONTWAIT);
+   if (t==-1 && (errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR)) 
+      return DBRELAY_SOCKET_TIMEOUT;
+   return t;
+}
 #if 0
 int
 dbrelay_socket_recv_string(int s, char *in_buf, int *in_ptr, char *out_buf)
@@ -0,0 +1,239 @@
+/*
+ * DB Relay is an HTTP module built on the NGiNX webserver platform which 
+ * communicates with a variety of database servers and returns JSON formatted 
+ * data.
+ * 
+ * Copyright (C) 2008-2010 Getco LLC
+ * 
+ * This program is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by the Free 
+ * Software Foundation, either version 3 of the License, or (at your option) 
+ * any later version. In addition, redistributions in source code and in binary 
+ * form must 
+ * include the above copyright notices, and each of the following disclaimers. 
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS “AS IS” 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANY COPYRIGHT OWNERS OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Warm standby connectors.  A supervisor process keeps a number of idle
+ * connectors running, each listening on its own socket, and records them
+ * in a small table in a SysV segment.  A request that needs a connector
+ * for a new connection name takes one from the table instead of forking
+ * and exec'ing a fresh one while holding the slot table lock, and the 
+ * supervisor tops the table back up in the background.
+ *
+ * The supervisor is forked by whichever nginx worker starts first and
+ * notices there is none running.  It goes away, taking its standbys with
+ * it, when that worker exits, and the next worker to start replaces it.
+ */
+
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <signal.h>
+#include "dbrelay.h"
+#include "../include/dbrelay_config.h"
+
+#define DBRELAY_STANDBY_MAX 64
+/* usecs between checks of the table */
+#define DBRELAY_STANDBY_POLL 200000
+
+#define STANDBY_FREE 0
+#define STANDBY_SPAWNING 1
+#define STANDBY_READY 2
+
+typedef struct {
+   volatile int state;
+   pid_t pid;
+   char sock_path[256];
+} dbrelay_standby_slot_t;
+
+typedef struct {
+   volatile pid_t supervisor;
+   int target;
+   dbrelay_standby_slot_t slots[DBRELAY_STANDBY_MAX];
+} dbrelay_standby_t;
+
+static dbrelay_standby_t *standby;
+static volatile sig_atomic_t standby_stop;
+
+static key_t dbrelay_standby_ipc_key()
+{
+   return ftok(DBRELAY_PREFIX, 6);
+}
+static dbrelay_standby_t *dbrelay_standby_get(int create)
+{
+   int shmid;
+   void *p;
+
+   if (standby) return standby;
+
+   shmid = shmget(dbrelay_standby_ipc_key(), sizeof(dbrelay_standby_t), (create ? IPC_CREAT : 0) | 0600);
+   if (shmid==-1) return NULL;
+   p = shmat(shmid, NULL, 0);
+   if (p==(void *) -1) return NULL;
+   standby = (dbrelay_standby_t *) p;
+
+   return standby;
+}
+/*
+ * hand a ready connector to the caller, copying its socket path into 
+ * sock_path.  Returns 0 if none is available.
+ */
+int dbrelay_standby_take(char *sock_path)
+{
+   dbrelay_standby_t *sb;
+   dbrelay_standby_slot_t *slot;
+   int i;
+
+   if (!(sb = dbrelay_standby_get(0)) || !sb->target) return 0;
+
+   for (i=0; i<DBRELAY_STANDBY_MAX; i++) {
+      slot = &sb->slots[i];
+      if (slot->state!=STANDBY_READY) continue;
+      if (!__sync_bool_compare_and_swap(&slot->state, STANDBY_READY, STANDBY_SPAWNING)) continue;
+      if (slot->pid && kill(slot->pid, 0)==0) {
+         strcpy(sock_path, slot->sock_path);
+         __sync_synchronize();
+         slot->state = STANDBY_FREE;
+         return 1;
+      }
+      /* died while waiting, the supervisor will replace it */
+      slot->state = STANDBY_FREE;
+   }
+   return 0;
+}
+/* start a standby and learn its pid over the connector protocol */
+static pid_t dbrelay_standby_spawn(char *sock_path)
+{
+   pid_t pid;
+   int s, error;
+
+   if (tmpnam(sock_path)==NULL) return 0;
+   if (dbrelay_conn_launch_connector(sock_path, NULL)<=0) return 0;
+
+   s = dbrelay_socket_connect(sock_path, 10, &error);
+   if (s==-1) return 0;
+   pid = dbrelay_conn_initialize(s, NULL);
+   dbrelay_conn_close(s);
+
+   return pid > 0 ? pid : 0;
+}
+static void dbrelay_standby_signal(int sig)
+{
+   standby_stop = 1;
+}
+static void dbrelay_standby_shutdown(dbrelay_standby_t *sb)
+{
+   int i;
+
+   for (i=0; i<DBRELAY_STANDBY_MAX; i++) {
+      if (sb->slots[i].state==STANDBY_READY && sb->slots[i].pid) {
+         kill(sb->slots[i].pid, SIGTERM);
+         unlink(sb->slots[i].sock_path);
+      }
+      sb->slots[i].state = STANDBY_FREE;
+   }
+   sb->supervisor = 0;
+}
+static void dbrelay_standby_supervise(dbrelay_standby_t *sb, pid_t parent)
+{
+   dbrelay_standby_slot_t *slot;
+   sigset_t set;
+   int i, ready;
+
+   /* don't inherit the worker's listening sockets and signal handling */
+   for (i=3; i<sysconf(_SC_OPEN_MAX); i++) close(i);
+   signal(SIGCHLD, SIG_DFL);
+   signal(SIGHUP, SIG_IGN);
+   signal(SIGINT, SIG_IGN);
+   signal(SIGQUIT, dbrelay_standby_signal);
+   signal(SIGTERM, dbrelay_standby_signal);
+   signal(SIGUSR1, SIG_IGN);
+   signal(SIGUSR2, SIG_IGN);
+   signal(SIGWINCH, SIG_IGN);
+   signal(SIGPIPE, SIG_IGN);
+   sigemptyset(&set);
+   sigprocmask(SIG_SETMASK, &set, NULL);
+
+   while (!standby_stop && getppid()==parent) {
+      ready = 0;
+      for (i=0; i<DBRELAY_STANDBY_MAX; i++) {
+         slot = &sb->slots[i];
+         if (slot->state==STANDBY_READY) {
+            if (kill(slot->pid, 0)==0) ready++;
+            else __sync_bool_compare_and_swap(&slot->state, STANDBY_READY, STANDBY_FREE);
+         }
+      }
+      for (i=0; i<DBRELAY_STANDBY_MAX && ready<sb->target && !standby_stop; i++) {
+         slot = &sb->slots[i];
+         if (!__sync_bool_compare_and_swap(&slot->state, STANDBY_FREE, STANDBY_SPAWNING)) continue;
+         slot->pid = dbrelay_standby_spawn(slot->sock_path);
+         __sync_synchronize();
+         if (slot->pid) {
+            slot->state = STANDBY_READY;
+            ready++;
+         } else {
+            slot->state = STANDBY_FREE;
+            break;   /* try again next round */
+         }
+      }
+      usleep(DBRELAY_STANDBY_POLL);
+   }
+   dbrelay_standby_shutdown(sb);
+   _exit(0);
+}
+/*
+ * called as each worker starts, forks the supervisor if there isn't one
+ * running already
+ */
+void dbrelay_standby_start(int target)
+{
+   dbrelay_standby_t *sb;
+   pid_t current, child, me = getpid();
+
+   if (target<=0) return;
+   if (target>DBRELAY_STANDBY_MAX) target = DBRELAY_STANDBY_MAX;
+   if (!(sb = dbrelay_standby_get(1))) return;
+   sb->target = target;
+
+   current = sb->supervisor;
+   if (current && kill(current, 0)==0) return;
+   if (!__sync_bool_compare_and_swap(&sb->supervisor, current, me)) return;
+
+   child = fork();
+   if (child==0) dbrelay_standby_supervise(sb, me);
+   if (child==-1) child = 0;
+   sb->supervisor = child;
+}
+void dbrelay_standby_destroy()
+{
+   dbrelay_standby_t *sb;
+   int shmid;
+
+   if ((sb = dbrelay_standby_get(0))) {
+      if (sb->supervisor>0) kill(sb->supervisor, SIGTERM);
+      shmdt(sb);
+   }
+   standby = NULL;
+   shmid = shmget(dbrelay_standby_ipc_key(), sizeof(dbrelay_standby_t), 0600);
+   if (shmid!=-1) shmctl(shmid, IPC_RMID, NULL);
+}
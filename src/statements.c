@@ -0,0 +1,210 @@
+/*
+ * DB Relay is an HTTP module built on the NGiNX webserver platform which 
+ * communicates with a variety of database servers and returns JSON formatted 
+ * data.
+ * 
+ * Copyright (C) 2008-2010 Getco LLC
+ * 
+ * This program is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by the Free 
+ * Software Foundation, either version 3 of the License, or (at your option) 
+ * any later version. In addition, redistributions in source code and in binary 
+ * form must 
+ * include the above copyright notices, and each of the following disclaimers. 
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS “AS IS” 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANY COPYRIGHT OWNERS OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Per-fingerprint statement statistics, in the spirit of 
+ * pg_stat_statements.  Entries live in an open addressed table in a SysV
+ * segment keyed by the 64 bit fingerprint, claimed by compare-and-swap and
+ * updated with atomic adds.  Latency goes into a log-linear histogram with
+ * two buckets per power of two, percentiles are read off it.
+ */
+
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include "dbrelay.h"
+#include "../include/dbrelay_config.h"
+
+#define DBRELAY_STATEMENTS_MAX 1024
+
+typedef struct {
+   unsigned long overflow;     /* executions that found the table full */
+   dbrelay_statement_t entries[DBRELAY_STATEMENTS_MAX];
+} dbrelay_statements_t;
+
+static dbrelay_statements_t *statements;
+
+static key_t dbrelay_statements_ipc_key()
+{
+   return ftok(DBRELAY_PREFIX, 5);
+}
+static dbrelay_statements_t *dbrelay_statements_get(int create)
+{
+   int shmid;
+   void *p;
+
+   if (statements) return statements;
+
+   shmid = shmget(dbrelay_statements_ipc_key(), sizeof(dbrelay_statements_t), (create ? IPC_CREAT : 0) | 0600);
+   if (shmid==-1) return NULL;
+   p = shmat(shmid, NULL, 0);
+   if (p==(void *) -1) return NULL;
+   statements = (dbrelay_statements_t *) p;
+
+   return statements;
+}
+void dbrelay_statements_destroy()
+{
+   int shmid;
+
+   if (statements) shmdt(statements);
+   statements = NULL;
+   shmid = shmget(dbrelay_statements_ipc_key(), sizeof(dbrelay_statements_t), 0600);
+   if (shmid!=-1) shmctl(shmid, IPC_RMID, NULL);
+}
+/* bucket 2n holds [2^n, 1.5 * 2^n), bucket 2n+1 holds [1.5 * 2^n, 2^(n+1)) */
+static int dbrelay_statement_bucket(unsigned long usecs)
+{
+   int msb = 0;
+   int idx;
+
+   if (usecs < 2) return 0;
+   while (usecs >> (msb + 1)) msb++;
+   idx = 2 * msb + ((usecs >> (msb - 1)) & 1);
+   return idx < DBRELAY_STATEMENT_BUCKETS ? idx : DBRELAY_STATEMENT_BUCKETS - 1;
+}
+static unsigned long dbrelay_statement_bucket_bound(int idx)
+{
+   int msb = idx / 2;
+
+   if (idx==0) return 1;
+   if (idx % 2) return 1UL << (msb + 1);
+   return (1UL << msb) + (1UL << msb) / 2;
+}
+/*
+ * upper bound of the bucket holding the pct'th percentile, never more
+ * than the slowest execution seen
+ */
+unsigned long dbrelay_statement_percentile(dbrelay_statement_t *stmt, int pct)
+{
+   unsigned long want, seen = 0;
+   int i;
+
+   if (!stmt->calls) return 0;
+   want = (stmt->calls * pct + 99) / 100;
+   for (i=0; i<DBRELAY_STATEMENT_BUCKETS; i++) {
+      seen += stmt->buckets[i];
+      if (seen >= want) break;
+   }
+   if (i==DBRELAY_STATEMENT_BUCKETS || dbrelay_statement_bucket_bound(i) > stmt->max_us) return stmt->max_us;
+   return dbrelay_statement_bucket_bound(i);
+}
+static void dbrelay_atomic_min(unsigned long *p, unsigned long v)
+{
+   unsigned long old;
+
+   while ((old = *p)==0 || v < old)
+      if (__sync_bool_compare_and_swap(p, old, v)) return;
+}
+static void dbrelay_atomic_max(unsigned long *p, unsigned long v)
+{
+   unsigned long old;
+
+   while (v > (old = *p))
+      if (__sync_bool_compare_and_swap(p, old, v)) return;
+}
+static dbrelay_statement_t *dbrelay_statements_find(dbrelay_statements_t *st, dbrelay_request_t *request)
+{
+   dbrelay_statement_t *stmt;
+   unsigned long long fp = request->fingerprint;
+   int i, n;
+
+   for (n=0; n<DBRELAY_STATEMENTS_MAX; n++) {
+      i = (fp + n) % DBRELAY_STATEMENTS_MAX;
+      stmt = &st->entries[i];
+      if (stmt->fingerprint==fp) return stmt;
+      if (stmt->fingerprint==0 && __sync_bool_compare_and_swap(&stmt->fingerprint, 0, fp)) {
+         /* only the first execution pays for the normalized text */
+         dbrelay_sql_fingerprint(request->sql, stmt->query, sizeof(stmt->query));
+         __sync_synchronize();
+         stmt->ready = 1;
+         return stmt;
+      }
+      if (stmt->fingerprint==fp) return stmt;
+   }
+   return NULL;
+}
+/* request->fingerprint and request->timings must be complete */
+void dbrelay_statements_record(dbrelay_request_t *request, int err_class)
+{
+   dbrelay_statements_t *st;
+   dbrelay_statement_t *stmt;
+   unsigned long usecs = request->timings.total;
+
+   if (!request->sql || !request->fingerprint) return;
+   if (!(st = dbrelay_statements_get(1))) return;
+
+   if (!(stmt = dbrelay_statements_find(st, request))) {
+      __sync_fetch_and_add(&st->overflow, 1);
+      return;
+   }
+
+   __sync_fetch_and_add(&stmt->calls, 1);
+   if (err_class!=DBRELAY_ERR_NONE) __sync_fetch_and_add(&stmt->errors, 1);
+   __sync_fetch_and_add(&stmt->total_us, usecs);
+   __sync_fetch_and_add(&stmt->rows, request->timings.rows);
+   __sync_fetch_and_add(&stmt->bytes, request->timings.bytes);
+   __sync_fetch_and_add(&stmt->buckets[dbrelay_statement_bucket(usecs)], 1);
+   dbrelay_atomic_min(&stmt->min_us, usecs ? usecs : 1);
+   dbrelay_atomic_max(&stmt->max_us, usecs);
+}
+/*
+ * returns a malloc'd snapshot of every entry in use, *count set to the
+ * number of entries, NULL if there are none
+ */
+dbrelay_statement_t *dbrelay_statements_read(int *count)
+{
+   dbrelay_statements_t *st;
+   dbrelay_statement_t *out;
+   int i, n = 0;
+
+   *count = 0;
+   if (!(st = dbrelay_statements_get(0))) return NULL;
+
+   out = (dbrelay_statement_t *) malloc(sizeof(dbrelay_statement_t) * DBRELAY_STATEMENTS_MAX);
+   for (i=0; i<DBRELAY_STATEMENTS_MAX; i++) {
+      if (!st->entries[i].ready || !st->entries[i].calls) continue;
+      memcpy(&out[n++], &st->entries[i], sizeof(dbrelay_statement_t));
+   }
+   *count = n;
+   return out;
+}
+/* forget everything, entries being updated right now may survive */
+void dbrelay_statements_reset()
+{
+   dbrelay_statements_t *st;
+
+   if (!(st = dbrelay_statements_get(0))) return;
+   memset(st, 0, sizeof(dbrelay_statements_t));
+}
@@ -108,6 +108,19 @@ stringbuf_node_t *sb_append(stringbuf_t *string, char *s)
 
    return new_node;
 }
+/* append the first len bytes of s, which need not be null terminated */
+stringbuf_node_t *sb_append_len(stringbuf_t *string, char *s, size_t len)
+{
+   stringbuf_node_t *new_node = malloc(sizeof(stringbuf_node_t));
+   memset(new_node, 0, sizeof(stringbuf_node_t));
+   new_node->part = malloc(len + 1);
+   memcpy(new_node->part, s, len);
+   new_node->part[len] = '\0';
+   string->tail->next = new_node;
+   string->tail = new_node;
+
+   return new_node;
+}
 
 /*
 main() {
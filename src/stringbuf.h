@@ -53,5 +53,6 @@ int sb_len(stringbuf_t *string);
 void sb_free(stringbuf_t *string);
 stringbuf_t *sb_new(char *s);
 stringbuf_node_t *sb_append(stringbuf_t *string, char *s);
+stringbuf_node_t *sb_append_len(stringbuf_t *string, char *s, size_t len);
 
 #endif /* _STRINGBUF_H_INCLUDED_ */
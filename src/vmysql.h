@@ -43,9 +43,13 @@
 
 typedef struct mysql_db_s {
    MYSQL *mysql;
-   MYSQL_RES *result;
+   MYSQL_RES *result;      /* unbuffered, rows are read from the server as fetched */
    MYSQL_ROW row;
-   MYSQL_FIELD *field;
+   unsigned long *lengths; /* of the columns in row */
+   MYSQL_FIELD *fields;    /* of result, fetched once */
+   unsigned int numcols;
+   unsigned char pending;  /* exec has read the first result's header */
+   dbrelay_request_t *request;
 } mysql_db_t;
 
 void dbrelay_mysql_init();
@@ -66,8 +70,10 @@ int dbrelay_mysql_colprec(void *db, int colnum);
 int dbrelay_mysql_colscale(void *db, int colnum);
 int dbrelay_mysql_fetch_row(void *db);
 char *dbrelay_mysql_colvalue(void *db, int colnum, char *dest);
+int dbrelay_mysql_fetch_batch(void *db, dbrelay_batch_t *batch);
 char *dbrelay_mysql_error(void *db);
 char *dbrelay_mysql_catalogsql(int dbcmd, char **params);
 int dbrelay_mysql_isalive(void *db);
+int dbrelay_mysql_cancel(void *db);
 
 #endif
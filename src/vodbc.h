@@ -42,13 +42,50 @@
 #define TRUE 1
 #define FALSE 0
 
+/* block cursor sizing, rows per SQLFetch are capped by both */
+#define DBRELAY_ODBC_BLOCK_ROWS 256
+#define DBRELAY_ODBC_BLOCK_BYTES 262144
+/* columns wider than this are read with SQLGetData instead of bound */
+#define DBRELAY_ODBC_MAX_BIND 32768
+/* SQLGetData piece size for long columns */
+#define DBRELAY_ODBC_PIECE 8192
+/* prepared statements kept per connection with the prepare flag */
+#define DBRELAY_ODBC_PREPARED 16
+
+typedef struct odbc_prepared_s {
+   char *sql;
+   SQLHSTMT stmt;
+   unsigned long last_used;
+} odbc_prepared_t;
+
+typedef struct odbc_col_s {
+   char name[256];
+   SQLSMALLINT type;
+   SQLULEN size;
+   SQLSMALLINT digits;
+   SQLLEN width;          /* of one value in data */
+   char *data;            /* block of bound values, NULL if read unbound */
+   SQLLEN *ind;
+   char *value;           /* unbound value of the current row */
+   SQLLEN valsz;
+   SQLLEN len;
+   unsigned char loaded;
+} odbc_col_t;
+
 typedef struct odbc_db_s {
-   SQLHENV env;
    SQLHDBC dbc;
-   SQLHSTMT stmt;
+   SQLHSTMT stmt;         /* the statement last executed */
+   SQLHSTMT direct;       /* reused for SQLExecDirect */
+   odbc_prepared_t prepared[DBRELAY_ODBC_PREPARED];
+   unsigned long uses;
    unsigned char querying;
-   char tmpbuf[256];
    SQLCHAR error_message[256];
+   odbc_col_t *cols;      /* described and bound once per result set */
+   SQLSMALLINT numcols;
+   SQLUSMALLINT *status;
+   SQLULEN fetched;       /* rows in the current block */
+   SQLLEN row;            /* current row within the block */
+   dbrelay_request_t *request;
 } odbc_db_t;
 
 void dbrelay_odbc_init();
@@ -69,8 +106,10 @@ int dbrelay_odbc_colprec(void *db, int colnum);
 int dbrelay_odbc_colscale(void *db, int colnum);
 int dbrelay_odbc_fetch_row(void *db);
 char *dbrelay_odbc_colvalue(void *db, int colnum, char *dest);
+int dbrelay_odbc_fetch_batch(void *db, dbrelay_batch_t *batch);
 char *dbrelay_odbc_error(void *db);
 char *dbrelay_odbc_catalogsql(int dbcmd, char **params);
 int dbrelay_odbc_isalive(void *db);
+int dbrelay_odbc_cancel(void *db);
 
 #endif
@@ -0,0 +1,126 @@
+/*
+ * DB Relay is an HTTP module built on the NGiNX webserver platform which 
+ * communicates with a variety of database servers and returns JSON formatted 
+ * data.
+ * 
+ * Copyright (C) 2008-2010 Getco LLC
+ * 
+ * This program is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by the Free 
+ * Software Foundation, either version 3 of the License, or (at your option) 
+ * any later version. In addition, redistributions in source code and in binary 
+ * form must 
+ * include the above copyright notices, and each of the following disclaimers. 
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS “AS IS” 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANY COPYRIGHT OWNERS OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _DBRELAYPGSQL_H_INCLUDED_
+#define _DBRELAYPGSQL_H_INCLUDED_
+
+#include "libpq-fe.h"
+#include "dbrelay.h"
+
+#define TRUE 1
+#define FALSE 0
+
+/* rows per result in chunked rows mode (libpq 17 and later) */
+#define DBRELAY_PGSQL_CHUNK_ROWS 64
+/* statements remembered per connection as safe to fetch in binary */
+#define DBRELAY_PGSQL_FORMATS 128
+
+/* type oids from catalog/pg_type.h, which is not installed with libpq */
+#define PGSQL_BOOLOID        16
+#define PGSQL_BYTEAOID       17
+#define PGSQL_CHAROID        18
+#define PGSQL_NAMEOID        19
+#define PGSQL_INT8OID        20
+#define PGSQL_INT2OID        21
+#define PGSQL_INT4OID        23
+#define PGSQL_TEXTOID        25
+#define PGSQL_OIDOID         26
+#define PGSQL_JSONOID        114
+#define PGSQL_FLOAT4OID      700
+#define PGSQL_FLOAT8OID      701
+#define PGSQL_BPCHAROID      1042
+#define PGSQL_VARCHAROID     1043
+#define PGSQL_DATEOID        1082
+#define PGSQL_TIMEOID        1083
+#define PGSQL_TIMESTAMPOID   1114
+#define PGSQL_TIMESTAMPTZOID 1184
+#define PGSQL_NUMERICOID     1700
+#define PGSQL_UUIDOID        2950
+#define PGSQL_JSONBOID       3802
+
+typedef struct {
+   unsigned long long hash;
+   unsigned long long types;   /* hash of the column type oids it was learned with */
+   int binary;
+} pgsql_format_t;
+
+typedef struct pgsql_db_s {
+   PGconn *conn;
+   PGresult *result;      /* result holding the current row(s) */
+   PGresult *next;        /* first result, read by exec */
+   int row;               /* current row within result, -1 before the first */
+   int ntuples;
+   long rows;             /* rows fetched from the current statement */
+   long affected;         /* PQcmdTuples of a statement without rows */
+   unsigned char busy;    /* results of the last exec not yet read */
+   unsigned char in_rows; /* more row results follow for this statement */
+   unsigned char pipeline;
+   unsigned char row_mode; /* set single row/chunked mode before the next read */
+   unsigned long long *hashes; /* of each statement sent by exec */
+   int nstmts;
+   int stmt;              /* statement the results being read belong to */
+   char *error;
+   PGresult **held;       /* results the current batch still points into */
+   int nheld;
+   int heldsz;
+   unsigned char hold;    /* fetch_row keeps results instead of clearing them */
+   pgsql_format_t formats[DBRELAY_PGSQL_FORMATS];
+   dbrelay_request_t *request;
+} pgsql_db_t;
+
+void dbrelay_pgsql_init();
+void *dbrelay_pgsql_connect(dbrelay_request_t *request);
+void dbrelay_pgsql_close(void *db);
+void dbrelay_pgsql_assign_request(void *db, dbrelay_request_t *request);
+int dbrelay_pgsql_is_quoted(void *db, int colnum);
+int dbrelay_pgsql_connected(void *db);
+int dbrelay_pgsql_change_db(void *db, char *database);
+int dbrelay_pgsql_exec(void *db, char *sql);
+int dbrelay_pgsql_rowcount(void *db);
+int dbrelay_pgsql_has_results(void *db);
+int dbrelay_pgsql_numcols(void *db);
+char *dbrelay_pgsql_colname(void *db, int colnum);
+void dbrelay_pgsql_coltype(void *db, int colnum, char *dest);
+int dbrelay_pgsql_collen(void *db, int colnum);
+int dbrelay_pgsql_colprec(void *db, int colnum);
+int dbrelay_pgsql_colscale(void *db, int colnum);
+int dbrelay_pgsql_fetch_row(void *db);
+char *dbrelay_pgsql_colvalue(void *db, int colnum, char *dest);
+int dbrelay_pgsql_fetch_batch(void *db, dbrelay_batch_t *batch);
+char *dbrelay_pgsql_error(void *db);
+char *dbrelay_pgsql_catalogsql(int dbcmd, char **params);
+int dbrelay_pgsql_isalive(void *db);
+int dbrelay_pgsql_cancel(void *db);
+
+#endif
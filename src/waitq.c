@@ -0,0 +1,173 @@
+/*
+ * DB Relay is an HTTP module built on the NGiNX webserver platform which 
+ * communicates with a variety of database servers and returns JSON formatted 
+ * data.
+ * 
+ * Copyright (C) 2008-2010 Getco LLC
+ * 
+ * This program is free software: you can redistribute it and/or modify it 
+ * under the terms of the GNU General Public License as published by the Free 
+ * Software Foundation, either version 3 of the License, or (at your option) 
+ * any later version. In addition, redistributions in source code and in binary 
+ * form must 
+ * include the above copyright notices, and each of the following disclaimers. 
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT OWNERS AND CONTRIBUTORS “AS IS” 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANY COPYRIGHT OWNERS OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Requests waiting for a connection slot once the pool is exhausted.  The
+ * queue is a fixed table in a SysV segment shared by every worker; each
+ * waiter takes a ticket and only the one at the head, the lowest ticket
+ * of the highest priority class present, tries for a freed slot.  Entries
+ * left by workers that died while waiting are dropped when seen.
+ */
+
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <signal.h>
+#include "dbrelay.h"
+#include "../include/dbrelay_config.h"
+
+#define DBRELAY_WAITQ_SZ 256
+
+#define WAITER_FREE 0
+#define WAITER_CLAIMED 1
+#define WAITER_WAITING 2
+
+typedef struct {
+   volatile int state;
+   pid_t pid;
+   int priority;
+   unsigned long ticket;
+} dbrelay_waiter_t;
+
+typedef struct {
+   volatile unsigned long tickets;
+   dbrelay_waiter_t waiters[DBRELAY_WAITQ_SZ];
+} dbrelay_waitq_t;
+
+static dbrelay_waitq_t *waitq;
+
+static key_t dbrelay_waitq_ipc_key()
+{
+   return ftok(DBRELAY_PREFIX, 7);
+}
+static dbrelay_waitq_t *dbrelay_waitq_get()
+{
+   int shmid;
+   void *p;
+
+   if (waitq) return waitq;
+
+   shmid = shmget(dbrelay_waitq_ipc_key(), sizeof(dbrelay_waitq_t), IPC_CREAT | 0600);
+   if (shmid==-1) return NULL;
+   p = shmat(shmid, NULL, 0);
+   if (p==(void *) -1) return NULL;
+   waitq = (dbrelay_waitq_t *) p;
+
+   return waitq;
+}
+void dbrelay_waitq_destroy()
+{
+   int shmid;
+
+   if (waitq) shmdt(waitq);
+   waitq = NULL;
+   shmid = shmget(dbrelay_waitq_ipc_key(), sizeof(dbrelay_waitq_t), 0600);
+   if (shmid!=-1) shmctl(shmid, IPC_RMID, NULL);
+}
+/*
+ * live waiters ahead of priority/ticket, or of that priority if ticket is 0
+ */
+static int dbrelay_waitq_count(dbrelay_waitq_t *q, int priority, unsigned long ticket)
+{
+   dbrelay_waiter_t *w;
+   int i, count = 0;
+
+   for (i=0; i<DBRELAY_WAITQ_SZ; i++) {
+      w = &q->waiters[i];
+      if (w->state!=WAITER_WAITING) continue;
+      if (kill(w->pid, 0) && __sync_bool_compare_and_swap(&w->state, WAITER_WAITING, WAITER_FREE)) continue;
+      if (ticket ? w->priority < priority || (w->priority==priority && w->ticket < ticket) : w->priority==priority)
+         count++;
+   }
+   return count;
+}
+/* 
+ * join the queue, returning our place in the table and the number of 
+ * waiters ahead in depth, or -1 if it is full
+ */
+int dbrelay_waitq_join(int priority, int *depth)
+{
+   dbrelay_waitq_t *q = dbrelay_waitq_get();
+   dbrelay_waiter_t *w;
+   int i;
+
+   if (!q) return -1;
+
+   for (i=0; i<DBRELAY_WAITQ_SZ; i++) {
+      w = &q->waiters[i];
+      if (w->state!=WAITER_FREE) continue;
+      if (!__sync_bool_compare_and_swap(&w->state, WAITER_FREE, WAITER_CLAIMED)) continue;
+      w->pid = getpid();
+      w->priority = priority;
+      w->ticket = __sync_add_and_fetch(&q->tickets, 1);
+      __sync_synchronize();
+      w->state = WAITER_WAITING;
+      if (depth) *depth = dbrelay_waitq_count(q, priority, w->ticket);
+      return i;
+   }
+   return -1;
+}
+void dbrelay_waitq_leave(int waiter)
+{
+   if (waitq && waiter>=0 && waiter<DBRELAY_WAITQ_SZ) 
+      waitq->waiters[waiter].state = WAITER_FREE;
+}
+/* is the waiter at the head of the queue */
+int dbrelay_waitq_is_next(int waiter)
+{
+   dbrelay_waiter_t *w;
+
+   if (!waitq || waiter<0 || waiter>=DBRELAY_WAITQ_SZ) return 1;
+   w = &waitq->waiters[waiter];
+   return dbrelay_waitq_count(waitq, w->priority, w->ticket)==0;
+}
+/* 
+ * would a new request of this priority be queued behind anyone, so that
+ * it does not take a freed slot out from under them
+ */
+int dbrelay_waitq_ahead(int priority)
+{
+   dbrelay_waitq_t *q = dbrelay_waitq_get();
+
+   if (!q) return 0;
+   return dbrelay_waitq_count(q, priority, (unsigned long) -1);
+}
+/* requests of the priority waiting now */
+int dbrelay_waitq_depth(int priority)
+{
+   dbrelay_waitq_t *q = dbrelay_waitq_get();
+
+   if (!q) return 0;
+   return dbrelay_waitq_count(q, priority, 0);
+}
@@ -0,0 +1,44 @@
+load('jsonpath.js');
+
+print('Checking 1000 parameters...');
+
+var json = '';
+while (line = readline())
+{
+   json = json + line + '\n';
+}
+
+var json2 = eval('(' + json + ')');
+
+if (jsonPath(json2, "$.data[0].fields.length").toString() != 1000)
+{
+   print('failed');
+   quit(1);
+}
+if (jsonPath(json2, "$.data[0].rows[0].c1").toString() != 1)
+{
+   print('failed');
+   quit(2);
+}
+if (jsonPath(json2, "$.data[0].rows[0].c2").toString() != 2)
+{
+   print('failed');
+   quit(3);
+}
+if (jsonPath(json2, "$.data[0].rows[0].c500").toString() != 500)
+{
+   print('failed');
+   quit(4);
+}
+if (jsonPath(json2, "$.data[0].rows[0].c999").toString() != 999)
+{
+   print('failed');
+   quit(5);
+}
+if (jsonPath(json2, "$.data[0].rows[0].c1000").toString() != 1000)
+{
+   print('failed');
+   quit(6);
+}
+print('passed');
+quit(0);
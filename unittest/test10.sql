@@ -0,0 +1,1000 @@
+select ? as c1,
+? as c2,
+? as c3,
+? as c4,
+? as c5,
+? as c6,
+? as c7,
+? as c8,
+? as c9,
+? as c10,
+? as c11,
+? as c12,
+? as c13,
+? as c14,
+? as c15,
+? as c16,
+? as c17,
+? as c18,
+? as c19,
+? as c20,
+? as c21,
+? as c22,
+? as c23,
+? as c24,
+? as c25,
+? as c26,
+? as c27,
+? as c28,
+? as c29,
+? as c30,
+? as c31,
+? as c32,
+? as c33,
+? as c34,
+? as c35,
+? as c36,
+? as c37,
+? as c38,
+? as c39,
+? as c40,
+? as c41,
+? as c42,
+? as c43,
+? as c44,
+? as c45,
+? as c46,
+? as c47,
+? as c48,
+? as c49,
+? as c50,
+? as c51,
+? as c52,
+? as c53,
+? as c54,
+? as c55,
+? as c56,
+? as c57,
+? as c58,
+? as c59,
+? as c60,
+? as c61,
+? as c62,
+? as c63,
+? as c64,
+? as c65,
+? as c66,
+? as c67,
+? as c68,
+? as c69,
+? as c70,
+? as c71,
+? as c72,
+? as c73,
+? as c74,
+? as c75,
+? as c76,
+? as c77,
+? as c78,
+? as c79,
+? as c80,
+? as c81,
+? as c82,
+? as c83,
+? as c84,
+? as c85,
+? as c86,
+? as c87,
+? as c88,
+? as c89,
+? as c90,
+? as c91,
+? as c92,
+? as c93,
+? as c94,
+? as c95,
+? as c96,
+? as c97,
+? as c98,
+? as c99,
+? as c100,
+? as c101,
+? as c102,
+? as c103,
+? as c104,
+? as c105,
+? as c106,
+? as c107,
+? as c108,
+? as c109,
+? as c110,
+? as c111,
+? as c112,
+? as c113,
+? as c114,
+? as c115,
+? as c116,
+? as c117,
+? as c118,
+? as c119,
+? as c120,
+? as c121,
+? as c122,
+? as c123,
+? as c124,
+? as c125,
+? as c126,
+? as c127,
+? as c128,
+? as c129,
+? as c130,
+? as c131,
+? as c132,
+? as c133,
+? as c134,
+? as c135,
+? as c136,
+? as c137,
+? as c138,
+? as c139,
+? as c140,
+? as c141,
+? as c142,
+? as c143,
+? as c144,
+? as c145,
+? as c146,
+? as c147,
+? as c148,
+? as c149,
+? as c150,
+? as c151,
+? as c152,
+? as c153,
+? as c154,
+? as c155,
+? as c156,
+? as c157,
+? as c158,
+? as c159,
+? as c160,
+? as c161,
+? as c162,
+? as c163,
+? as c164,
+? as c165,
+? as c166,
+? as c167,
+? as c168,
+? as c169,
+? as c170,
+? as c171,
+? as c172,
+? as c173,
+? as c174,
+? as c175,
+? as c176,
+? as c177,
+? as c178,
+? as c179,
+? as c180,
+? as c181,
+? as c182,
+? as c183,
+? as c184,
+? as c185,
+? as c186,
+? as c187,
+? as c188,
+? as c189,
+? as c190,
+? as c191,
+? as c192,
+? as c193,
+? as c194,
+? as c195,
+? as c196,
+? as c197,
+? as c198,
+? as c199,
+? as c200,
+? as c201,
+? as c202,
+? as c203,
+? as c204,
+? as c205,
+? as c206,
+? as c207,
+? as c208,
+? as c209,
+? as c210,
+? as c211,
+? as c212,
+? as c213,
+? as c214,
+? as c215,
+? as c216,
+? as c217,
+? as c218,
+? as c219,
+? as c220,
+? as c221,
+? as c222,
+? as c223,
+? as c224,
+? as c225,
+? as c226,
+? as c227,
+? as c228,
+? as c229,
+? as c230,
+? as c231,
+? as c232,
+? as c233,
+? as c234,
+? as c235,
+? as c236,
+? as c237,
+? as c238,
+? as c239,
+? as c240,
+? as c241,
+? as c242,
+? as c243,
+? as c244,
+? as c245,
+? as c246,
+? as c247,
+? as c248,
+? as c249,
+? as c250,
+? as c251,
+? as c252,
+? as c253,
+? as c254,
+? as c255,
+? as c256,
+? as c257,
+? as c258,
+? as c259,
+? as c260,
+? as c261,
+? as c262,
+? as c263,
+? as c264,
+? as c265,
+? as c266,
+? as c267,
+? as c268,
+? as c269,
+? as c270,
+? as c271,
+? as c272,
+? as c273,
+? as c274,
+? as c275,
+? as c276,
+? as c277,
+? as c278,
+? as c279,
+? as c280,
+? as c281,
+? as c282,
+? as c283,
+? as c284,
+? as c285,
+? as c286,
+? as c287,
+? as c288,
+? as c289,
+? as c290,
+? as c291,
+? as c292,
+? as c293,
+? as c294,
+? as c295,
+? as c296,
+? as c297,
+? as c298,
+? as c299,
+? as c300,
+? as c301,
+? as c302,
+? as c303,
+? as c304,
+? as c305,
+? as c306,
+? as c307,
+? as c308,
+? as c309,
+? as c310,
+? as c311,
+? as c312,
+? as c313,
+? as c314,
+? as c315,
+? as c316,
+? as c317,
+? as c318,
+? as c319,
+? as c320,
+? as c321,
+? as c322,
+? as c323,
+? as c324,
+? as c325,
+? as c326,
+? as c327,
+? as c328,
+? as c329,
+? as c330,
+? as c331,
+? as c332,
+? as c333,
+? as c334,
+? as c335,
+? as c336,
+? as c337,
+? as c338,
+? as c339,
+? as c340,
+? as c341,
+? as c342,
+? as c343,
+? as c344,
+? as c345,
+? as c346,
+? as c347,
+? as c348,
+? as c349,
+? as c350,
+? as c351,
+? as c352,
+? as c353,
+? as c354,
+? as c355,
+? as c356,
+? as c357,
+? as c358,
+? as c359,
+? as c360,
+? as c361,
+? as c362,
+? as c363,
+? as c364,
+? as c365,
+? as c366,
+? as c367,
+? as c368,
+? as c369,
+? as c370,
+? as c371,
+? as c372,
+? as c373,
+? as c374,
+? as c375,
+? as c376,
+? as c377,
+? as c378,
+? as c379,
+? as c380,
+? as c381,
+? as c382,
+? as c383,
+? as c384,
+? as c385,
+? as c386,
+? as c387,
+? as c388,
+? as c389,
+? as c390,
+? as c391,
+? as c392,
+? as c393,
+? as c394,
+? as c395,
+? as c396,
+? as c397,
+? as c398,
+? as c399,
+? as c400,
+? as c401,
+? as c402,
+? as c403,
+? as c404,
+? as c405,
+? as c406,
+? as c407,
+? as c408,
+? as c409,
+? as c410,
+? as c411,
+? as c412,
+? as c413,
+? as c414,
+? as c415,
+? as c416,
+? as c417,
+? as c418,
+? as c419,
+? as c420,
+? as c421,
+? as c422,
+? as c423,
+? as c424,
+? as c425,
+? as c426,
+? as c427,
+? as c428,
+? as c429,
+? as c430,
+? as c431,
+? as c432,
+? as c433,
+? as c434,
+? as c435,
+? as c436,
+? as c437,
+? as c438,
+? as c439,
+? as c440,
+? as c441,
+? as c442,
+? as c443,
+? as c444,
+? as c445,
+? as c446,
+? as c447,
+? as c448,
+? as c449,
+? as c450,
+? as c451,
+? as c452,
+? as c453,
+? as c454,
+? as c455,
+? as c456,
+? as c457,
+? as c458,
+? as c459,
+? as c460,
+? as c461,
+? as c462,
+? as c463,
+? as c464,
+? as c465,
+? as c466,
+? as c467,
+? as c468,
+? as c469,
+? as c470,
+? as c471,
+? as c472,
+? as c473,
+? as c474,
+? as c475,
+? as c476,
+? as c477,
+? as c478,
+? as c479,
+? as c480,
+? as c481,
+? as c482,
+? as c483,
+? as c484,
+? as c485,
+? as c486,
+? as c487,
+? as c488,
+? as c489,
+? as c490,
+? as c491,
+? as c492,
+? as c493,
+? as c494,
+? as c495,
+? as c496,
+? as c497,
+? as c498,
+? as c499,
+? as c500,
+? as c501,
+? as c502,
+? as c503,
+? as c504,
+? as c505,
+? as c506,
+? as c507,
+? as c508,
+? as c509,
+? as c510,
+? as c511,
+? as c512,
+? as c513,
+? as c514,
+? as c515,
+? as c516,
+? as c517,
+? as c518,
+? as c519,
+? as c520,
+? as c521,
+? as c522,
+? as c523,
+? as c524,
+? as c525,
+? as c526,
+? as c527,
+? as c528,
+? as c529,
+? as c530,
+? as c531,
+? as c532,
+? as c533,
+? as c534,
+? as c535,
+? as c536,
+? as c537,
+? as c538,
+? as c539,
+? as c540,
+? as c541,
+? as c542,
+? as c543,
+? as c544,
+? as c545,
+? as c546,
+? as c547,
+? as c548,
+? as c549,
+? as c550,
+? as c551,
+? as c552,
+? as c553,
+? as c554,
+? as c555,
+? as c556,
+? as c557,
+? as c558,
+? as c559,
+? as c560,
+? as c561,
+? as c562,
+? as c563,
+? as c564,
+? as c565,
+? as c566,
+? as c567,
+? as c568,
+? as c569,
+? as c570,
+? as c571,
+? as c572,
+? as c573,
+? as c574,
+? as c575,
+? as c576,
+? as c577,
+? as c578,
+? as c579,
+? as c580,
+? as c581,
+? as c582,
+? as c583,
+? as c584,
+? as c585,
+? as c586,
+? as c587,
+? as c588,
+? as c589,
+? as c590,
+? as c591,
+? as c592,
+? as c593,
+? as c594,
+? as c595,
+? as c596,
+? as c597,
+? as c598,
+? as c599,
+? as c600,
+? as c601,
+? as c602,
+? as c603,
+? as c604,
+? as c605,
+? as c606,
+? as c607,
+? as c608,
+? as c609,
+? as c610,
+? as c611,
+? as c612,
+? as c613,
+? as c614,
+? as c615,
+? as c616,
+? as c617,
+? as c618,
+? as c619,
+? as c620,
+? as c621,
+? as c622,
+? as c623,
+? as c624,
+? as c625,
+? as c626,
+? as c627,
+? as c628,
+? as c629,
+? as c630,
+? as c631,
+? as c632,
+? as c633,
+? as c634,
+? as c635,
+? as c636,
+? as c637,
+? as c638,
+? as c639,
+? as c640,
+? as c641,
+? as c642,
+? as c643,
+? as c644,
+? as c645,
+? as c646,
+? as c647,
+? as c648,
+? as c649,
+? as c650,
+? as c651,
+? as c652,
+? as c653,
+? as c654,
+? as c655,
+? as c656,
+? as c657,
+? as c658,
+? as c659,
+? as c660,
+? as c661,
+? as c662,
+? as c663,
+? as c664,
+? as c665,
+? as c666,
+? as c667,
+? as c668,
+? as c669,
+? as c670,
+? as c671,
+? as c672,
+? as c673,
+? as c674,
+? as c675,
+? as c676,
+? as c677,
+? as c678,
+? as c679,
+? as c680,
+? as c681,
+? as c682,
+? as c683,
+? as c684,
+? as c685,
+? as c686,
+? as c687,
+? as c688,
+? as c689,
+? as c690,
+? as c691,
+? as c692,
+? as c693,
+? as c694,
+? as c695,
+? as c696,
+? as c697,
+? as c698,
+? as c699,
+? as c700,
+? as c701,
+? as c702,
+? as c703,
+? as c704,
+? as c705,
+? as c706,
+? as c707,
+? as c708,
+? as c709,
+? as c710,
+? as c711,
+? as c712,
+? as c713,
+? as c714,
+? as c715,
+? as c716,
+? as c717,
+? as c718,
+? as c719,
+? as c720,
+? as c721,
+? as c722,
+? as c723,
+? as c724,
+? as c725,
+? as c726,
+? as c727,
+? as c728,
+? as c729,
+? as c730,
+? as c731,
+? as c732,
+? as c733,
+? as c734,
+? as c735,
+? as c736,
+? as c737,
+? as c738,
+? as c739,
+? as c740,
+? as c741,
+? as c742,
+? as c743,
+? as c744,
+? as c745,
+? as c746,
+? as c747,
+? as c748,
+? as c749,
+? as c750,
+? as c751,
+? as c752,
+? as c753,
+? as c754,
+? as c755,
+? as c756,
+? as c757,
+? as c758,
+? as c759,
+? as c760,
+? as c761,
+? as c762,
+? as c763,
+? as c764,
+? as c765,
+? as c766,
+? as c767,
+? as c768,
+? as c769,
+? as c770,
+? as c771,
+? as c772,
+? as c773,
+? as c774,
+? as c775,
+? as c776,
+? as c777,
+? as c778,
+? as c779,
+? as c780,
+? as c781,
+? as c782,
+? as c783,
+? as c784,
+? as c785,
+? as c786,
+? as c787,
+? as c788,
+? as c789,
+? as c790,
+? as c791,
+? as c792,
+? as c793,
+? as c794,
+? as c795,
+? as c796,
+? as c797,
+? as c798,
+? as c799,
+? as c800,
+? as c801,
+? as c802,
+? as c803,
+? as c804,
+? as c805,
+? as c806,
+? as c807,
+? as c808,
+? as c809,
+? as c810,
+? as c811,
+? as c812,
+? as c813,
+? as c814,
+? as c815,
+? as c816,
+? as c817,
+? as c818,
+? as c819,
+? as c820,
+? as c821,
+? as c822,
+? as c823,
+? as c824,
+? as c825,
+? as c826,
+? as c827,
+? as c828,
+? as c829,
+? as c830,
+? as c831,
+? as c832,
+? as c833,
+? as c834,
+? as c835,
+? as c836,
+? as c837,
+? as c838,
+? as c839,
+? as c840,
+? as c841,
+? as c842,
+? as c843,
+? as c844,
+? as c845,
+? as c846,
+? as c847,
+? as c848,
+? as c849,
+? as c850,
+? as c851,
+? as c852,
+? as c853,
+? as c854,
+? as c855,
+? as c856,
+? as c857,
+? as c858,
+? as c859,
+? as c860,
+? as c861,
+? as c862,
+? as c863,
+? as c864,
+? as c865,
+? as c866,
+? as c867,
+? as c868,
+? as c869,
+? as c870,
+? as c871,
+? as c872,
+? as c873,
+? as c874,
+? as c875,
+? as c876,
+? as c877,
+? as c878,
+? as c879,
+? as c880,
+? as c881,
+? as c882,
+? as c883,
+? as c884,
+? as c885,
+? as c886,
+? as c887,
+? as c888,
+? as c889,
+? as c890,
+? as c891,
+? as c892,
+? as c893,
+? as c894,
+? as c895,
+? as c896,
+? as c897,
+? as c898,
+? as c899,
+? as c900,
+? as c901,
+? as c902,
+? as c903,
+? as c904,
+? as c905,
+? as c906,
+? as c907,
+? as c908,
+? as c909,
+? as c910,
+? as c911,
+? as c912,
+? as c913,
+? as c914,
+? as c915,
+? as c916,
+? as c917,
+? as c918,
+? as c919,
+? as c920,
+? as c921,
+? as c922,
+? as c923,
+? as c924,
+? as c925,
+? as c926,
+? as c927,
+? as c928,
+? as c929,
+? as c930,
+? as c931,
+? as c932,
+? as c933,
+? as c934,
+? as c935,
+? as c936,
+? as c937,
+? as c938,
+? as c939,
+? as c940,
+? as c941,
+? as c942,
+? as c943,
+? as c944,
+? as c945,
+? as c946,
+? as c947,
+? as c948,
+? as c949,
+? as c950,
+? as c951,
+? as c952,
+? as c953,
+? as c954,
+? as c955,
+? as c956,
+? as c957,
+? as c958,
+? as c959,
+? as c960,
+? as c961,
+? as c962,
+? as c963,
+? as c964,
+? as c965,
+? as c966,
+? as c967,
+? as c968,
+? as c969,
+? as c970,
+? as c971,
+? as c972,
+? as c973,
+? as c974,
+? as c975,
+? as c976,
+? as c977,
+? as c978,
+? as c979,
+? as c980,
+? as c981,
+? as c982,
+? as c983,
+? as c984,
+? as c985,
+? as c986,
+? as c987,
+? as c988,
+? as c989,
+? as c990,
+? as c991,
+? as c992,
+? as c993,
+? as c994,
+? as c995,
+? as c996,
+? as c997,
+? as c998,
+? as c999,
+? as c1000
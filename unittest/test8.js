@@ -0,0 +1,49 @@
+load('jsonpath.js');
+
+print('Checking placeholders in literals and comments...');
+
+var json = '';
+while (line = readline())
+{
+   json = json + line + '\n';
+}
+
+var json2 = eval('(' + json + ')');
+
+if (jsonPath(json2, "$.data[0].rows[0].a").toString() != 'first')
+{
+   print('failed');
+   quit(1);
+}
+if (jsonPath(json2, "$.data[0].rows[0].b").toString() != "it's ?")
+{
+   print('failed');
+   quit(2);
+}
+if (jsonPath(json2, "$.data[0].rows[0].c").toString() != 2)
+{
+   print('failed');
+   quit(3);
+}
+if (jsonPath(json2, "$.data[0].rows[0].d").toString() != "'?'")
+{
+   print('failed');
+   quit(4);
+}
+if (jsonPath(json2, "$.data[0].rows[0].e").toString() != '-- ?')
+{
+   print('failed');
+   quit(5);
+}
+if (jsonPath(json2, "$.data[0].rows[0].f").toString() != '/* ?')
+{
+   print('failed');
+   quit(6);
+}
+if (jsonPath(json2, "$.data[0].rows[0].g").toString() != 'x?y')
+{
+   print('failed');
+   quit(7);
+}
+print('passed');
+quit(0);
@@ -0,0 +1,3 @@
+-- a ? in a line comment is left alone
+select ? as a, 'it''s ?' as b, /* nor this ? */ ? as c,
+'''?''' as d, '-- ?' as e, '/* ?' as f, ? as g
@@ -0,0 +1,19 @@
+load('jsonpath.js');
+
+print('Checking a single parameter...');
+
+var json = '';
+while (line = readline())
+{
+   json = json + line + '\n';
+}
+
+var json2 = eval('(' + json + ')');
+
+if (jsonPath(json2, "$.data[0].rows[0].one").toString() != '?')
+{
+   print('failed');
+   quit(1);
+}
+print('passed');
+quit(0);
@@ -0,0 +1 @@
+select ? as one
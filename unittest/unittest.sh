@@ -26,16 +26,20 @@ if [ "$OPTW" = "-w" ]; then OPTW=""; fi
 
 TESTNAME=$1
 
+# placeholders in the test's sql are bound from its .params file, if any
+OPTP=""
+if [ -f ${TESTNAME}.params ]; then OPTP="-P${TESTNAME}.params"; fi
+
 #OPTC="-c${TESTNAME}"
 
 JS=`which js 2> /dev/null`
 if [ "$JS" = "" -o "x$DEBUG" = "x1" ]
 then
-   echo ../src/dbrelay $OPTU $OPTH $OPTD $OPTC -tunittest -f${TESTNAME}.sql 2> /dev/null 
-   ../src/dbrelay $OPTU $OPTH $OPTD $OPTC -tunittest -f${TESTNAME}.sql 2> /dev/null 
+   echo ../src/dbrelay $OPTU $OPTH $OPTD $OPTC $OPTP -tunittest -f${TESTNAME}.sql 2> /dev/null 
+   ../src/dbrelay $OPTU $OPTH $OPTD $OPTC $OPTP -tunittest -f${TESTNAME}.sql 2> /dev/null 
 else
    # spidermonkey's readline() doesn't differentiate between blank lines
    # and EOF, so the sed here adds a space to the begining of each line.
-   ../src/dbrelay $OPTU $OPTH $OPTD $OPTC -tunittest -f${TESTNAME}.sql 2> /dev/null | sed -e 's/^/ /' | $JS ${TESTNAME}.js
+   ../src/dbrelay $OPTU $OPTH $OPTD $OPTC $OPTP -tunittest -f${TESTNAME}.sql 2> /dev/null | sed -e 's/^/ /' | $JS ${TESTNAME}.js
 fi
 